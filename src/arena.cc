@@ -0,0 +1,158 @@
+#include "arena.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <new>
+
+#if defined __linux__
+# include <sys/mman.h>
+# include <unistd.h>
+#endif
+
+namespace {
+
+// chunk size without huge pages
+const size_t kSmallChunkSize = 256 * 1024;
+// smallest page size of the platforms supported
+const size_t kPageSize = 4096;
+
+size_t round_up(size_t n, size_t alignment) {
+    return (n + alignment - 1) / alignment * alignment;
+}
+
+#if defined __linux__
+// 2MB aligned anonymous mapping of 'size'(a multiple of 2MB), 0 on failure.
+// 'hugetlb' is set if it is from hugetlbfs, 'advised' if MADV_HUGEPAGE was accepted.
+char * map_huge(size_t size, bool * hugetlb, bool * advised) {
+    *hugetlb = false;
+    *advised = false;
+    void * p;
+# if defined MAP_HUGETLB
+    p = mmap(0, size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED) {
+        *hugetlb = true;
+        return (char *)p;
+    }
+# endif
+
+    // Map one huge page more, and trim both ends to a 2MB boundary.
+    size_t mapped = size + Arena::kHugePageSize;
+    p = mmap(0, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        return 0;
+    }
+    char * base = (char *)p;
+    char * aligned = (char *)round_up((uintptr_t)base, Arena::kHugePageSize);
+    if (aligned > base) {
+        munmap(base, aligned - base);
+    }
+    char * end = base + mapped;
+    if (end > aligned + size) {
+        munmap(aligned + size, end - (aligned + size));
+    }
+# if defined MADV_HUGEPAGE
+    *advised = madvise(aligned, size, MADV_HUGEPAGE) == 0;
+# endif
+    return aligned;
+}
+#endif
+
+}
+
+const size_t Arena::kHugePageSize;
+const size_t Arena::kAlignment;
+
+Arena::Arena(bool huge_pages, int numa_node)
+    : chunks_(), current_(0), remains_(0), huge_pages_(huge_pages), numa_node_(numa_node),
+    size_(0), used_(0), huge_page_bytes_(0), numa_bytes_(0) {
+}
+
+Arena::~Arena() {
+    for (size_t i = 0; i < chunks_.size(); i++) {
+        const Chunk& chunk = chunks_[i];
+#if defined __linux__
+        if (chunk.mapped) {
+            munmap(chunk.base, chunk.size);
+            continue;
+        }
+#endif
+        free(chunk.base);
+    }
+}
+
+void Arena::add_chunk(size_t bytes) {
+    Chunk chunk;
+    chunk.base = 0;
+    chunk.mapped = false;
+#if defined __linux__
+    if (huge_pages_) {
+        chunk.size = round_up(bytes, kHugePageSize);
+        bool hugetlb, advised;
+        chunk.base = map_huge(chunk.size, &hugetlb, &advised);
+        if (chunk.base) {
+            chunk.mapped = true;
+            if (hugetlb || advised) {
+                huge_page_bytes_ += chunk.size;
+            }
+        }
+    }
+    if (!chunk.base && numa_node_ != Numa::kAnyNode) {
+        // mbind needs whole pages, malloc may share them with other data
+        chunk.size = round_up(bytes, (size_t)sysconf(_SC_PAGESIZE));
+        void * p = mmap(0, chunk.size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p != MAP_FAILED) {
+            chunk.base = (char *)p;
+            chunk.mapped = true;
+        }
+    }
+    if (chunk.base && numa_node_ != Numa::kAnyNode
+            && Numa::bind(chunk.base, chunk.size, numa_node_)) {
+        numa_bytes_ += chunk.size;
+    }
+#endif
+    if (!chunk.base) {
+        // malloc aligns to 16 at least, keep room to align to kAlignment
+        chunk.size = std::max(bytes + kAlignment, kSmallChunkSize);
+        chunk.base = (char *)malloc(chunk.size);
+        if (!chunk.base) {
+            throw std::bad_alloc();
+        }
+    }
+    chunks_.push_back(chunk);
+    size_ += chunk.size;
+    current_ = (char *)round_up((uintptr_t)chunk.base, kAlignment);
+    remains_ = chunk.size - (current_ - chunk.base);
+}
+
+void Arena::reserve(size_t bytes) {
+    if (remains_ < bytes) {
+        add_chunk(bytes);
+    }
+}
+
+void * Arena::allocate(size_t bytes) {
+    size_t aligned = allocation_size(bytes);
+    if (remains_ < aligned) {
+        add_chunk(std::max(aligned, huge_pages_ ? kHugePageSize : kSmallChunkSize));
+    }
+    void * p = current_;
+    current_ += aligned;
+    remains_ -= aligned;
+    used_ += aligned;
+    return p;
+}
+
+uint64_t Arena::touch() const {
+    uint64_t sum = 0;
+    for (size_t i = 0, s = chunks_.size(); i < s; i++) {
+        const char * p = chunks_[i].base;
+        // the rest of the last chunk is not allocated yet
+        const char * end = i + 1 == s ? current_ : p + chunks_[i].size;
+        for (; p < end; p += kPageSize) {
+            sum += *(const volatile char *)p;
+        }
+    }
+    return sum;
+}
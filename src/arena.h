@@ -0,0 +1,89 @@
+#ifndef WAND_ENGINE_ARENA_H
+#define WAND_ENGINE_ARENA_H
+
+#include "numa.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Bump allocator whose memory is freed all at once by the destructor.
+//
+// With 'huge_pages', chunks are 2MB aligned anonymous mappings, so random
+// accesses into them miss the TLB far less often. On Linux a chunk is taken
+// from hugetlbfs(MAP_HUGETLB) if pages are reserved there, otherwise it is
+// advised with MADV_HUGEPAGE for transparent huge pages. When neither works,
+// or on other platforms, chunks come from malloc.
+//
+// With 'numa_node'(a node id or Numa::kInterleave), every chunk is mapped
+// and bound to the node before its first touch. Chunks the kernel refuses
+// to bind are kept where they are.
+// Not thread safe.
+class Arena {
+public:
+    static const size_t kHugePageSize = 2 * 1024 * 1024;
+    // alignment of every allocation, like malloc
+    static const size_t kAlignment = 16;
+
+private:
+    struct Chunk {
+        char * base;
+        size_t size;
+        bool mapped;// by mmap, otherwise by malloc
+    };
+
+    std::vector<Chunk> chunks_;
+    char * current_;
+    size_t remains_;
+    const bool huge_pages_;
+    const int numa_node_;
+    size_t size_;
+    size_t used_;
+    size_t huge_page_bytes_;
+    size_t numa_bytes_;
+
+    void add_chunk(size_t bytes);
+
+public:
+    explicit Arena(bool huge_pages = true, int numa_node = Numa::kAnyNode);
+    ~Arena();
+
+    // Make sure the next allocations of 'bytes' in total(including alignment)
+    // come from one chunk, sum allocation_size of them.
+    void reserve(size_t bytes);
+    // aligned to kAlignment
+    void * allocate(size_t bytes);
+    // bytes allocate(bytes) takes from a chunk
+    static size_t allocation_size(size_t bytes) {
+        return ((bytes ? bytes : 1) + kAlignment - 1) / kAlignment * kAlignment;
+    }
+
+    // bytes of all chunks
+    size_t size() const {
+        return size_;
+    }
+
+    // bytes allocated, including alignment padding
+    size_t used() const {
+        return used_;
+    }
+
+    // bytes of chunks from hugetlbfs or advised with MADV_HUGEPAGE
+    size_t huge_page_bytes() const {
+        return huge_page_bytes_;
+    }
+
+    // bytes of chunks bound by 'numa_node'
+    size_t numa_bytes() const {
+        return numa_bytes_;
+    }
+
+    // Read one byte of every page allocated so far, so later reads don't fault.
+    // Return their sum, only to keep the reads.
+    uint64_t touch() const;
+
+private:
+    Arena(Arena& other);
+    Arena& operator=(Arena& other);
+};
+
+#endif// WAND_ENGINE_ARENA_H
@@ -0,0 +1,37 @@
+#ifndef WAND_ENGINE_ATOMIC_H
+#define WAND_ENGINE_ATOMIC_H
+
+#if defined _MSC_VER
+# include <intrin.h>
+#endif
+
+// Minimal full barrier atomic operations on integers of 4 or 8 bytes.
+
+template <typename T>
+inline T atomic_fetch_add(volatile T * p, T v) {
+#if defined _MSC_VER
+    if (sizeof(T) == 8) {
+        return (T)_InterlockedExchangeAdd64((volatile __int64 *)p, (__int64)v);
+    }
+    return (T)_InterlockedExchangeAdd((volatile long *)p, (long)v);
+#else
+    return __sync_fetch_and_add(p, v);
+#endif
+}
+
+// Set *p to 'desired' if it is 'expected', return whether it was.
+template <typename T>
+inline bool atomic_compare_exchange(volatile T * p, T expected, T desired) {
+#if defined _MSC_VER
+    if (sizeof(T) == 8) {
+        return _InterlockedCompareExchange64((volatile __int64 *)p,
+            (__int64)desired, (__int64)expected) == (__int64)expected;
+    }
+    return _InterlockedCompareExchange((volatile long *)p,
+        (long)desired, (long)expected) == (long)expected;
+#else
+    return __sync_bool_compare_and_swap(p, expected, desired);
+#endif
+}
+
+#endif// WAND_ENGINE_ATOMIC_H
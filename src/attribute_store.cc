@@ -0,0 +1,274 @@
+#include "attribute_store.h"
+
+namespace {
+
+// IN values spanning at most this many are tested by a bitmap, 8KB at most
+const uint64_t kMaxBitmapSpan = 65536;
+
+template <typename ColumnType>
+struct Column_IdLess {
+    bool operator()(const ColumnType * column, IdType id) const {
+        return column->id < id;
+    }
+};
+
+}
+
+const AttributeValue AttributeStore::kMissing;
+
+AttributeStore::~AttributeStore() {
+    clear();
+}
+
+AttributeStore::Column * AttributeStore::get_column(IdType id) {
+    std::vector<Column *>::iterator it =
+        std::lower_bound(columns_.begin(), columns_.end(), id, Column_IdLess<Column>());
+    if (it != columns_.end() && (*it)->id == id) {
+        return *it;
+    }
+    Column * column = new Column();
+    column->id = id;
+    column->values.assign(doc_count_, kMissing);
+    columns_.insert(it, column);
+    return column;
+}
+
+void AttributeStore::append(const AttributeVector& attributes) {
+    for (size_t i = 0, s = columns_.size(); i < s; i++) {
+        columns_[i]->values.push_back(kMissing);
+    }
+    doc_count_++;
+    for (size_t i = 0, s = attributes.size(); i < s; i++) {
+        get_column(attributes[i].id)->values[doc_count_ - 1] = attributes[i].value;
+    }
+}
+
+void AttributeStore::clear() {
+    for (size_t i = 0, s = columns_.size(); i < s; i++) {
+        delete columns_[i];
+    }
+    columns_.clear();
+    doc_count_ = 0;
+}
+
+const AttributeValue * AttributeStore::find(IdType id) const {
+    std::vector<Column *>::const_iterator it =
+        std::lower_bound(columns_.begin(), columns_.end(), id, Column_IdLess<Column>());
+    if (it == columns_.end() || (*it)->id != id || doc_count_ == 0) {
+        return 0;
+    }
+    return &(*it)->values[0];
+}
+
+AttributeValue AttributeStore::get(OrdinalType ordinal, IdType id) const {
+    const AttributeValue * column = find(id);
+    if (!column || ordinal >= doc_count_) {
+        return kMissing;
+    }
+    return column[ordinal];
+}
+
+std::ostream& AttributeStore::dump(std::ostream& os) const {
+    for (size_t i = 0, s = columns_.size(); i < s; i++) {
+        const Column * column = columns_[i];
+        os << "attribute id: " << column->id << "\n";
+        for (size_t j = 0; j < doc_count_; j++) {
+            if (column->values[j] != kMissing) {
+                os << "  ordinal: " << j << ", value: " << column->values[j] << "\n";
+            }
+        }
+    }
+    return os;
+}
+
+AttributeFilter& AttributeFilter::range(IdType attribute_id,
+        AttributeValue min, AttributeValue max) {
+    Predicate predicate;
+    predicate.attribute_id = attribute_id;
+    predicate.type = RANGE;
+    predicate.min = min;
+    predicate.max = max;
+    predicates_.push_back(predicate);
+    return *this;
+}
+
+AttributeFilter& AttributeFilter::equal(IdType attribute_id, AttributeValue value) {
+    return range(attribute_id, value, value);
+}
+
+AttributeFilter& AttributeFilter::in(IdType attribute_id,
+        const std::vector<AttributeValue>& values) {
+    Predicate predicate;
+    predicate.attribute_id = attribute_id;
+    predicate.type = IN;
+    predicate.min = 0;
+    predicate.max = 0;
+    predicate.values = values;
+    predicates_.push_back(predicate);
+    return *this;
+}
+
+std::ostream& AttributeFilter::dump(std::ostream& os) const {
+    for (size_t i = 0, s = predicates_.size(); i < s; i++) {
+        const Predicate& predicate = predicates_[i];
+        os << "attribute id: " << predicate.attribute_id;
+        if (predicate.type == RANGE) {
+            os << " in [" << predicate.min << ", " << predicate.max << "]\n";
+        } else {
+            os << " in {";
+            for (size_t j = 0, js = predicate.values.size(); j < js; j++) {
+                os << (j ? ", " : "") << predicate.values[j];
+            }
+            os << "}\n";
+        }
+    }
+    return os;
+}
+
+namespace {
+
+// plain ranges, then bitmaps, then binary searches
+template <typename TestType>
+int test_cost(const TestType& test) {
+    if (test.values != (size_t)-1) {
+        return 2;
+    }
+    return test.bits != (size_t)-1 ? 1 : 0;
+}
+
+struct Test_CostLess {
+    template <typename TestType>
+    bool operator()(const TestType& a, const TestType& b) const {
+        return test_cost(a) < test_cost(b);
+    }
+};
+
+}
+
+void AttributeMatcher::clear() {
+    tests_.clear();
+    bits_.clear();
+    values_.clear();
+}
+
+bool AttributeMatcher::compile(const AttributeFilter& filter, const AttributeStore& store) {
+    clear();
+    const std::vector<AttributeFilter::Predicate>& predicates = filter.predicates();
+    for (size_t i = 0, s = predicates.size(); i < s; i++) {
+        const AttributeFilter::Predicate& predicate = predicates[i];
+        Test test;
+        test.column = store.find(predicate.attribute_id);
+        test.bits = (size_t)-1;
+        test.values = (size_t)-1;
+        test.value_count = 0;
+        if (!test.column) {
+            clear();
+            return false;
+        }
+
+        AttributeValue min, max;
+        if (predicate.type == AttributeFilter::RANGE) {
+            // kMissing is below every range
+            min = std::max(predicate.min, AttributeStore::kMissing + 1);
+            max = predicate.max;
+            if (min > max) {
+                clear();
+                return false;
+            }
+        } else {
+            size_t first = values_.size();
+            for (size_t j = 0, js = predicate.values.size(); j < js; j++) {
+                if (predicate.values[j] != AttributeStore::kMissing) {
+                    values_.push_back(predicate.values[j]);
+                }
+            }
+            std::sort(values_.begin() + first, values_.end());
+            values_.erase(std::unique(values_.begin() + first, values_.end()), values_.end());
+            size_t count = values_.size() - first;
+            if (count == 0) {
+                clear();
+                return false;
+            }
+            min = values_[first];
+            max = values_.back();
+            uint64_t span = (uint64_t)max - (uint64_t)min;
+            if (span == count - 1) {
+                // consecutive values, the range check is enough
+                values_.resize(first);
+            } else if (span < kMaxBitmapSpan) {
+                test.bits = bits_.size();
+                bits_.resize(bits_.size() + span / 64 + 1, 0);
+                for (size_t j = first; j < values_.size(); j++) {
+                    uint64_t offset = (uint64_t)values_[j] - (uint64_t)min;
+                    bits_[test.bits + (offset >> 6)] |= (uint64_t)1 << (offset & 63);
+                }
+                values_.resize(first);
+            } else {
+                test.values = first;
+                test.value_count = count;
+            }
+        }
+        test.min = min;
+        test.span = (uint64_t)max - (uint64_t)min;
+        tests_.push_back(test);
+    }
+    std::stable_sort(tests_.begin(), tests_.end(), Test_CostLess());
+    return true;
+}
+
+size_t AttributeMatcher::select_range(const Test& test, const OrdinalType * ordinals,
+        uint32_t * selection, size_t count) const {
+    const AttributeValue * column = test.column;
+    uint64_t min = (uint64_t)test.min;
+    uint64_t span = test.span;
+    // no branch, every index is written and kept if it passes
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+        uint32_t index = selection[i];
+        selection[n] = index;
+        n += (uint64_t)column[ordinals[index]] - min <= span;
+    }
+    return n;
+}
+
+size_t AttributeMatcher::select_bits(const Test& test, const OrdinalType * ordinals,
+        uint32_t * selection, size_t count) const {
+    const AttributeValue * column = test.column;
+    const uint64_t * bits = &bits_[test.bits];
+    uint64_t min = (uint64_t)test.min;
+    uint64_t span = test.span;
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+        uint32_t index = selection[i];
+        uint64_t offset = (uint64_t)column[ordinals[index]] - min;
+        uint64_t in_range = offset <= span;
+        offset = in_range ? offset : 0;
+        selection[n] = index;
+        n += (bits[offset >> 6] >> (offset & 63)) & in_range;
+    }
+    return n;
+}
+
+size_t AttributeMatcher::select(const OrdinalType * ordinals, size_t count,
+        uint32_t * selection) const {
+    for (size_t i = 0; i < count; i++) {
+        selection[i] = (uint32_t)i;
+    }
+    for (size_t t = 0, ts = tests_.size(); t < ts && count > 0; t++) {
+        const Test& test = tests_[t];
+        if (test.values != (size_t)-1) {
+            size_t n = 0;
+            for (size_t i = 0; i < count; i++) {
+                if (pass(test, ordinals[selection[i]])) {
+                    selection[n++] = selection[i];
+                }
+            }
+            count = n;
+        } else if (test.bits != (size_t)-1) {
+            count = select_bits(test, ordinals, selection, count);
+        } else {
+            count = select_range(test, ordinals, selection, count);
+        }
+    }
+    return count;
+}
@@ -0,0 +1,195 @@
+#ifndef WAND_ENGINE_ATTRIBUTE_STORE_H
+#define WAND_ENGINE_ATTRIBUTE_STORE_H
+
+#include "document.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
+#include <ostream>
+#include <vector>
+
+// Numeric attributes of the docs of an InvertedIndex, one column per attribute id,
+// each indexed by doc ordinal. A doc without an attribute has kMissing in its column,
+// which no AttributeFilter matches.
+class AttributeStore {
+public:
+    static const AttributeValue kMissing = -0x7fffffffffffffffLL - 1;
+
+private:
+    struct Column {
+        IdType id;
+        std::vector<AttributeValue> values;
+    };
+
+    std::vector<Column *> columns_;// sorted by id
+    size_t doc_count_;
+
+    Column * get_column(IdType id);
+
+public:
+    AttributeStore() : columns_(), doc_count_(0) {}
+    ~AttributeStore();
+
+    // Append the attributes of the doc of ordinal doc_count(),
+    // the last value of an attribute id wins.
+    void append(const AttributeVector& attributes);
+    void clear();
+
+    size_t doc_count() const {
+        return doc_count_;
+    }
+
+    size_t column_count() const {
+        return columns_.size();
+    }
+
+    IdType column_id(size_t i) const {
+        return columns_[i]->id;
+    }
+
+    const std::vector<AttributeValue>& column_values(size_t i) const {
+        return columns_[i]->values;
+    }
+
+    // doc_count() values of attribute 'id', 0 if no doc has it
+    const AttributeValue * find(IdType id) const;
+    AttributeValue get(OrdinalType ordinal, IdType id) const;
+
+    std::ostream& dump(std::ostream& os) const;
+
+private:
+    AttributeStore(AttributeStore& other);
+    AttributeStore& operator=(AttributeStore& other);
+};
+
+inline std::ostream& operator << (std::ostream& os, const AttributeStore& store) {
+    store.dump(os);
+    return os;
+}
+
+// Predicates on attributes, a doc passes the filter if it passes all of them.
+// Bounds are inclusive, a doc missing the attribute of a predicate never passes it.
+class AttributeFilter {
+public:
+    enum PredicateType {
+        RANGE,// min <= value <= max
+        IN// value is one of 'values'
+    };
+
+    struct Predicate {
+        IdType attribute_id;
+        PredicateType type;
+        AttributeValue min;
+        AttributeValue max;
+        std::vector<AttributeValue> values;
+    };
+
+private:
+    std::vector<Predicate> predicates_;
+
+public:
+    AttributeFilter() : predicates_() {}
+
+    AttributeFilter& range(IdType attribute_id, AttributeValue min, AttributeValue max);
+    AttributeFilter& equal(IdType attribute_id, AttributeValue value);
+    // 'values' in any order
+    AttributeFilter& in(IdType attribute_id, const std::vector<AttributeValue>& values);
+
+    void clear() {
+        predicates_.clear();
+    }
+
+    bool empty() const {
+        return predicates_.empty();
+    }
+
+    const std::vector<Predicate>& predicates() const {
+        return predicates_;
+    }
+
+    std::ostream& dump(std::ostream& os) const;
+};
+
+inline std::ostream& operator << (std::ostream& os, const AttributeFilter& filter) {
+    filter.dump(os);
+    return os;
+}
+
+// An AttributeFilter compiled against the columns of an AttributeStore,
+// which search evaluates on candidate docs before scoring them.
+//
+// Every predicate becomes a test of one column: a range check of the value,
+// then for IN a bitmap over [min, max] of the values if it is small enough,
+// otherwise a binary search in them. Tests are ordered cheapest first.
+// 'select' runs one tight loop per test over a batch of docs,
+// so candidates failing a test are never loaded by the next ones.
+class AttributeMatcher {
+private:
+    struct Test {
+        const AttributeValue * column;
+        AttributeValue min;
+        uint64_t span;// max - min
+        // IN only, one of them is used
+        size_t bits;// offset in 'bits_', -1 if none
+        size_t values;// offset in 'values_', -1 if none
+        size_t value_count;
+    };
+
+    std::vector<Test> tests_;
+    std::vector<uint64_t> bits_;
+    std::vector<AttributeValue> values_;
+
+    bool pass(const Test& test, OrdinalType ordinal) const {
+        uint64_t offset = (uint64_t)test.column[ordinal] - (uint64_t)test.min;
+        if (offset > test.span) {
+            return false;
+        }
+        if (test.bits != (size_t)-1) {
+            return (bits_[test.bits + (offset >> 6)] >> (offset & 63)) & 1;
+        }
+        if (test.values != (size_t)-1) {
+            const AttributeValue * first = &values_[test.values];
+            return std::binary_search(first, first + test.value_count, test.column[ordinal]);
+        }
+        return true;
+    }
+
+    // Keep the indexes in 'selection' of 'ordinals' passing 'test'.
+    size_t select_range(const Test& test, const OrdinalType * ordinals,
+            uint32_t * selection, size_t count) const;
+    size_t select_bits(const Test& test, const OrdinalType * ordinals,
+            uint32_t * selection, size_t count) const;
+
+public:
+    AttributeMatcher() : tests_(), bits_(), values_() {}
+
+    // Return false if no doc of 'store' can pass 'filter',
+    // e.g. an attribute no doc has, or an empty range.
+    // 'store' must not change while this is used.
+    bool compile(const AttributeFilter& filter, const AttributeStore& store);
+    void clear();
+
+    // whether there is anything to test
+    bool active() const {
+        return !tests_.empty();
+    }
+
+    bool match(OrdinalType ordinal) const {
+        for (size_t i = 0, s = tests_.size(); i < s; i++) {
+            if (!pass(tests_[i], ordinal)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Fill 'selection' with the indexes of 'ordinals' passing,
+    // in increasing order, and return how many they are.
+    size_t select(const OrdinalType * ordinals, size_t count, uint32_t * selection) const;
+
+private:
+    AttributeMatcher(AttributeMatcher& other);
+    AttributeMatcher& operator=(AttributeMatcher& other);
+};
+
+#endif// WAND_ENGINE_ATTRIBUTE_STORE_H
@@ -0,0 +1,742 @@
+// Reproducible benchmark of Wand engines on a synthetic corpus.
+//
+// Term ids of docs and queries follow a Zipf distribution over the vocabulary,
+// everything is generated from '--seed', so the same options give the same corpus
+// and queries on every machine.
+//
+// usage: wand-bench [--name=value ...], run "wand-bench --help" for options.
+#include "wand.h"
+#include "perf_counters.h"
+#include "sharded_index.h"
+#include "timer.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct BenchOptions {
+    size_t docs;
+    size_t vocabulary;
+    double doc_skew;// Zipf exponent of terms in docs
+    size_t doc_terms;// mean terms per doc
+    size_t queries;
+    double query_skew;// Zipf exponent of terms in queries
+    size_t query_terms;
+    // terms every query starts with, in addition to 'query_terms'
+    size_t shared_terms;
+    std::string weights;// uniform or zipf
+    size_t max_weight;
+    size_t k;
+    uint64_t threshold;
+    size_t warmup;
+    size_t batch_size;// queries per Wand::search_batch of the batch engines
+    std::string engines;
+    uint64_t seed;
+    bool perf;// hardware counters per phase
+    size_t prefetch;// Wand::set_prefetch_distance
+    bool huge_pages;// InvertedIndex::seal
+    size_t shards;// of the sharded engines, 0 means one per NUMA node
+    size_t shard_threads;// per shard, 0 means one per CPU of its node
+    // percent of docs passing the attribute filter of searches, 100 means no filter
+    size_t filter;
+
+    BenchOptions()
+        : docs(100000), vocabulary(100000), doc_skew(1.0), doc_terms(50),
+        queries(1000), query_skew(1.0), query_terms(20), shared_terms(0),
+        weights("uniform"), max_weight(100),
+        k(100), threshold(0), warmup(10), batch_size(16),
+        engines("wand,taat,taat_v1,taat_v2,wand_sealed,taat_sealed"),
+        seed(1), perf(true), prefetch(Wand::kDefaultPrefetchDistance),
+        huge_pages(true), shards(0), shard_threads(1), filter(100) {
+    }
+};
+
+// xorshift64*, the same sequence on every platform unlike rand()
+class Random {
+private:
+    uint64_t state_;
+
+public:
+    explicit Random(uint64_t seed) : state_(seed ? seed : 0x9e3779b97f4a7c15ULL) {}
+
+    uint64_t next() {
+        state_ ^= state_ >> 12;
+        state_ ^= state_ << 25;
+        state_ ^= state_ >> 27;
+        return state_ * 0x2545f4914f6cdd1dULL;
+    }
+
+    // [0, 1)
+    double next_double() {
+        return (next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+    // [0, n)
+    size_t next_size(size_t n) {
+        return (size_t)(next_double() * n);
+    }
+};
+
+// rank in [0, n), P(rank) ~ 1 / (rank + 1)^skew
+class ZipfDistribution {
+private:
+    std::vector<double> cdf_;
+
+public:
+    ZipfDistribution(size_t n, double skew) : cdf_(n) {
+        double sum = 0;
+        for (size_t i = 0; i < n; i++) {
+            sum += 1.0 / pow((double)(i + 1), skew);
+            cdf_[i] = sum;
+        }
+        for (size_t i = 0; i < n; i++) {
+            cdf_[i] /= sum;
+        }
+    }
+
+    size_t next(Random * random) const {
+        double u = random->next_double();
+        size_t rank = std::upper_bound(cdf_.begin(), cdf_.end(), u) - cdf_.begin();
+        return rank < cdf_.size() ? rank : cdf_.size() - 1;
+    }
+};
+
+// Spread ranks over the id space, so frequent terms are not the smallest ids.
+IdType term_id_of_rank(size_t rank) {
+    uint64_t x = (uint64_t)rank + 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return (IdType)((x ^ (x >> 31)) >> 1);// never the sentinel id
+}
+
+// Docs get a bucket in [0, 100) when searches are filtered,
+// derived from the doc id so the terms of the corpus don't change.
+const IdType kBucketAttribute = 1;
+
+AttributeValue bucket_of_doc(IdType doc_id) {
+    return (AttributeValue)(term_id_of_rank((size_t)doc_id) % 100);
+}
+
+// SearchOptions of the engines, with 'filter' when options.filter < 100
+const Wand::SearchOptions * make_search_options(const BenchOptions& options,
+        AttributeFilter * filter, Wand::SearchOptions * search_options) {
+    if (options.filter >= 100) {
+        return 0;
+    }
+    filter->clear();
+    filter->range(kBucketAttribute, 0, (AttributeValue)options.filter - 1);
+    search_options->filter = filter;
+    return search_options;
+}
+
+class WeightGenerator {
+private:
+    size_t max_weight_;
+    ZipfDistribution * zipf_;
+
+public:
+    WeightGenerator(const std::string& distribution, size_t max_weight)
+        : max_weight_(max_weight ? max_weight : 1),
+        zipf_(distribution == "zipf" ? new ZipfDistribution(max_weight_, 1.0) : 0) {
+    }
+
+    ~WeightGenerator() {
+        delete zipf_;
+    }
+
+    // [1, max_weight], small weights are more frequent with zipf
+    WeightType next(Random * random) const {
+        if (zipf_) {
+            return (WeightType)(zipf_->next(random) + 1);
+        }
+        return (WeightType)(random->next_size(max_weight_) + 1);
+    }
+
+private:
+    WeightGenerator(WeightGenerator& other);
+    WeightGenerator& operator=(WeightGenerator& other);
+};
+
+// Return the number of postings inserted.
+// 'Index' is InvertedIndex or ShardedIndex.
+template <typename Index>
+size_t build_corpus(const BenchOptions& options, Random * random, Index * ii) {
+    ZipfDistribution terms(options.vocabulary, options.doc_skew);
+    WeightGenerator weights(options.weights, options.max_weight);
+    DocumentBuilder db;
+    size_t postings = 0;
+    for (size_t i = 0; i < options.docs; i++) {
+        db.id((IdType)i + 1);
+        // [doc_terms / 2, doc_terms * 3 / 2]
+        size_t size = options.doc_terms / 2 + random->next_size(options.doc_terms + 1);
+        for (size_t j = 0; j < size; j++) {
+            db.term(term_id_of_rank(terms.next(random)), weights.next(random));
+        }
+        if (options.filter < 100) {
+            db.attribute(kBucketAttribute, bucket_of_doc((IdType)i + 1));
+        }
+        Document * doc = db.build();
+        postings += doc->terms.size();
+        ii->insert(doc);
+    }
+    return postings;
+}
+
+void build_queries(const BenchOptions& options, Random * random,
+        std::vector<TermVector> * queries) {
+    ZipfDistribution terms(options.vocabulary, options.query_skew);
+    WeightGenerator weights(options.weights, options.max_weight);
+    DocumentBuilder db;
+    // the same terms and weights in every query, like the features of a user or a page
+    TermVector shared;
+    for (size_t j = 0; j < options.shared_terms; j++) {
+        shared.push_back(Term(term_id_of_rank(terms.next(random)), weights.next(random)));
+    }
+    for (size_t i = 0; i < options.queries; i++) {
+        for (size_t j = 0; j < shared.size(); j++) {
+            db.term(shared[j].id, shared[j].weight);
+        }
+        for (size_t j = 0; j < options.query_terms; j++) {
+            db.term(term_id_of_rank(terms.next(random)), weights.next(random));
+        }
+        Document * query = db.build();
+        queries->push_back(query->terms);
+        query->release_ref();
+    }
+}
+
+// 'options' and 'stats' may be 0, the comparison engines ignore 'options'
+// and leave 'stats' cleared.
+typedef void (*EngineType)(Wand * wand, TermVector& query, std::vector<Wand::DocIdScore> * result,
+        const Wand::SearchOptions * options, Wand::QueryStats * stats);
+
+void search_wand(Wand * wand, TermVector& query, std::vector<Wand::DocIdScore> * result,
+        const Wand::SearchOptions * options, Wand::QueryStats * stats) {
+    wand->search(query, result, options, stats);
+}
+
+void search_taat(Wand * wand, TermVector& query, std::vector<Wand::DocIdScore> * result,
+        const Wand::SearchOptions * options, Wand::QueryStats * stats) {
+    wand->search_taat(query, result, options, stats);
+}
+
+void search_taat_v1(Wand * wand, TermVector& query, std::vector<Wand::DocIdScore> * result,
+        const Wand::SearchOptions *, Wand::QueryStats * stats) {
+    if (stats) {
+        stats->clear();
+    }
+    wand->search_taat_v1(query, result);
+}
+
+void search_taat_v2(Wand * wand, TermVector& query, std::vector<Wand::DocIdScore> * result,
+        const Wand::SearchOptions *, Wand::QueryStats * stats) {
+    if (stats) {
+        stats->clear();
+    }
+    wand->search_taat_v2(query, result);
+}
+
+// search_stream stops once it has k docs, the first ones above the threshold by doc id.
+struct StreamCollector {
+    std::vector<Wand::DocIdScore> * result;
+    size_t k;
+};
+
+bool collect_stream(const Wand::DocIdScore& doc, void * arg) {
+    StreamCollector * collector = (StreamCollector *)arg;
+    collector->result->push_back(doc);
+    return collector->result->size() < collector->k;
+}
+
+void search_stream(Wand * wand, TermVector& query, std::vector<Wand::DocIdScore> * result,
+        const Wand::SearchOptions * options, Wand::QueryStats * stats) {
+    result->clear();
+    StreamCollector collector;
+    collector.result = result;
+    collector.k = wand->heap_size();
+    wand->search_stream(query, collect_stream, &collector, options, stats);
+}
+
+struct Engine {
+    const char * name;
+    EngineType search;
+    bool sealed;// runs on the sealed index
+    bool term_groups;// with a TermGroupCache built from the queries
+    bool batch;// Wand::search_batch on batches of queries, 'search' is 0
+};
+
+const Engine kEngines[] = {
+    {"wand", search_wand, false, false, false},
+    {"taat", search_taat, false, false, false},
+    {"taat_v1", search_taat_v1, false, false, false},
+    {"taat_v2", search_taat_v2, false, false, false},
+    {"wand_groups", search_wand, false, true, false},
+    {"batch", 0, false, false, true},
+    {"wand_sealed", search_wand, true, false, false},
+    {"taat_sealed", search_taat, true, false, false},
+    {"stream_sealed", search_stream, true, false, false},
+    {"groups_sealed", search_wand, true, true, false},
+    {"batch_sealed", 0, true, false, true},
+};
+const size_t kEngineCount = sizeof(kEngines) / sizeof(kEngines[0]);
+
+// Engines on their own ShardedIndex, built from the same corpus,
+// queries are searched one by one through ShardedSearcher.
+struct ShardedEngine {
+    const char * name;
+    const char * seal_name;// of the seal phase
+    ShardedIndex::Placement placement;
+};
+
+const ShardedEngine kShardedEngines[] = {
+    {"sharded_local", "seal local", ShardedIndex::PLACE_LOCAL},
+    {"sharded_interleave", "seal interleave", ShardedIndex::PLACE_INTERLEAVE},
+};
+const size_t kShardedEngineCount = sizeof(kShardedEngines) / sizeof(kShardedEngines[0]);
+
+bool has_engine(const BenchOptions& options, const char * name) {
+    std::string list = "," + options.engines + ",";
+    return list.find("," + std::string(name) + ",") != std::string::npos;
+}
+
+// p in [0, 1], 'sorted' must not be empty
+double percentile(const std::vector<uint64_t>& sorted, double p) {
+    size_t i = (size_t)ceil(p * sorted.size());
+    return (double)sorted[i > 0 ? i - 1 : 0];
+}
+
+// Counters and time of one phase of the benchmark.
+struct PhaseReport {
+    std::string name;
+    PerfCounters::Sample sample;
+    uint64_t postings;// 0 if the engine doesn't count them
+    // search phases only, from Wand::QueryStats
+    bool has_split;
+    uint64_t match_ns;
+    uint64_t traverse_ns;
+    uint64_t collect_ns;
+
+    explicit PhaseReport(const std::string& _name)
+        : name(_name), sample(), postings(0), has_split(false),
+        match_ns(0), traverse_ns(0), collect_ns(0) {
+    }
+};
+
+void start_phase(PerfCounters * perf) {
+    if (perf) {
+        perf->start();
+    }
+}
+
+void stop_phase(PerfCounters * perf, PhaseReport * report) {
+    if (perf) {
+        perf->stop(&report->sample);
+    }
+}
+
+// one row of the latency table, 'latencies' in nanoseconds
+void print_latencies(const char * name, std::vector<uint64_t> * latencies,
+        uint64_t total, size_t results) {
+    if (latencies->empty()) {
+        return;
+    }
+    std::sort(latencies->begin(), latencies->end());
+    size_t count = latencies->size();
+
+    // latencies in microseconds
+    printf("%-18s %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f %8.1f\n",
+        name,
+        count / (total / 1e9),
+        total / 1e3 / count,
+        percentile(*latencies, 0.5) / 1e3,
+        percentile(*latencies, 0.9) / 1e3,
+        percentile(*latencies, 0.99) / 1e3,
+        percentile(*latencies, 0.999) / 1e3,
+        latencies->back() / 1e3,
+        (double)results / count);
+}
+
+// 'perf' may be 0, then 'report' gets no counters.
+void run_engine(const BenchOptions& options, const Engine& engine, Wand * wand,
+        const std::vector<TermVector>& queries, PerfCounters * perf, PhaseReport * report) {
+    AttributeFilter filter;
+    Wand::SearchOptions search_options;
+    const Wand::SearchOptions * filtered = make_search_options(options, &filter, &search_options);
+    TermVector query;
+    std::vector<Wand::DocIdScore> result;
+    for (size_t i = 0; i < options.warmup && !queries.empty(); i++) {
+        query = queries[i % queries.size()];
+        engine.search(wand, query, &result, filtered, 0);
+    }
+
+    // Counters are read once around the whole run, nothing per query.
+    std::vector<uint64_t> latencies;
+    latencies.reserve(queries.size());
+    size_t results = 0;
+    size_t groups_matched = 0;
+    uint64_t total = 0;
+    Wand::QueryStats stats;
+    start_phase(perf);
+    for (size_t i = 0; i < queries.size(); i++) {
+        query = queries[i];
+        uint64_t begin = now_ns();
+        engine.search(wand, query, &result, filtered, &stats);
+        uint64_t latency = now_ns() - begin;
+        latencies.push_back(latency);
+        total += latency;
+        results += result.size();
+        groups_matched += stats.groups_matched;
+        report->postings += stats.postings_advanced;
+        report->match_ns += stats.match_ns;
+        report->traverse_ns += stats.traverse_ns;
+        report->collect_ns += stats.collect_ns;
+    }
+    stop_phase(perf, report);
+    report->has_split = report->match_ns + report->traverse_ns + report->collect_ns > 0;
+    print_latencies(engine.name, &latencies, total, results);
+    if (engine.term_groups && !queries.empty()) {
+        printf("%-18s %.2f term groups matched per query\n", "",
+            (double)groups_matched / queries.size());
+    }
+}
+
+// Search 'queries' in batches of options.batch_size like run_engine, a query's latency is
+// that of its batch. search_batch takes no options and counts no postings.
+void run_batch(const BenchOptions& options, const Engine& engine, Wand * wand,
+        const std::vector<TermVector>& queries, PerfCounters * perf, PhaseReport * report) {
+    size_t batch_size = std::max<size_t>(options.batch_size, 1);
+    std::vector<TermVector> batch;
+    std::vector<std::vector<Wand::DocIdScore> > result;
+    for (size_t i = 0; i < options.warmup && !queries.empty(); i += batch_size) {
+        batch.clear();
+        for (size_t j = i; j < i + batch_size && j < options.warmup; j++) {
+            batch.push_back(queries[j % queries.size()]);
+        }
+        wand->search_batch(batch, &result);
+    }
+
+    std::vector<uint64_t> latencies;
+    latencies.reserve(queries.size());
+    size_t results = 0;
+    uint64_t total = 0;
+    start_phase(perf);
+    for (size_t i = 0; i < queries.size(); i += batch_size) {
+        size_t end = std::min(i + batch_size, queries.size());
+        batch.assign(queries.begin() + i, queries.begin() + end);
+        uint64_t begin = now_ns();
+        wand->search_batch(batch, &result);
+        uint64_t latency = now_ns() - begin;
+        latencies.insert(latencies.end(), end - i, latency);
+        total += latency;
+        for (size_t j = 0; j < result.size(); j++) {
+            results += result[j].size();
+        }
+    }
+    stop_phase(perf, report);
+    print_latencies(engine.name, &latencies, total, results);
+}
+
+// Build and seal the sharded index of 'engine', then search like run_engine.
+// The seal is added to 'phases' before the search phase.
+void run_sharded(const BenchOptions& options, const ShardedEngine& engine,
+        const std::vector<TermVector>& queries, PerfCounters * perf,
+        std::vector<PhaseReport> * phases) {
+    Random random(options.seed);
+    ShardedIndex si(options.shards, engine.placement);
+    size_t postings = build_corpus(options, &random, &si);
+    PhaseReport seal(engine.seal_name);
+    start_phase(perf);
+    si.seal(options.huge_pages);
+    stop_phase(perf, &seal);
+    seal.postings = postings;
+    phases->push_back(seal);
+    IndexMemoryUsage usage;
+    si.memory_usage(&usage);
+    printf("%-18s %lu shards on nodes", "", (unsigned long)si.shard_count());
+    for (size_t i = 0; i < si.shard_count(); i++) {
+        printf("%s%d", i ? "," : " ", si.node(i));
+    }
+    printf(", %lu of %lu bytes bound to NUMA nodes\n",
+        (unsigned long)usage.numa_bound, (unsigned long)usage.total());
+
+    ShardedSearcher searcher(si, options.k, (ScoreType)options.threshold, options.shard_threads);
+    for (size_t i = 0; i < searcher.shard_count(); i++) {
+        searcher.wand(i).set_prefetch_distance(options.prefetch);
+    }
+    AttributeFilter filter;
+    Wand::SearchOptions search_options;
+    const Wand::SearchOptions * filtered = make_search_options(options, &filter, &search_options);
+    std::vector<TermVector> batch(1);
+    std::vector<std::vector<Wand::DocIdScore> > result;
+    for (size_t i = 0; i < options.warmup && !queries.empty(); i++) {
+        batch[0] = queries[i % queries.size()];
+        searcher.search(batch, &result, filtered);
+    }
+
+    std::vector<uint64_t> latencies;
+    latencies.reserve(queries.size());
+    size_t results = 0;
+    uint64_t total = 0;
+    phases->push_back(PhaseReport(engine.name));
+    start_phase(perf);
+    for (size_t i = 0; i < queries.size(); i++) {
+        batch[0] = queries[i];
+        uint64_t begin = now_ns();
+        searcher.search(batch, &result, filtered);
+        uint64_t latency = now_ns() - begin;
+        latencies.push_back(latency);
+        total += latency;
+        results += result[0].size();
+    }
+    stop_phase(perf, &phases->back());
+    print_latencies(engine.name, &latencies, total, results);
+}
+
+// 'value' / 'per', "-" if unknown
+void print_ratio(bool valid, double value, double per) {
+    if (valid && per > 0) {
+        printf(" %10.3f", value / per);
+    } else {
+        printf(" %10s", "-");
+    }
+}
+
+void print_phases(const std::vector<PhaseReport>& reports) {
+    printf("%-18s %10s %10s %10s %10s %10s %10s %10s %10s %8s %8s %8s\n",
+        "phase", "postings", "IPC", "ins/post", "cyc/post", "brmis/post",
+        "L1d/post", "LLC/post", "dTLB/post", "match%", "trav%", "collect%");
+    for (size_t i = 0; i < reports.size(); i++) {
+        const PhaseReport& report = reports[i];
+        const PerfCounters::Sample& sample = report.sample;
+        double postings = (double)report.postings;
+        printf("%-18s", report.name.c_str());
+        if (report.postings) {
+            printf(" %10lu", (unsigned long)report.postings);
+        } else {
+            printf(" %10s", "-");
+        }
+        print_ratio(sample.valid[PerfCounters::INSTRUCTIONS] && sample.valid[PerfCounters::CYCLES],
+            (double)sample.values[PerfCounters::INSTRUCTIONS],
+            (double)sample.values[PerfCounters::CYCLES]);
+        print_ratio(sample.valid[PerfCounters::INSTRUCTIONS],
+            (double)sample.values[PerfCounters::INSTRUCTIONS], postings);
+        print_ratio(sample.valid[PerfCounters::CYCLES],
+            (double)sample.values[PerfCounters::CYCLES], postings);
+        print_ratio(sample.valid[PerfCounters::BRANCH_MISSES],
+            (double)sample.values[PerfCounters::BRANCH_MISSES], postings);
+        print_ratio(sample.valid[PerfCounters::L1D_MISSES],
+            (double)sample.values[PerfCounters::L1D_MISSES], postings);
+        print_ratio(sample.valid[PerfCounters::LLC_MISSES],
+            (double)sample.values[PerfCounters::LLC_MISSES], postings);
+        print_ratio(sample.valid[PerfCounters::DTLB_MISSES],
+            (double)sample.values[PerfCounters::DTLB_MISSES], postings);
+        if (report.has_split) {
+            double total = (double)(report.match_ns + report.traverse_ns + report.collect_ns);
+            printf(" %8.1f %8.1f %8.1f\n", report.match_ns * 100 / total,
+                report.traverse_ns * 100 / total, report.collect_ns * 100 / total);
+        } else {
+            printf(" %8s %8s %8s\n", "-", "-", "-");
+        }
+    }
+}
+
+void usage(const BenchOptions& defaults) {
+    std::cout << "usage: wand-bench [--name=value ...]\n"
+        << "  --docs=" << defaults.docs << "\n"
+        << "  --vocabulary=" << defaults.vocabulary << "\n"
+        << "  --doc-skew=" << defaults.doc_skew << "     Zipf exponent of doc terms\n"
+        << "  --doc-terms=" << defaults.doc_terms << "     mean terms per doc\n"
+        << "  --queries=" << defaults.queries << "\n"
+        << "  --query-skew=" << defaults.query_skew << "   Zipf exponent of query terms\n"
+        << "  --query-terms=" << defaults.query_terms << "\n"
+        << "  --shared-terms=" << defaults.shared_terms << "  terms and weights every query starts with\n"
+        << "  --weights=" << defaults.weights << "   uniform or zipf in [1, max-weight]\n"
+        << "  --max-weight=" << defaults.max_weight << "\n"
+        << "  --k=" << defaults.k << "\n"
+        << "  --threshold=" << defaults.threshold << "\n"
+        << "  --warmup=" << defaults.warmup << "       queries run before measuring each engine\n"
+        << "  --engines=" << defaults.engines << "\n"
+        << "      also sharded_local, sharded_interleave, and stream_sealed,\n"
+        << "      which streams docs above the threshold and stops after k of them,\n"
+        << "      wand_groups and groups_sealed, Wand::search with a TermGroupCache\n"
+        << "      built from the queries, see --shared-terms,\n"
+        << "      batch and batch_sealed, Wand::search_batch, which ignore --filter\n"
+        << "  --batch-size=" << defaults.batch_size << "    queries per batch of the batch engines\n"
+        << "  --seed=" << defaults.seed << "\n"
+        << "  --perf=" << defaults.perf << "          hardware counters per phase, Linux only\n"
+        << "  --prefetch=" << defaults.prefetch << "      postings prefetched ahead, 0 disables\n"
+        << "  --huge-pages=" << defaults.huge_pages << "    seal into huge page backed memory\n"
+        << "  --shards=" << defaults.shards << "        of sharded_local and sharded_interleave,"
+        << " 0 means one per NUMA node\n"
+        << "  --shard-threads=" << defaults.shard_threads << " per shard, 0 means one per CPU of its node\n"
+        << "  --filter=" << defaults.filter << "      percent of docs passing an attribute filter,"
+        << " 100 means no filter, taat_v1 and taat_v2 ignore it\n";
+}
+
+bool parse_options(int argc, char ** argv, BenchOptions * options) {
+    for (int i = 1; i < argc; i++) {
+        const char * arg = argv[i];
+        const char * eq = strchr(arg, '=');
+        if (strncmp(arg, "--", 2) != 0 || !eq) {
+            return false;
+        }
+        std::string name(arg + 2, eq);
+        const char * value = eq + 1;
+        if (name == "docs") {
+            options->docs = (size_t)strtoul(value, 0, 10);
+        } else if (name == "vocabulary") {
+            options->vocabulary = (size_t)strtoul(value, 0, 10);
+        } else if (name == "doc-skew") {
+            options->doc_skew = atof(value);
+        } else if (name == "doc-terms") {
+            options->doc_terms = (size_t)strtoul(value, 0, 10);
+        } else if (name == "queries") {
+            options->queries = (size_t)strtoul(value, 0, 10);
+        } else if (name == "query-skew") {
+            options->query_skew = atof(value);
+        } else if (name == "query-terms") {
+            options->query_terms = (size_t)strtoul(value, 0, 10);
+        } else if (name == "shared-terms") {
+            options->shared_terms = (size_t)strtoul(value, 0, 10);
+        } else if (name == "weights") {
+            options->weights = value;
+        } else if (name == "max-weight") {
+            options->max_weight = (size_t)strtoul(value, 0, 10);
+        } else if (name == "k") {
+            options->k = (size_t)strtoul(value, 0, 10);
+        } else if (name == "threshold") {
+            options->threshold = (uint64_t)strtoull(value, 0, 10);
+        } else if (name == "warmup") {
+            options->warmup = (size_t)strtoul(value, 0, 10);
+        } else if (name == "batch-size") {
+            options->batch_size = (size_t)strtoul(value, 0, 10);
+        } else if (name == "engines") {
+            options->engines = value;
+        } else if (name == "seed") {
+            options->seed = (uint64_t)strtoull(value, 0, 10);
+        } else if (name == "perf") {
+            options->perf = atoi(value) != 0;
+        } else if (name == "prefetch") {
+            options->prefetch = (size_t)strtoul(value, 0, 10);
+        } else if (name == "huge-pages") {
+            options->huge_pages = atoi(value) != 0;
+        } else if (name == "shards") {
+            options->shards = (size_t)strtoul(value, 0, 10);
+        } else if (name == "shard-threads") {
+            options->shard_threads = (size_t)strtoul(value, 0, 10);
+        } else if (name == "filter") {
+            options->filter = (size_t)strtoul(value, 0, 10);
+        } else {
+            return false;
+        }
+    }
+    return options->vocabulary > 0
+        && (options->weights == "uniform" || options->weights == "zipf");
+}
+
+}
+
+int main(int argc, char ** argv) {
+    BenchOptions options;
+    if (!parse_options(argc, argv, &options)) {
+        usage(BenchOptions());
+        return 1;
+    }
+
+    std::cout << "docs: " << options.docs << ", vocabulary: " << options.vocabulary
+        << ", doc skew: " << options.doc_skew << ", doc terms: " << options.doc_terms << "\n"
+        << "queries: " << options.queries << ", query skew: " << options.query_skew
+        << ", query terms: " << options.query_terms
+        << ", shared terms: " << options.shared_terms << "\n"
+        << "weights: " << options.weights << " [1, " << options.max_weight << "]"
+        << ", k: " << options.k << ", threshold: " << options.threshold
+        << ", seed: " << options.seed << ", prefetch: " << options.prefetch
+        << ", huge pages: " << options.huge_pages << ", filter: " << options.filter << "%\n";
+
+    PerfCounters * perf = 0;
+    if (options.perf) {
+        perf = new PerfCounters();
+        if (!perf->available()) {
+            std::cout << "hardware counters unavailable(" << perf->error() << ")\n";
+            delete perf;
+            perf = 0;
+        }
+    }
+    std::vector<PhaseReport> phases;
+
+    Random random(options.seed);
+    InvertedIndex ii;
+    uint64_t begin = now_us();
+    PhaseReport load("index load");
+    start_phase(perf);
+    size_t postings = build_corpus(options, &random, &ii);
+    stop_phase(perf, &load);
+    load.postings = postings;
+    phases.push_back(load);
+    std::vector<TermVector> queries;
+    build_queries(options, &random, &queries);
+    std::cout << "generated in " << (now_us() - begin) / 1e6 << " seconds\n\n";
+
+    Wand wand(ii, options.k, (ScoreType)options.threshold);
+    wand.set_prefetch_distance(options.prefetch);
+    // built on the first term group engine, sealing keeps it valid
+    TermGroupCache term_group_cache;
+    bool term_groups_built = false;
+    printf("%-18s %10s %10s %10s %10s %10s %10s %10s %8s\n",
+        "engine", "qps", "mean(us)", "p50", "p90", "p99", "p99.9", "max", "results");
+    for (size_t i = 0; i < kEngineCount; i++) {
+        const Engine& engine = kEngines[i];
+        if (!has_engine(options, engine.name)) {
+            continue;
+        }
+        if (engine.sealed && !ii.sealed()) {
+            PhaseReport seal("seal");
+            start_phase(perf);
+            ii.seal(options.huge_pages);
+            stop_phase(perf, &seal);
+            seal.postings = postings;
+            phases.push_back(seal);
+            IndexMemoryUsage usage;
+            ii.memory_usage(&usage);
+            printf("%-18s sealed, %lu of %lu bytes in huge page arenas\n", "",
+                (unsigned long)usage.huge_pages, (unsigned long)usage.total());
+        }
+        if (engine.term_groups && !term_groups_built) {
+            uint64_t rebuild_begin = now_us();
+            for (size_t q = 0; q < queries.size(); q++) {
+                term_group_cache.observe(queries[q]);
+            }
+            term_group_cache.rebuild(ii);
+            term_groups_built = true;
+            printf("%-18s %lu term groups of %lu postings, built in %.3f seconds\n", "",
+                (unsigned long)term_group_cache.size(),
+                (unsigned long)term_group_cache.postings(), (now_us() - rebuild_begin) / 1e6);
+        }
+        wand.set_term_group_cache(engine.term_groups ? &term_group_cache : 0);
+        phases.push_back(PhaseReport(engine.name));
+        if (engine.batch) {
+            run_batch(options, engine, &wand, queries, perf, &phases.back());
+        } else {
+            run_engine(options, engine, &wand, queries, perf, &phases.back());
+        }
+    }
+    wand.set_term_group_cache(0);
+    for (size_t i = 0; i < kShardedEngineCount; i++) {
+        if (has_engine(options, kShardedEngines[i].name)) {
+            run_sharded(options, kShardedEngines[i], queries, perf, &phases);
+        }
+    }
+
+    // Search phases count the postings advanced by their cursors,
+    // a query of search_taat walks every posting of its terms.
+    std::cout << "\n";
+    print_phases(phases);
+    delete perf;
+    return 0;
+}
@@ -0,0 +1,108 @@
+#include "cap_features.h"
+#include "city.h"
+#include <stdlib.h>
+#include <string.h>
+
+IdType hash_string(const char * buf, size_t len) {
+    uint64 hash = CityHash64(buf, len);
+    return (IdType)hash;
+}
+
+size_t load_cap_features(InvertedIndex * ii, FILE * fp, size_t * bad_lines) {
+    char line[4096];
+    char feature[128];
+    int score;
+    DocumentBuilder db;
+    IdType id = 0;
+    size_t bad = 0;
+
+    // every line is read once and parsed from 'line'
+    while((fgets(line, sizeof(line), fp))) {
+        size_t len = strcspn(line, "\r\n");
+        if (line[len] == '\0' && !feof(fp)) {
+            // longer than 'line', skip the rest of it
+            int c;
+            while ((c = fgetc(fp)) != EOF && c != '\n') {
+            }
+            bad++;
+            continue;
+        }
+        line[len] = '\0';
+        if (strcmp("cap_features", line) == 0) {
+            if (id != 0) {
+                ii->insert(db.build());
+            }
+            db.id(id);
+            id++;
+        } else if (id != 0 && sscanf(line, " %127s %d", feature, &score) == 2) {
+            IdType hash = hash_string(feature, strlen(feature));
+            db.term(hash, (WeightType)score);
+        } else if (line[strspn(line, " \t")] != '\0') {
+            bad++;
+        }
+    }
+    if (id != 0) {
+        // the last doc
+        ii->insert(db.build());
+    }
+    if (bad_lines) {
+        *bad_lines = bad;
+    }
+    return (size_t)id;
+}
+
+int load_cap_features(InvertedIndex * ii, const char * filename) {
+    FILE * fp = fopen(filename, "r");
+    if (fp == NULL) {
+        return -1;
+    }
+    size_t bad_lines;
+    size_t doc_count = ii->doc_count();
+    size_t loaded = load_cap_features(ii, fp, &bad_lines);
+    fclose(fp);
+    if (bad_lines != 0 || ii->doc_count() != doc_count + loaded) {
+        return -2;
+    }
+    return 0;
+}
+
+int load_queries(const char * filename, std::vector<TermVector> * queries) {
+    FILE * fp = fopen(filename, "r");
+    if (fp == NULL) {
+        return -1;
+    }
+    char line[65536];
+    DocumentBuilder db;
+    const char * separators = " \t\r\n";
+    while (fgets(line, sizeof(line), fp)) {
+        char * p = line;
+        for (;;) {
+            p += strspn(p, separators);
+            if (*p == '\0') {
+                break;
+            }
+            size_t len = strcspn(p, separators);
+            // the last ':' separates the weight
+            size_t feature_len = len;
+            while (feature_len > 0 && p[feature_len - 1] != ':') {
+                feature_len--;
+            }
+            WeightType weight = 1;
+            if (feature_len > 0) {
+                weight = (WeightType)strtoull(p + feature_len, 0, 10);
+                feature_len--;
+            } else {
+                feature_len = len;
+            }
+            db.term(hash_string(p, feature_len), weight);
+            p += len;
+        }
+        Document * query = db.build();
+        if (!query->terms.empty()) {
+            queries->push_back(query->terms);
+        }
+        query->release_ref();
+    }
+    fclose(fp);
+    return 0;
+}
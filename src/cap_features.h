@@ -0,0 +1,28 @@
+#ifndef WAND_ENGINE_CAP_FEATURES_H
+#define WAND_ENGINE_CAP_FEATURES_H
+
+#include "index.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <vector>
+
+// Loader of the cap features text format produced by tools/cap-features.py:
+// a "cap_features" line starts a doc, each following "    feature weight" line is one term.
+// Doc ids are assigned from 0 in file order, term ids are hash_string of features.
+
+IdType hash_string(const char * buf, size_t len);
+
+// Return the number of docs loaded. Lines which are neither, or longer than 4095 bytes,
+// are skipped and counted in 'bad_lines', blank lines are ignored.
+size_t load_cap_features(InvertedIndex * ii, FILE * fp, size_t * bad_lines = 0);
+// Return -1 if 'filename' can't be opened, -2 if it has bad lines
+// or not every doc of it went into 'ii'.
+int load_cap_features(InvertedIndex * ii, const char * filename);
+
+// Query log of wand-replay and wand-load: every line is one query of whitespace
+// separated "feature:weight" terms("feature" alone means weight 1), features are
+// hashed like above, lines without terms are skipped.
+// Return -1 if 'filename' can't be opened.
+int load_queries(const char * filename, std::vector<TermVector> * queries);
+
+#endif// WAND_ENGINE_CAP_FEATURES_H
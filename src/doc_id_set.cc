@@ -0,0 +1,147 @@
+#include "doc_id_set.h"
+#include <string.h>
+
+namespace {
+
+const size_t kBitmapUnits = DocIdSet::kBitmapWords * 4 + DocIdSet::kBitmapWords;
+
+// Container of the chunk of 'count' ids from 'ids'.
+struct ChunkPlan {
+    DocIdSet::ContainerType type;
+    size_t runs;
+    size_t units;// of uint16
+};
+
+// 'end' is set to the end of the chunk starting at 'begin'.
+ChunkPlan plan_chunk(const IdType * ids, size_t begin, size_t count, size_t * end) {
+    IdType key = ids[begin] >> 16;
+    size_t runs = 1;
+    size_t i = begin + 1;
+    for (; i < count && (ids[i] >> 16) == key; i++) {
+        if (ids[i] != ids[i - 1] + 1) {
+            runs++;
+        }
+    }
+    *end = i;
+
+    ChunkPlan plan;
+    plan.runs = runs;
+    size_t cardinality = i - begin;
+    // the smallest, arrays first when sizes are equal
+    plan.type = DocIdSet::ARRAY;
+    plan.units = cardinality;
+    if (runs * 3 < plan.units) {
+        plan.type = DocIdSet::RUN;
+        plan.units = runs * 3;
+    }
+    if (kBitmapUnits < plan.units) {
+        plan.type = DocIdSet::BITMAP;
+        plan.units = kBitmapUnits;
+    }
+    return plan;
+}
+
+size_t align_units(size_t units) {
+    // bitmap words are aligned to 8 bytes
+    return (units + 3) / 4 * 4;
+}
+
+}
+
+const size_t DocIdSet::kBitmapWords;
+
+size_t DocIdSet::get_bytes(const IdType * ids, size_t count) {
+    if (count == 0 || count > (uint32_t)-1) {
+        return 0;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (Document::is_sentinel(ids[i]) || (i > 0 && ids[i] <= ids[i - 1])) {
+            return 0;
+        }
+    }
+
+    size_t chunk_count = 0;
+    size_t units = 0;
+    for (size_t i = 0; i < count;) {
+        ChunkPlan plan = plan_chunk(ids, i, count, &i);
+        if (plan.type == BITMAP) {
+            units = align_units(units);
+        }
+        units += plan.units;
+        chunk_count++;
+    }
+    return (chunk_count + 1) * sizeof(Chunk) + align_units(units) * sizeof(uint16_t);
+}
+
+void DocIdSet::build(const IdType * ids, size_t count, char * memory) {
+    size_t chunk_total = 0;
+    for (size_t i = 0; i < count; chunk_total++) {
+        plan_chunk(ids, i, count, &i);
+    }
+    Chunk * out_chunks = (Chunk *)memory;
+    uint16_t * out_data = (uint16_t *)(memory + (chunk_total + 1) * sizeof(Chunk));
+
+    size_t units = 0;
+    size_t c = 0;
+    for (size_t i = 0; i < count; c++) {
+        size_t begin = i;
+        ChunkPlan plan = plan_chunk(ids, begin, count, &i);
+        if (plan.type == BITMAP) {
+            size_t aligned = align_units(units);
+            memset(out_data + units, 0, (aligned - units) * sizeof(uint16_t));
+            units = aligned;
+        }
+        Chunk& chunk = out_chunks[c];
+        chunk.key = ids[begin] >> 16;
+        chunk.rank = (uint32_t)begin;
+        chunk.offset = (uint32_t)units;
+        chunk.type = (uint16_t)plan.type;
+        chunk.runs = (uint16_t)(plan.type == RUN ? plan.runs : 0);
+
+        uint16_t * container = out_data + units;
+        if (plan.type == ARRAY) {
+            for (size_t j = begin; j < i; j++) {
+                container[j - begin] = (uint16_t)ids[j];
+            }
+        } else if (plan.type == BITMAP) {
+            uint64_t * words = (uint64_t *)container;
+            memset(words, 0, kBitmapWords * sizeof(uint64_t));
+            for (size_t j = begin; j < i; j++) {
+                uint32_t low = (uint32_t)(ids[j] & 0xffff);
+                words[low >> 6] |= (uint64_t)1 << (low & 63);
+            }
+            uint16_t * ranks = container + kBitmapWords * 4;
+            uint32_t rank = 0;
+            for (size_t w = 0; w < kBitmapWords; w++) {
+                ranks[w] = (uint16_t)rank;
+                rank += popcount64(words[w]);
+            }
+        } else {
+            uint16_t * ranks = container + plan.runs * 2;
+            size_t run = 0;
+            for (size_t j = begin; j < i; j++) {
+                if (j == begin || ids[j] != ids[j - 1] + 1) {
+                    container[run * 2] = (uint16_t)ids[j];
+                    ranks[run] = (uint16_t)(j - begin);
+                    run++;
+                }
+                container[(run - 1) * 2 + 1] = (uint16_t)ids[j];
+            }
+        }
+        units += plan.units;
+    }
+    size_t aligned = align_units(units);
+    memset(out_data + units, 0, (aligned - units) * sizeof(uint16_t));
+
+    Chunk& last = out_chunks[chunk_total];
+    last.key = (IdType)-1;
+    last.rank = (uint32_t)count;
+    last.offset = (uint32_t)units;
+    last.type = ARRAY;
+    last.runs = 0;
+
+    chunks = out_chunks;
+    data = out_data;
+    chunk_count = chunk_total;
+    bytes = (chunk_total + 1) * sizeof(Chunk) + aligned * sizeof(uint16_t);
+}
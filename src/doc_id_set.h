@@ -0,0 +1,167 @@
+#ifndef WAND_ENGINE_DOC_ID_SET_H
+#define WAND_ENGINE_DOC_ID_SET_H
+
+#include "document.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
+
+#if defined _MSC_VER
+# include <intrin.h>
+#endif
+
+inline int popcount64(uint64_t x) {
+#if defined __GNUC__
+    return __builtin_popcountll(x);
+#else
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    return (int)((x * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+// 'x' must not be 0
+inline int lowest_bit64(uint64_t x) {
+#if defined __GNUC__
+    return __builtin_ctzll(x);
+#elif defined _MSC_VER && defined _WIN64
+    unsigned long index;
+    _BitScanForward64(&index, x);
+    return (int)index;
+#else
+    int bit = 0;
+    while (!(x & 1)) {
+        x >>= 1;
+        bit++;
+    }
+    return bit;
+#endif
+}
+
+// Sorted set of distinct doc ids in the style of Roaring bitmaps, the doc id
+// layout of dense posting lists, see BasicPostingArray.
+//
+// Doc ids are split into chunks of 65536 by their high 48 bits. The low 16 bits
+// of a chunk are stored in the smallest of three containers:
+//   ARRAY   sorted low bits, 2 bytes per doc
+//   BITMAP  65536 bits, and the number of bits set before each 64 bits word
+//   RUN     [first, last] of every run of consecutive ids, and the number of ids
+//           before each run
+// The ranks make the position of a doc in the set(the index into weights and docs
+// of its posting array) known after a seek without counting from the chunk start.
+//
+// The set is one block of memory: chunk_count + 1 Chunks, then the uint16 data of
+// all containers. The last chunk only has 'rank', the size of the set.
+struct DocIdSet {
+    enum ContainerType {
+        ARRAY,
+        BITMAP,
+        RUN
+    };
+
+    static const size_t kBitmapWords = 65536 / 64;
+
+    struct Chunk {
+        IdType key;// doc id >> 16
+        uint32_t rank;// doc ids in the chunks before
+        uint32_t offset;// of the container in 'data', in uint16
+        uint16_t type;
+        uint16_t runs;// of a RUN container
+    };
+
+    const Chunk * chunks;
+    const uint16_t * data;
+    size_t chunk_count;
+    size_t bytes;
+
+    DocIdSet() : chunks(0), data(0), chunk_count(0), bytes(0) {}
+
+    size_t size() const {
+        return chunks[chunk_count].rank;
+    }
+
+    // The position in a container, which moves only forward while a cursor walks
+    // it, is the index of an ARRAY, the bit of a BITMAP, or the run of a RUN.
+
+    // Find the first doc id of chunk 'c' whose low bits >= 'low', at or after
+    // position 'in'. Return false if there is none, otherwise move 'in' to it,
+    // and set its low bits and rank in the chunk.
+    bool seek(size_t c, uint32_t low, uint32_t * in, uint32_t * value, uint32_t * rank) const {
+        const Chunk& chunk = chunks[c];
+        const uint16_t * container = data + chunk.offset;
+        if (chunk.type == ARRAY) {
+            const uint16_t * last = container + (chunks[c + 1].rank - chunk.rank);
+            const uint16_t * p = std::lower_bound(container + *in, last, low);
+            if (p == last) {
+                return false;
+            }
+            *in = (uint32_t)(p - container);
+            *value = *p;
+            *rank = *in;
+            return true;
+        }
+        if (chunk.type == BITMAP) {
+            const uint64_t * words = (const uint64_t *)container;
+            size_t w = low >> 6;
+            uint64_t word = words[w] & (~(uint64_t)0 << (low & 63));
+            while (!word) {
+                if (++w == kBitmapWords) {
+                    return false;
+                }
+                word = words[w];
+            }
+            *in = *value = (uint32_t)(w * 64 + lowest_bit64(word));
+            const uint16_t * ranks = container + kBitmapWords * 4;
+            *rank = ranks[w] + popcount64(words[w] & ~(~(uint64_t)0 << (*value & 63)));
+            return true;
+        }
+
+        // the first run at or after 'in' whose last >= 'low'
+        size_t first = *in, count = chunk.runs;
+        while (first < count) {
+            size_t middle = first + (count - first) / 2;
+            if (container[middle * 2 + 1] < low) {
+                first = middle + 1;
+            } else {
+                count = middle;
+            }
+        }
+        if (first == chunk.runs) {
+            return false;
+        }
+        uint32_t start = container[first * 2];
+        const uint16_t * ranks = container + chunk.runs * 2;
+        *in = (uint32_t)first;
+        *value = std::max(start, low);
+        *rank = ranks[first] + (*value - start);
+        return true;
+    }
+
+    // Move from position 'in' with low bits 'value' to the next doc id of chunk 'c',
+    // there must be one.
+    void next(size_t c, uint32_t * in, uint32_t * value) const {
+        const Chunk& chunk = chunks[c];
+        const uint16_t * container = data + chunk.offset;
+        if (chunk.type == ARRAY) {
+            *value = container[++*in];
+        } else if (chunk.type == BITMAP) {
+            uint32_t rank;
+            seek(c, *value + 1, in, value, &rank);
+        } else if (*value < container[*in * 2 + 1]) {
+            ++*value;
+        } else {
+            *value = container[++*in * 2];
+        }
+    }
+
+    // Bytes of the set of 'ids', sorted in increasing order.
+    // 0 if they can't be a set: duplicated ids, the sentinel id,
+    // or more than 2^32 - 1 of them.
+    static size_t get_bytes(const IdType * ids, size_t count);
+    // Build the set of 'ids' in 'memory' of get_bytes(ids, count) bytes,
+    // aligned to 8, the set must not be used after 'memory' is freed.
+    void build(const IdType * ids, size_t count, char * memory);
+};
+
+#endif// WAND_ENGINE_DOC_ID_SET_H
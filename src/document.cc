@@ -1,8 +1,10 @@
 #include "document.h"
 #include <algorithm>
 
-ScoreType Document::get_weight(IdType term_id) const {
-    TermVector::const_iterator it =
+template <typename Traits>
+typename BasicDocument<Traits>::WeightType
+BasicDocument<Traits>::get_weight(IdType term_id) const {
+    typename TermVector::const_iterator it =
         std::lower_bound(terms.begin(), terms.end(), term_id, TermLess());
     if (it == terms.end()) {
         return 0;
@@ -10,45 +12,60 @@ ScoreType Document::get_weight(IdType term_id) const {
     return (*it).weight;
 }
 
-std::ostream& Document::dump(std::ostream& os) const {
+template <typename Traits>
+std::ostream& BasicDocument<Traits>::dump(std::ostream& os) const {
     if (!is_sentinel()) {
         os << "    doc id: " << id << "\n";
         for (size_t i = 0, s = terms.size(); i < s; i++) {
-            const Term& term = terms[i];
+            const BasicTerm<Traits>& term = terms[i];
             os << "      term id: " << term.id << ", weight: " << term.weight << "\n";
         }
+        for (size_t i = 0, s = attributes.size(); i < s; i++) {
+            os << "      attribute id: " << attributes[i].id
+                << ", value: " << attributes[i].value << "\n";
+        }
     } else {
         os << "    (sentinel)\n";
     }
     return os;
 }
 
-std::ostream& operator << (std::ostream& os, const Document& doc) {
-    doc.dump(os);
-    return os;
-}
-
-DocumentBuilder& DocumentBuilder::id(IdType id) {
+template <typename Traits>
+BasicDocumentBuilder<Traits>& BasicDocumentBuilder<Traits>::id(IdType id) {
     _id = id;
     return *this;
 }
 
-DocumentBuilder& DocumentBuilder::term(IdType id, ScoreType weight) {
-    Term term(id, weight);
+template <typename Traits>
+BasicDocumentBuilder<Traits>& BasicDocumentBuilder<Traits>::term(IdType id, WeightType weight) {
+    BasicTerm<Traits> term(id, weight);
     terms.push_back(term);
     return *this;
 }
 
-Document * DocumentBuilder::build() {
+template <typename Traits>
+BasicDocumentBuilder<Traits>& BasicDocumentBuilder<Traits>::attribute(IdType id,
+        AttributeValue value) {
+    attributes.push_back(Attribute(id, value));
+    return *this;
+}
+
+template <typename Traits>
+BasicDocument<Traits> * BasicDocumentBuilder<Traits>::build() {
     // sort and dedup terms
     std::sort(terms.begin(), terms.end(), TermLess());
     terms.erase(std::unique(terms.begin(), terms.end(), TermIdEqualer()), terms.end());
 
-    Document * doc = Document::create();
+    BasicDocument<Traits> * doc = BasicDocument<Traits>::create();
     doc->id = _id;
     doc->terms.swap(terms);
+    doc->attributes.swap(attributes);
 
     _id = 0;
     terms.clear();
+    attributes.clear();
     return doc;
 }
+
+WAND_ENGINE_INSTANTIATE(struct BasicDocument)
+WAND_ENGINE_INSTANTIATE(struct BasicDocumentBuilder)
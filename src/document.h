@@ -2,54 +2,109 @@
 #define WAND_ENGINE_DOCUMENT_H
 
 #include <stdint.h>
+#include <string.h>
 #include <ostream>
 #include <vector>
 
 typedef uint64_t IdType;
-typedef uint64_t ScoreType;
+// dense internal doc number assigned by InvertedIndex
+typedef uint32_t OrdinalType;
+
+// Weight type of terms in docs and queries, and score type of dot products.
+// Templates in this project take one of them as 'Traits'
+// and are explicitly instantiated for all of them in their .cc files.
+template <typename W, typename S>
+struct ScoreTraits {
+    typedef W WeightType;
+    typedef S ScoreType;
+};
+
+typedef ScoreTraits<uint64_t, uint64_t> DefaultScoreTraits;
+typedef ScoreTraits<float, float> FloatScoreTraits;
+typedef ScoreTraits<uint16_t, uint64_t> Uint16ScoreTraits;
+
+// usage: WAND_ENGINE_INSTANTIATE(class BasicDocument)
+#define WAND_ENGINE_INSTANTIATE(TEMPLATE) \
+    template TEMPLATE<DefaultScoreTraits>; \
+    template TEMPLATE<FloatScoreTraits>; \
+    template TEMPLATE<Uint16ScoreTraits>;
+
+// bits of a weight or score, for hashing
+template <typename T>
+inline uint64_t weight_bits(T weight) {
+    uint64_t bits = 0;
+    memcpy(&bits, &weight, sizeof(T) < sizeof(bits) ? sizeof(T) : sizeof(bits));
+    return bits;
+}
 
-struct Term {
+typedef DefaultScoreTraits::WeightType WeightType;
+typedef DefaultScoreTraits::ScoreType ScoreType;
+
+// Numeric attribute of a doc, e.g. a bid or a geo id, see AttributeStore.
+typedef int64_t AttributeValue;
+
+struct Attribute {
     IdType id;
-    ScoreType weight;
-    Term(IdType _id, ScoreType _weight) : id(_id), weight(_weight) {}
+    AttributeValue value;
+    Attribute(IdType _id, AttributeValue _value) : id(_id), value(_value) {}
 };
 
-typedef std::vector<Term> TermVector;
+typedef std::vector<Attribute> AttributeVector;
+
+template <typename Traits>
+struct BasicTerm {
+    typedef typename Traits::WeightType WeightType;
+
+    IdType id;
+    WeightType weight;
+    BasicTerm(IdType _id, WeightType _weight) : id(_id), weight(_weight) {}
+};
 
 struct TermLess {
-    bool operator()(const Term& a, const Term& b) const {
+    template <typename TermType>
+    bool operator()(const TermType& a, const TermType& b) const {
         return a.id < b.id;
     }
-    bool operator()(IdType id, const Term& term) const {
+    template <typename TermType>
+    bool operator()(IdType id, const TermType& term) const {
         return id < term.id;
     }
-    bool operator()(const Term& term, IdType id) const {
+    template <typename TermType>
+    bool operator()(const TermType& term, IdType id) const {
         return term.id < id;
     }
 };
 
 struct TermIdEqualer {
-    bool operator()(const Term& a, const Term& b) const {
+    template <typename TermType>
+    bool operator()(const TermType& a, const TermType& b) const {
         return a.id == b.id;
     }
 };
 
-struct Document {
+template <typename Traits>
+struct BasicDocument {
+    typedef typename Traits::WeightType WeightType;
+    typedef std::vector<BasicTerm<Traits> > TermVector;
+
     IdType id;
+    OrdinalType ordinal;
     TermVector terms;// "terms" must be sorted
+    // moved into the AttributeStore of the index by insert
+    AttributeVector attributes;
 
 private:
-    Document() :ref(1) {}
-    Document(IdType _id) : id(_id), ref(1) {}
+    BasicDocument() : ordinal((OrdinalType)-1), ref(1) {}
+    BasicDocument(IdType _id) : id(_id), ordinal((OrdinalType)-1), ref(1) {}
     int ref;
 
 public:
-    static Document * create() {
-        return new Document();
+    static BasicDocument * create() {
+        return new BasicDocument();
     }
 
-    static Document * sentinel() {
-        static Document doc((IdType)-1);
+    static BasicDocument * sentinel() {
+        static BasicDocument doc((IdType)-1);
         return &doc;
     }
 
@@ -75,28 +130,44 @@ public:
         }
     }
 
-    ScoreType get_weight(IdType term_id) const;
+    WeightType get_weight(IdType term_id) const;
     std::ostream& dump(std::ostream& os) const;
 
 private:
-    Document(Document& other);
-    Document& operator=(Document& other);
+    BasicDocument(BasicDocument& other);
+    BasicDocument& operator=(BasicDocument& other);
 };
 
-std::ostream& operator << (std::ostream& os, const Document& doc);
+template <typename Traits>
+inline std::ostream& operator << (std::ostream& os, const BasicDocument<Traits>& doc) {
+    doc.dump(os);
+    return os;
+}
+
+template <typename Traits>
+struct BasicDocumentBuilder {
+    typedef typename Traits::WeightType WeightType;
+    typedef std::vector<BasicTerm<Traits> > TermVector;
 
-struct DocumentBuilder {
     IdType _id;
     TermVector terms;
+    AttributeVector attributes;
 
-    DocumentBuilder() : _id(0) {}
-    DocumentBuilder& id(IdType id);
-    DocumentBuilder& term(IdType id, ScoreType weight);
-    Document * build();
+    BasicDocumentBuilder() : _id(0) {}
+    BasicDocumentBuilder& id(IdType id);
+    BasicDocumentBuilder& term(IdType id, WeightType weight);
+    // the last value of an attribute id wins
+    BasicDocumentBuilder& attribute(IdType id, AttributeValue value);
+    BasicDocument<Traits> * build();
 
 private:
-    DocumentBuilder(DocumentBuilder& other);
-    DocumentBuilder& operator=(DocumentBuilder& other);
+    BasicDocumentBuilder(BasicDocumentBuilder& other);
+    BasicDocumentBuilder& operator=(BasicDocumentBuilder& other);
 };
 
+typedef BasicTerm<DefaultScoreTraits> Term;
+typedef std::vector<Term> TermVector;
+typedef BasicDocument<DefaultScoreTraits> Document;
+typedef BasicDocumentBuilder<DefaultScoreTraits> DocumentBuilder;
+
 #endif// WAND_ENGINE_DOCUMENT_H
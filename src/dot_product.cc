@@ -0,0 +1,246 @@
+#include "dot_product.h"
+#include <algorithm>
+
+#if defined __AVX2__
+# include <immintrin.h>
+#elif defined __SSE4_1__
+# include <smmintrin.h>
+#endif
+
+namespace {
+
+// use galloping if the larger vector is at least this many times the size of the smaller one
+const size_t kGallopingRatio = 16;
+// merge is as fast as simd for smaller vectors
+const size_t kSimdMinSize = 8;
+
+template <typename Term>
+inline bool is_duplicated(const Term * v, size_t i) {
+    return i > 0 && v[i].id == v[i - 1].id;
+}
+
+// index of the first term in v[first, last) whose id >= 'id'
+template <typename Term>
+inline size_t gallop(const Term * v, size_t first, size_t last, IdType id) {
+    if (v[first].id >= id) {
+        return first;
+    }
+    size_t step = 1;
+    while (first + step < last && v[first + step].id < id) {
+        step <<= 1;
+    }
+    // v[first + step / 2].id < id <= v[first + step].id
+    size_t lo = first + (step >> 1) + 1;
+    size_t hi = first + step < last ? first + step : last;
+    while (lo < hi) {
+        size_t mid = lo + ((hi - lo) >> 1);
+        if (v[mid].id < id) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+template <typename Traits>
+inline typename Traits::ScoreType merge(const BasicTerm<Traits> * a, size_t i, size_t imax,
+        const BasicTerm<Traits> * b, size_t j, size_t jmax) {
+    typedef typename Traits::ScoreType ScoreType;
+    ScoreType dp = 0;
+    while (i < imax && j < jmax) {
+        if (a[i].id < b[j].id) {
+            i++;
+        } else if (a[i].id > b[j].id) {
+            j++;
+        } else {
+            if (!is_duplicated(a, i)) {
+                dp += (ScoreType)a[i].weight * b[j].weight;
+            }
+            i++;
+            j++;
+        }
+    }
+    return dp;
+}
+
+#if defined __AVX2__ || defined __SSE4_1__
+// products of equal ids in a[i, i + n) and b[j, j + n)
+template <typename Traits>
+inline typename Traits::ScoreType block_product(const BasicTerm<Traits> * a, size_t i,
+        const BasicTerm<Traits> * b, size_t j, size_t n) {
+    typedef typename Traits::ScoreType ScoreType;
+    ScoreType dp = 0;
+    for (size_t x = i; x < i + n; x++) {
+        if (is_duplicated(a, x)) {
+            continue;
+        }
+        for (size_t y = j; y < j + n; y++) {
+            if (a[x].id == b[y].id) {
+                dp += (ScoreType)a[x].weight * b[y].weight;
+                break;
+            }
+        }
+    }
+    return dp;
+}
+#endif
+
+}
+
+template <typename Traits>
+typename Traits::ScoreType sparse_dot_product_merge(
+        const std::vector<BasicTerm<Traits> >& a, const std::vector<BasicTerm<Traits> >& b) {
+    if (a.empty() || b.empty()) {
+        return 0;
+    }
+    return merge(&a[0], 0, a.size(), &b[0], 0, b.size());
+}
+
+template <typename Traits>
+typename Traits::ScoreType sparse_dot_product_galloping(
+        const std::vector<BasicTerm<Traits> >& a, const std::vector<BasicTerm<Traits> >& b) {
+    typedef BasicTerm<Traits> Term;
+    typedef typename Traits::ScoreType ScoreType;
+
+    if (a.empty() || b.empty()) {
+        return 0;
+    }
+
+    const Term * pa = &a[0];
+    const Term * pb = &b[0];
+    size_t as = a.size(), bs = b.size();
+    ScoreType dp = 0;
+    if (as <= bs) {
+        for (size_t i = 0, j = 0; i < as; i++) {
+            if (is_duplicated(pa, i)) {
+                continue;
+            }
+            j = gallop(pb, j, bs, pa[i].id);
+            if (j == bs) {
+                break;
+            }
+            if (pb[j].id == pa[i].id) {
+                dp += (ScoreType)pa[i].weight * pb[j].weight;
+            }
+        }
+    } else {
+        // gallop finds the first one of duplicated ids in 'a'
+        for (size_t i = 0, j = 0; j < bs; j++) {
+            i = gallop(pa, i, as, pb[j].id);
+            if (i == as) {
+                break;
+            }
+            if (pa[i].id == pb[j].id) {
+                dp += (ScoreType)pa[i].weight * pb[j].weight;
+            }
+        }
+    }
+    return dp;
+}
+
+template <typename Traits>
+typename Traits::ScoreType sparse_dot_product_simd(
+        const std::vector<BasicTerm<Traits> >& a, const std::vector<BasicTerm<Traits> >& b) {
+    typedef BasicTerm<Traits> Term;
+    typedef typename Traits::ScoreType ScoreType;
+
+    if (a.empty() || b.empty()) {
+        return 0;
+    }
+
+    const Term * pa = &a[0];
+    const Term * pb = &b[0];
+    size_t as = a.size(), bs = b.size();
+    size_t i = 0, j = 0;
+    ScoreType dp = 0;
+
+#if defined __AVX2__ || defined __SSE4_1__
+    // ids are loaded as the low 64 bits of every 128 bits,
+    // any other layout of terms goes to merge.
+    if (sizeof(Term) != 2 * sizeof(IdType)) {
+        return merge(pa, i, as, pb, j, bs);
+    }
+#endif
+
+    // Compare a block of ids from 'a' with a block from 'b' all against all,
+    // only blocks having equal ids are multiplied in scalar code.
+    // Then advance the block(s) with the smaller last id.
+#if defined __AVX2__
+    const size_t block = 4;
+    while (i + block <= as && j + block <= bs) {
+        // [id0, w0, id1, w1], [id2, w2, id3, w3] -> [id0, id2, id1, id3]
+        __m256i va = _mm256_unpacklo_epi64(
+            _mm256_loadu_si256((const __m256i *)(pa + i)),
+            _mm256_loadu_si256((const __m256i *)(pa + i + 2)));
+        __m256i vb = _mm256_unpacklo_epi64(
+            _mm256_loadu_si256((const __m256i *)(pb + j)),
+            _mm256_loadu_si256((const __m256i *)(pb + j + 2)));
+        __m256i m = _mm256_cmpeq_epi64(va, vb);
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi64(va, _mm256_permute4x64_epi64(vb, 0x39)));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi64(va, _mm256_permute4x64_epi64(vb, 0x4e)));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi64(va, _mm256_permute4x64_epi64(vb, 0x93)));
+        if (!_mm256_testz_si256(m, m)) {
+            dp += block_product(pa, i, pb, j, block);
+        }
+
+        IdType amax = pa[i + block - 1].id, bmax = pb[j + block - 1].id;
+        i += amax <= bmax ? block : 0;
+        j += bmax <= amax ? block : 0;
+    }
+#elif defined __SSE4_1__
+    const size_t block = 2;
+    while (i + block <= as && j + block <= bs) {
+        // [id0, w0], [id1, w1] -> [id0, id1]
+        __m128i va = _mm_unpacklo_epi64(
+            _mm_loadu_si128((const __m128i *)(pa + i)),
+            _mm_loadu_si128((const __m128i *)(pa + i + 1)));
+        __m128i vb = _mm_unpacklo_epi64(
+            _mm_loadu_si128((const __m128i *)(pb + j)),
+            _mm_loadu_si128((const __m128i *)(pb + j + 1)));
+        __m128i m = _mm_cmpeq_epi64(va, vb);
+        m = _mm_or_si128(m, _mm_cmpeq_epi64(va, _mm_shuffle_epi32(vb, 0x4e)));
+        if (!_mm_testz_si128(m, m)) {
+            dp += block_product(pa, i, pb, j, block);
+        }
+
+        IdType amax = pa[i + block - 1].id, bmax = pb[j + block - 1].id;
+        i += amax <= bmax ? block : 0;
+        j += bmax <= amax ? block : 0;
+    }
+#endif
+
+    return dp + merge(pa, i, as, pb, j, bs);
+}
+
+template <typename Traits>
+typename Traits::ScoreType sparse_dot_product(
+        const std::vector<BasicTerm<Traits> >& a, const std::vector<BasicTerm<Traits> >& b) {
+    size_t small = a.size(), large = b.size();
+    if (small > large) {
+        std::swap(small, large);
+    }
+    if (large >= small * kGallopingRatio) {
+        return sparse_dot_product_galloping(a, b);
+    }
+#if defined __AVX2__ || defined __SSE4_1__
+    if (small >= kSimdMinSize) {
+        return sparse_dot_product_simd(a, b);
+    }
+#endif
+    return sparse_dot_product_merge(a, b);
+}
+
+#define INSTANTIATE_SPARSE_DOT_PRODUCT(TRAITS) \
+    template TRAITS::ScoreType sparse_dot_product_merge<TRAITS>( \
+            const BasicDocument<TRAITS>::TermVector&, const BasicDocument<TRAITS>::TermVector&); \
+    template TRAITS::ScoreType sparse_dot_product_galloping<TRAITS>( \
+            const BasicDocument<TRAITS>::TermVector&, const BasicDocument<TRAITS>::TermVector&); \
+    template TRAITS::ScoreType sparse_dot_product_simd<TRAITS>( \
+            const BasicDocument<TRAITS>::TermVector&, const BasicDocument<TRAITS>::TermVector&); \
+    template TRAITS::ScoreType sparse_dot_product<TRAITS>( \
+            const BasicDocument<TRAITS>::TermVector&, const BasicDocument<TRAITS>::TermVector&);
+
+INSTANTIATE_SPARSE_DOT_PRODUCT(DefaultScoreTraits)
+INSTANTIATE_SPARSE_DOT_PRODUCT(FloatScoreTraits)
+INSTANTIATE_SPARSE_DOT_PRODUCT(Uint16ScoreTraits)
@@ -0,0 +1,30 @@
+#ifndef WAND_ENGINE_DOT_PRODUCT_H
+#define WAND_ENGINE_DOT_PRODUCT_H
+
+#include "document.h"
+
+// Sparse dot product kernels.
+// 'a' and 'b' must be sorted by term id,
+// ids in 'b' must be unique, duplicated ids in 'a' count only once.
+
+// Explicitly instantiated for all ScoreTraits in document.h.
+
+// linear merge, best for vectors of similar small sizes
+template <typename Traits>
+typename Traits::ScoreType sparse_dot_product_merge(
+        const std::vector<BasicTerm<Traits> >& a, const std::vector<BasicTerm<Traits> >& b);
+// iterate the smaller vector, exponential search in the larger one,
+// best for very unbalanced sizes
+template <typename Traits>
+typename Traits::ScoreType sparse_dot_product_galloping(
+        const std::vector<BasicTerm<Traits> >& a, const std::vector<BasicTerm<Traits> >& b);
+// block compare with AVX2 or SSE4.1, falls back to merge if neither is enabled
+template <typename Traits>
+typename Traits::ScoreType sparse_dot_product_simd(
+        const std::vector<BasicTerm<Traits> >& a, const std::vector<BasicTerm<Traits> >& b);
+// choose one of above by sizes
+template <typename Traits>
+typename Traits::ScoreType sparse_dot_product(
+        const std::vector<BasicTerm<Traits> >& a, const std::vector<BasicTerm<Traits> >& b);
+
+#endif// WAND_ENGINE_DOT_PRODUCT_H
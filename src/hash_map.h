@@ -0,0 +1,12 @@
+#ifndef WAND_ENGINE_HASH_MAP_H
+#define WAND_ENGINE_HASH_MAP_H
+
+#if defined HAVE_STD_TR1_UNORDERED_MAP
+# include <tr1/unordered_map>
+# define HASH_MAP std::tr1::unordered_map
+#else
+# include <unordered_map>
+# define HASH_MAP std::unordered_map
+#endif
+
+#endif// WAND_ENGINE_HASH_MAP_H
@@ -0,0 +1,122 @@
+#include "histogram.h"
+#include <math.h>
+
+#if defined _MSC_VER
+# include <intrin.h>
+#endif
+
+namespace {
+
+const int kSubBucketBits = 8;
+const size_t kSubBuckets = (size_t)1 << kSubBucketBits;
+const size_t kHalfSubBuckets = kSubBuckets / 2;
+// exact values, then half of the sub buckets for every larger power of 2
+const size_t kBuckets = kSubBuckets + (64 - kSubBucketBits) * kHalfSubBuckets;
+
+inline int most_significant_bit(uint64_t value) {
+#if defined __GNUC__
+    return 63 - __builtin_clzll(value);
+#elif defined _MSC_VER && defined _WIN64
+    unsigned long index;
+    _BitScanReverse64(&index, value);
+    return (int)index;
+#else
+    int bit = 0;
+    while (value >>= 1) {
+        bit++;
+    }
+    return bit;
+#endif
+}
+
+}
+
+Histogram::Histogram() : counts_(kBuckets, 0), count_(0), min_(0), max_(0), sum_(0) {
+}
+
+size_t Histogram::get_index(uint64_t value) {
+    if (value < kSubBuckets) {
+        return (size_t)value;
+    }
+    // value >> shift is in [kHalfSubBuckets, kSubBuckets)
+    int shift = most_significant_bit(value) - kSubBucketBits + 1;
+    return kSubBuckets + (shift - 1) * kHalfSubBuckets
+        + (size_t)(value >> shift) - kHalfSubBuckets;
+}
+
+uint64_t Histogram::get_upper_value(size_t index) {
+    if (index < kSubBuckets) {
+        return (uint64_t)index;
+    }
+    size_t shift = (index - kSubBuckets) / kHalfSubBuckets + 1;
+    uint64_t sub = (index - kSubBuckets) % kHalfSubBuckets + kHalfSubBuckets;
+    return ((sub + 1) << shift) - 1;
+}
+
+void Histogram::record(uint64_t value) {
+    counts_[get_index(value)]++;
+    if (count_ == 0 || value < min_) {
+        min_ = value;
+    }
+    if (value > max_) {
+        max_ = value;
+    }
+    count_++;
+    sum_ += (double)value;
+}
+
+void Histogram::merge(const Histogram& other) {
+    if (other.count_ == 0) {
+        return;
+    }
+    for (size_t i = 0; i < kBuckets; i++) {
+        counts_[i] += other.counts_[i];
+    }
+    if (count_ == 0 || other.min_ < min_) {
+        min_ = other.min_;
+    }
+    if (other.max_ > max_) {
+        max_ = other.max_;
+    }
+    count_ += other.count_;
+    sum_ += other.sum_;
+}
+
+void Histogram::clear() {
+    counts_.assign(kBuckets, 0);
+    count_ = 0;
+    min_ = 0;
+    max_ = 0;
+    sum_ = 0;
+}
+
+uint64_t Histogram::percentile(double p) const {
+    if (count_ == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)ceil(p / 100.0 * count_);
+    if (rank == 0) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kBuckets; i++) {
+        seen += counts_[i];
+        if (seen >= rank) {
+            uint64_t value = get_upper_value(i);
+            return value < max_ ? value : max_;
+        }
+    }
+    return max_;
+}
+
+std::ostream& Histogram::dump(std::ostream& os, double unit) const {
+    os << "count: " << count_
+        << ", mean: " << mean() / unit
+        << ", p50: " << percentile(50) / unit
+        << ", p90: " << percentile(90) / unit
+        << ", p95: " << percentile(95) / unit
+        << ", p99: " << percentile(99) / unit
+        << ", p99.9: " << percentile(99.9) / unit
+        << ", max: " << max_ / unit << "\n";
+    return os;
+}
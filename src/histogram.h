@@ -0,0 +1,61 @@
+#ifndef WAND_ENGINE_HISTOGRAM_H
+#define WAND_ENGINE_HISTOGRAM_H
+
+#include <stdint.h>
+#include <ostream>
+#include <vector>
+
+// HDR style histogram of non-negative integers, e.g. latencies in nanoseconds.
+//
+// Values below 256 are counted exactly, larger ones in 128 buckets for every
+// power of 2, so any value is reported with a relative error below 1 / 128,
+// in constant memory(about 60KB).
+// Not thread safe, use one per thread and 'merge' them.
+class Histogram {
+private:
+    std::vector<uint64_t> counts_;
+    uint64_t count_;
+    uint64_t min_;
+    uint64_t max_;
+    double sum_;
+
+    static size_t get_index(uint64_t value);
+    // the largest value counted in 'index'
+    static uint64_t get_upper_value(size_t index);
+
+public:
+    Histogram();
+
+    void record(uint64_t value);
+    void merge(const Histogram& other);
+    void clear();
+
+    uint64_t count() const {
+        return count_;
+    }
+
+    uint64_t min() const {
+        return count_ ? min_ : 0;
+    }
+
+    uint64_t max() const {
+        return max_;
+    }
+
+    double mean() const {
+        return count_ ? sum_ / count_ : 0;
+    }
+
+    // value at or below which 'p' percent of values are, 'p' in [0, 100]
+    uint64_t percentile(double p) const;
+
+    // percentiles p50, p90, p95, p99, p99.9 and max divided by 'unit'
+    std::ostream& dump(std::ostream& os, double unit = 1.0) const;
+};
+
+inline std::ostream& operator << (std::ostream& os, const Histogram& histogram) {
+    histogram.dump(os);
+    return os;
+}
+
+#endif// WAND_ENGINE_HISTOGRAM_H
@@ -1,14 +1,11 @@
 #include "index.h"
+#include "atomic.h"
+#include "hash_map.h"
+#include <algorithm>
+#include <vector>
 
-#if defined HAVE_STD_TR1_UNORDERED_MAP
-# include <tr1/unordered_map>
-# define HASH_MAP std::tr1::unordered_map
-#else
-# include <unordered_map>
-# define HASH_MAP std::unordered_map
-#endif
-
-std::ostream& PostingListNode::dump(std::ostream& os) const {
+template <typename Traits>
+std::ostream& BasicPostingListNode<Traits>::dump(std::ostream& os) const {
     os << *doc;
     if (!doc->is_sentinel()) {
         os << "      bound: " << bound << "\n";
@@ -16,7 +13,11 @@ std::ostream& PostingListNode::dump(std::ostream& os) const {
     return os;
 }
 
-void PostingList::insert(PostingListNode * node) {
+template <typename Traits>
+void BasicPostingList<Traits>::insert(PostingListNode * node) {
+    delete array_;
+    array_ = 0;
+
     IdType id = node->doc->id;
     PostingListNode * p = first_;
 
@@ -54,7 +55,119 @@ void PostingList::insert(PostingListNode * node) {
     }
 }
 
-std::ostream& PostingList::dump(std::ostream& os) const {
+namespace {
+
+// Arrays of a PostingArray are packed one after another, aligned for any of their types.
+size_t align(size_t bytes) {
+    const size_t alignment = sizeof(uint64_t);
+    return (bytes + alignment - 1) / alignment * alignment;
+}
+
+}
+
+template <typename Traits>
+size_t BasicPostingArray<Traits>::get_bytes(size_t length, size_t * skip_bytes, size_t set_bytes) {
+    size_t blocks = (length + kPostingBlockSize - 1) / kPostingBlockSize;
+    size_t skip = align(blocks * sizeof(WeightType));
+    size_t doc_ids = align(set_bytes);
+    if (!set_bytes) {
+        skip += align(blocks * sizeof(IdType));
+        doc_ids = align(length * sizeof(IdType));
+    }
+    if (skip_bytes) {
+        *skip_bytes = skip;
+    }
+    return doc_ids + align(length * sizeof(WeightType))
+        + align(length * sizeof(Document *)) + skip;
+}
+
+template <typename Traits>
+size_t BasicPostingList<Traits>::plan_seal(std::vector<IdType> * ids, size_t * set_bytes) const {
+    ids->reserve(size_);
+    for (PostingListNode * node = first_; node->next; node = node->next) {
+        ids->push_back(node->doc->id);
+    }
+    // Keep doc ids in a DocIdSet if it takes at most half of the array and block
+    // last ids, then cursors skip by chunk instead of by block.
+    size_t length = size_ + 1;
+    size_t blocks = (length + kPostingBlockSize - 1) / kPostingBlockSize;
+    *set_bytes = ids->empty() ? 0 : DocIdSet::get_bytes(&(*ids)[0], ids->size());
+    if (*set_bytes * 2 > align(length * sizeof(IdType)) + align(blocks * sizeof(IdType))) {
+        *set_bytes = 0;
+    }
+    return PostingArray::get_bytes(length, 0, *set_bytes);
+}
+
+template <typename Traits>
+size_t BasicPostingList<Traits>::get_seal_bytes() const {
+    std::vector<IdType> ids;
+    size_t set_bytes;
+    return plan_seal(&ids, &set_bytes);
+}
+
+template <typename Traits>
+void BasicPostingList<Traits>::seal(Arena * arena) {
+    if (array_) {
+        if (!arena) {
+            return;
+        }
+        delete array_;
+        array_ = 0;
+    }
+
+    std::vector<IdType> ids;
+    size_t set_bytes;
+    size_t bytes = plan_seal(&ids, &set_bytes);
+    // the sentinel node is included
+    size_t length = size_ + 1;
+    size_t blocks = (length + kPostingBlockSize - 1) / kPostingBlockSize;
+    PostingArray * array = new PostingArray();
+    char * p;
+    if (arena) {
+        p = (char *)arena->allocate(bytes);
+    } else {
+        // new aligns for any type
+        array->storage = new char[bytes];
+        p = array->storage;
+    }
+    if (set_bytes) {
+        array->doc_id_set.build(&ids[0], ids.size(), p);
+        p += align(set_bytes);
+    } else {
+        array->doc_ids = (IdType *)p;
+        p += align(length * sizeof(IdType));
+    }
+    array->weights = (WeightType *)p;
+    p += align(length * sizeof(WeightType));
+    array->docs = (typename PostingArray::Document **)p;
+    p += align(length * sizeof(typename PostingArray::Document *));
+    if (!set_bytes) {
+        array->block_last_ids = (IdType *)p;
+        p += align(blocks * sizeof(IdType));
+    }
+    array->block_max_weights = (WeightType *)p;
+    array->upper_bound = upper_bound_;
+    array->length = length;
+
+    size_t i = 0;
+    for (PostingListNode * node = first_; node; node = node->next, i++) {
+        size_t block = i / kPostingBlockSize;
+        if (i % kPostingBlockSize == 0) {
+            array->block_max_weights[block] = 0;
+        }
+        array->block_max_weights[block] = std::max(array->block_max_weights[block], node->bound);
+        if (!set_bytes) {
+            array->block_last_ids[block] = node->doc->id;
+            array->doc_ids[i] = node->doc->id;
+        }
+        array->weights[i] = node->bound;
+        array->docs[i] = node->doc;
+    }
+    array_ = array;
+}
+
+template <typename Traits>
+std::ostream& BasicPostingList<Traits>::dump(std::ostream& os) const {
     os << "  posting list size: " << size_ << ", upper bound: " << upper_bound_ << "\n";
     PostingListNode * p = first_;
     PostingListNode * pp;
@@ -66,13 +179,111 @@ std::ostream& PostingList::dump(std::ostream& os) const {
     return os;
 }
 
-class InvertedIndex::Impl {
+void IndexMemoryUsage::clear() {
+    dictionary = 0;
+    posting_nodes = 0;
+    posting_arrays = 0;
+    skip_data = 0;
+    documents = 0;
+    term_vectors = 0;
+    attributes = 0;
+    slack = 0;
+    huge_pages = 0;
+    numa_bound = 0;
+}
+
+size_t IndexMemoryUsage::total() const {
+    return dictionary + posting_nodes + posting_arrays + skip_data
+        + documents + term_vectors + attributes + slack;
+}
+
+std::ostream& IndexMemoryUsage::dump(std::ostream& os) const {
+    const char * names[] = {
+        "dictionary", "posting nodes", "posting arrays", "skip data",
+        "documents", "term vectors", "attributes", "slack"
+    };
+    size_t bytes[] = {
+        dictionary, posting_nodes, posting_arrays, skip_data,
+        documents, term_vectors, attributes, slack
+    };
+    size_t sum = total();
+    for (size_t i = 0; i < sizeof(bytes) / sizeof(bytes[0]); i++) {
+        os << names[i] << ": " << bytes[i] << " bytes";
+        if (sum) {
+            os << " (" << bytes[i] * 1000 / sum / 10.0 << "%)";
+        }
+        os << "\n";
+    }
+    os << "total: " << sum << " bytes" << "\n";
+    os << "in huge page arenas: " << huge_pages << " bytes" << "\n";
+    os << "bound to NUMA nodes: " << numa_bound << " bytes" << "\n";
+    return os;
+}
+
+namespace {
+
+// bytes malloc spends on an allocation of 'bytes' besides them
+size_t malloc_overhead(size_t bytes) {
+    if (bytes == 0) {
+        return 0;
+    }
+    const size_t alignment = 2 * sizeof(size_t);
+    size_t chunk = (bytes + sizeof(size_t) + alignment - 1) & ~(alignment - 1);
+    if (chunk < 2 * alignment) {
+        chunk = 2 * alignment;
+    }
+    return chunk - bytes;
+}
+
+void add_object(size_t * field, size_t * slack, size_t bytes) {
+    *field += bytes;
+    *slack += malloc_overhead(bytes);
+}
+
+template <typename T>
+void add_vector(size_t * field, size_t * slack, const std::vector<T>& v) {
+    *field += v.size() * sizeof(T);
+    *slack += (v.capacity() - v.size()) * sizeof(T) + malloc_overhead(v.capacity() * sizeof(T));
+}
+
+}
+
+static uint64_t next_version() {
+    // indexes may be built in different threads
+    static volatile uint64_t version = 0;
+    return atomic_fetch_add(&version, (uint64_t)1) + 1;
+}
+
+template <typename Traits>
+class BasicInvertedIndex<Traits>::Impl {
 private:
     typedef HASH_MAP<IdType, PostingList *> HashTableType;
+
+    // slot of the open addressing dictionary built by seal, empty if posting_list is 0
+    struct DictionaryEntry {
+        IdType term_id;
+        PostingList * posting_list;
+    };
+
     HashTableType ht_;
+    AttributeStore attributes_;
+    size_t doc_count_;
+    uint64_t version_;
+    bool sealed_;
+    // posting arrays and the dictionary of the last seal,
+    // kept after unsealing while untouched posting lists still use their arrays
+    Arena * arena_;
+    DictionaryEntry * dictionary_;
+    size_t dictionary_mask_;
+
+    static size_t hash(IdType term_id) {
+        uint64_t h = (uint64_t)term_id * 0x9e3779b97f4a7c15ULL;
+        return (size_t)(h ^ (h >> 32));
+    }
 
 public:
-    Impl() : ht_() {}
+    Impl() : ht_(), attributes_(), doc_count_(0), version_(next_version()), sealed_(false),
+        arena_(0), dictionary_(0), dictionary_mask_(0) {}
 
     ~Impl() {
         clear();
@@ -81,13 +292,39 @@ public:
     void insert(Document * doc);
     const PostingList * find(IdType term_id) const;
     void clear();
+    void seal(bool huge_pages, int numa_node);
+
+    bool sealed() const {
+        return sealed_;
+    }
+
+    size_t doc_count() const {
+        return doc_count_;
+    }
+
+    const AttributeStore& attributes() const {
+        return attributes_;
+    }
+
+    uint64_t version() const {
+        return version_;
+    }
+
+    uint64_t warm() const;
+    void memory_usage(IndexMemoryUsage * usage) const;
     std::ostream& dump(std::ostream& os) const;
 };
 
-void InvertedIndex::Impl::insert(Document * doc) {
+template <typename Traits>
+void BasicInvertedIndex<Traits>::Impl::insert(Document * doc) {
+    typedef BasicPostingListNode<Traits> PostingListNode;
+
+    doc->ordinal = (OrdinalType)doc_count_++;
+    attributes_.append(doc->attributes);
+    AttributeVector().swap(doc->attributes);
     size_t term_size = doc->terms.size();
     for (size_t i = 0; i < term_size; i++) {
-        const Term& term = doc->terms[i];
+        const BasicTerm<Traits>& term = doc->terms[i];
 
         PostingListNode * node = PostingListNode::get_node();
         node->doc = doc;
@@ -102,10 +339,23 @@ void InvertedIndex::Impl::insert(Document * doc) {
     }
 
     doc->release_ref();
+    version_ = next_version();
+    sealed_ = false;
 }
 
-const PostingList * InvertedIndex::Impl::find(IdType term_id) const {
-    HashTableType::const_iterator it = ht_.find(term_id);
+template <typename Traits>
+const typename BasicInvertedIndex<Traits>::PostingList *
+BasicInvertedIndex<Traits>::Impl::find(IdType term_id) const {
+    if (sealed_) {
+        for (size_t i = hash(term_id) & dictionary_mask_;; i = (i + 1) & dictionary_mask_) {
+            const DictionaryEntry& entry = dictionary_[i];
+            if (entry.posting_list == 0 || entry.term_id == term_id) {
+                return entry.posting_list;
+            }
+        }
+    }
+
+    typename HashTableType::const_iterator it = ht_.find(term_id);
     if (it == ht_.end()) {
         return 0;
     } else {
@@ -113,18 +363,177 @@ const PostingList * InvertedIndex::Impl::find(IdType term_id) const {
     }
 }
 
-void InvertedIndex::Impl::clear() {
-    HashTableType::iterator it = ht_.begin();
-    HashTableType::iterator last = ht_.end();
+template <typename Traits>
+void BasicInvertedIndex<Traits>::Impl::clear() {
+    typename HashTableType::iterator it = ht_.begin();
+    typename HashTableType::iterator last = ht_.end();
     for (; it != last; ++it) {
         delete (*it).second;
     }
     ht_.clear();
+    attributes_.clear();
+    doc_count_ = 0;
+    version_ = next_version();
+    sealed_ = false;
+    delete arena_;
+    arena_ = 0;
+    dictionary_ = 0;
+    dictionary_mask_ = 0;
+}
+
+template <typename Traits>
+void BasicInvertedIndex<Traits>::Impl::seal(bool huge_pages, int numa_node) {
+    if (sealed_) {
+        return;
+    }
+
+    // at most half full
+    size_t capacity = 2;
+    while (capacity < ht_.size() * 2) {
+        capacity *= 2;
+    }
+    size_t dictionary_bytes = align(capacity * sizeof(DictionaryEntry));
+    // as the arena rounds up every allocation
+    size_t bytes = Arena::allocation_size(dictionary_bytes);
+    typename HashTableType::iterator it = ht_.begin();
+    typename HashTableType::iterator last = ht_.end();
+    for (; it != last; ++it) {
+        bytes += Arena::allocation_size((*it).second->get_seal_bytes());
+    }
+
+    // Rebuild every array in one new arena, the old one may be shared by arrays
+    // of lists untouched since the last seal, it is freed after all of them are rebuilt.
+    Arena * arena = new Arena(huge_pages, numa_node);
+    arena->reserve(bytes);
+    DictionaryEntry * dictionary = (DictionaryEntry *)arena->allocate(dictionary_bytes);
+    for (size_t i = 0; i < capacity; i++) {
+        dictionary[i].term_id = 0;
+        dictionary[i].posting_list = 0;
+    }
+    size_t mask = capacity - 1;
+    for (it = ht_.begin(); it != last; ++it) {
+        PostingList * posting_list = (*it).second;
+        posting_list->seal(arena);
+        size_t i = hash((*it).first) & mask;
+        while (dictionary[i].posting_list) {
+            i = (i + 1) & mask;
+        }
+        dictionary[i].term_id = (*it).first;
+        dictionary[i].posting_list = posting_list;
+    }
+
+    delete arena_;
+    arena_ = arena;
+    dictionary_ = dictionary;
+    dictionary_mask_ = mask;
+    sealed_ = true;
+}
+
+template <typename Traits>
+void BasicInvertedIndex<Traits>::Impl::memory_usage(IndexMemoryUsage * usage) const {
+    typedef BasicPostingListNode<Traits> PostingListNode;
+    typedef BasicPostingArray<Traits> PostingArray;
+    typedef typename Traits::WeightType WeightType;
+    typedef typename HashTableType::value_type ValueType;
+
+    usage->clear();
+    // buckets, and nodes holding a next pointer and the value
+    usage->dictionary += ht_.bucket_count() * sizeof(void *);
+    usage->slack += malloc_overhead(ht_.bucket_count() * sizeof(void *));
+    // bytes of the arena in use, the rest of it is slack
+    size_t arena_bytes = 0;
+    if (sealed_) {
+        arena_bytes += (dictionary_mask_ + 1) * sizeof(DictionaryEntry);
+        usage->dictionary += (dictionary_mask_ + 1) * sizeof(DictionaryEntry);
+    }
+    if (arena_) {
+        usage->huge_pages = arena_->huge_page_bytes();
+        usage->numa_bound = arena_->numa_bytes();
+    }
+
+    // A doc is in the posting list of each of its terms, count it once by ordinal.
+    std::vector<char> counted_docs(doc_count_, 0);
+    typename HashTableType::const_iterator it = ht_.begin();
+    typename HashTableType::const_iterator last = ht_.end();
+    for (; it != last; ++it) {
+        const PostingList * posting_list = (*it).second;
+        add_object(&usage->dictionary, &usage->slack, sizeof(void *) + sizeof(ValueType));
+        add_object(&usage->dictionary, &usage->slack, sizeof(PostingList));
+
+        for (const PostingListNode * p = posting_list->front(); p; p = p->next) {
+            add_object(&usage->posting_nodes, &usage->slack, sizeof(PostingListNode));
+            const Document * doc = p->doc;
+            if (doc->is_sentinel() || doc->ordinal >= doc_count_ || counted_docs[doc->ordinal]) {
+                continue;
+            }
+            counted_docs[doc->ordinal] = 1;
+            add_object(&usage->documents, &usage->slack, sizeof(Document));
+            add_vector(&usage->term_vectors, &usage->slack, doc->terms);
+        }
+
+        const PostingArray * array = posting_list->array();
+        if (array) {
+            add_object(&usage->posting_arrays, &usage->slack, sizeof(PostingArray));
+            const DocIdSet& set = array->doc_id_set;
+            size_t postings = array->length * (sizeof(WeightType) + sizeof(Document *));
+            size_t skip = array->block_count() * sizeof(WeightType);
+            if (set.chunks) {
+                // chunk headers skip like block last ids
+                size_t chunks = (set.chunk_count + 1) * sizeof(DocIdSet::Chunk);
+                postings += set.bytes - chunks;
+                skip += chunks;
+            } else {
+                postings += array->length * sizeof(IdType);
+                skip += array->block_count() * sizeof(IdType);
+            }
+            usage->posting_arrays += postings;
+            usage->skip_data += skip;
+            if (array->storage) {
+                // sealed on its own, padding and malloc overhead are slack
+                size_t bytes = PostingArray::get_bytes(array->length, 0, set.bytes);
+                usage->slack += bytes + malloc_overhead(bytes) - postings - skip;
+            } else {
+                arena_bytes += postings + skip;
+            }
+        }
+    }
+    if (arena_) {
+        usage->slack += arena_->size() - arena_bytes;
+    }
+
+    for (size_t i = 0; i < attributes_.column_count(); i++) {
+        add_vector(&usage->attributes, &usage->slack, attributes_.column_values(i));
+    }
 }
 
-std::ostream& InvertedIndex::Impl::dump(std::ostream& os) const {
-    HashTableType::const_iterator it = ht_.begin();
-    HashTableType::const_iterator last = ht_.end();
+template <typename Traits>
+uint64_t BasicInvertedIndex<Traits>::Impl::warm() const {
+    typedef BasicPostingArray<Traits> PostingArray;
+
+    uint64_t sum = arena_ ? arena_->touch() : 0;
+    typename HashTableType::const_iterator it = ht_.begin();
+    typename HashTableType::const_iterator last = ht_.end();
+    for (; it != last; ++it) {
+        const PostingList * posting_list = (*it).second;
+        const PostingArray * array = posting_list->array();
+        // what a cursor reads when it is opened
+        if (array) {
+            sum += array->doc_ids ? array->doc_ids[0] : array->doc_id_set.chunks[0].key;
+            sum += weight_bits(array->weights[0]) + weight_bits(array->block_max_weights[0]);
+            if (array->block_last_ids) {
+                sum += array->block_last_ids[0];
+            }
+        } else {
+            sum += posting_list->front()->doc->id;
+        }
+    }
+    return sum;
+}
+
+template <typename Traits>
+std::ostream& BasicInvertedIndex<Traits>::Impl::dump(std::ostream& os) const {
+    typename HashTableType::const_iterator it = ht_.begin();
+    typename HashTableType::const_iterator last = ht_.end();
     for (; it != last; ++it) {
         const IdType& term_id = (*it).first;
         const PostingList& posting_list = *(*it).second;
@@ -134,41 +543,73 @@ std::ostream& InvertedIndex::Impl::dump(std::ostream& os) const {
     return os;
 }
 
-InvertedIndex::InvertedIndex() {
+template <typename Traits>
+BasicInvertedIndex<Traits>::BasicInvertedIndex() {
     impl_ = new Impl();
 }
 
-InvertedIndex::~InvertedIndex() {
+template <typename Traits>
+BasicInvertedIndex<Traits>::~BasicInvertedIndex() {
     delete impl_;
 }
 
-void InvertedIndex::insert(Document * doc) {
+template <typename Traits>
+void BasicInvertedIndex<Traits>::insert(Document * doc) {
     impl_->insert(doc);
 }
 
-const PostingList * InvertedIndex::find(IdType term_id) const {
+template <typename Traits>
+const typename BasicInvertedIndex<Traits>::PostingList *
+BasicInvertedIndex<Traits>::find(IdType term_id) const {
     return impl_->find(term_id);
 }
 
-void InvertedIndex::clear() {
+template <typename Traits>
+const AttributeStore& BasicInvertedIndex<Traits>::attributes() const {
+    return impl_->attributes();
+}
+
+template <typename Traits>
+void BasicInvertedIndex<Traits>::clear() {
     impl_->clear();
 }
 
-std::ostream& InvertedIndex::dump(std::ostream& os) const {
-    return impl_->dump(os);
+template <typename Traits>
+void BasicInvertedIndex<Traits>::seal(bool huge_pages, int numa_node) {
+    impl_->seal(huge_pages, numa_node);
 }
 
-std::ostream& operator << (std::ostream& os, const PostingListNode& node) {
-    node.dump(os);
-    return os;
+template <typename Traits>
+bool BasicInvertedIndex<Traits>::sealed() const {
+    return impl_->sealed();
 }
 
-std::ostream& operator << (std::ostream& os, const PostingList& pl) {
-    pl.dump(os);
-    return os;
+template <typename Traits>
+size_t BasicInvertedIndex<Traits>::doc_count() const {
+    return impl_->doc_count();
 }
 
-std::ostream& operator << (std::ostream& os, const InvertedIndex& ii) {
-    ii.dump(os);
-    return os;
+template <typename Traits>
+uint64_t BasicInvertedIndex<Traits>::version() const {
+    return impl_->version();
 }
+
+template <typename Traits>
+uint64_t BasicInvertedIndex<Traits>::warm() const {
+    return impl_->warm();
+}
+
+template <typename Traits>
+void BasicInvertedIndex<Traits>::memory_usage(IndexMemoryUsage * usage) const {
+    impl_->memory_usage(usage);
+}
+
+template <typename Traits>
+std::ostream& BasicInvertedIndex<Traits>::dump(std::ostream& os) const {
+    return impl_->dump(os);
+}
+
+WAND_ENGINE_INSTANTIATE(struct BasicPostingListNode)
+WAND_ENGINE_INSTANTIATE(struct BasicPostingArray)
+WAND_ENGINE_INSTANTIATE(class BasicPostingList)
+WAND_ENGINE_INSTANTIATE(class BasicInvertedIndex)
@@ -2,62 +2,133 @@
 #define WAND_ENGINE_INDEX_H
 
 #include "document.h"
+#include "arena.h"
+#include "attribute_store.h"
+#include "doc_id_set.h"
 #include <ostream>
+#include <vector>
+
+template <typename Traits>
+struct BasicPostingListNode {
+    typedef typename Traits::WeightType WeightType;
+    typedef BasicDocument<Traits> Document;
 
-struct PostingListNode {
     Document * doc;
-    ScoreType bound;// bound value used to estimate upper bound
-    PostingListNode * next;
+    WeightType bound;// bound value used to estimate upper bound
+    BasicPostingListNode * next;
 
     std::ostream& dump(std::ostream& os) const;
 
-    static PostingListNode * get_node() {
-        return new PostingListNode();
+    static BasicPostingListNode * get_node() {
+        return new BasicPostingListNode();
     }
 
-    static PostingListNode * get_sentinel_node() {
-        PostingListNode * sentinel = get_node();
+    static BasicPostingListNode * get_sentinel_node() {
+        BasicPostingListNode * sentinel = get_node();
         sentinel->doc = Document::sentinel();
         sentinel->bound = 0;
         sentinel->next = 0;
         return sentinel;
     }
 
-    static void put_node(PostingListNode * node) {
+    static void put_node(BasicPostingListNode * node) {
         delete node;
     }
 
 private:
-    PostingListNode() : doc(0) {}
-    ~PostingListNode() {
+    BasicPostingListNode() : doc(0) {}
+    ~BasicPostingListNode() {
         if (doc) {
             doc->release_ref();
         }
     }
 
 private:
-    PostingListNode(PostingListNode& other);
-    PostingListNode& operator=(PostingListNode& other);
+    BasicPostingListNode(BasicPostingListNode& other);
+    BasicPostingListNode& operator=(BasicPostingListNode& other);
 };
 
-class PostingList {
+// postings per block of BasicPostingArray
+const size_t kPostingBlockSize = 64;
+
+// Immutable copy of a PostingList in arrays, built by PostingList::seal.
+// All arrays end with the sentinel doc, which also ends the last block.
+// The arrays live in the Arena passed to seal, or in 'storage' owned by this.
+//
+// Doc ids are either in 'doc_ids', with 'block_last_ids' to skip blocks,
+// or in 'doc_id_set' when it takes at most half their bytes, which is the case
+// of dense lists. Then 'doc_ids' and 'block_last_ids' are 0.
+template <typename Traits>
+struct BasicPostingArray {
+    typedef typename Traits::WeightType WeightType;
+    typedef BasicDocument<Traits> Document;
+
+    IdType * doc_ids;
+    DocIdSet doc_id_set;// without the sentinel, empty if 'doc_ids' is used
+    WeightType * weights;
+    Document ** docs;// references are held by the PostingList
+    // every kPostingBlockSize postings
+    IdType * block_last_ids;
+    WeightType * block_max_weights;
+    WeightType upper_bound;
+    size_t length;// with the sentinel
+    char * storage;// 0 if in an Arena
+
+    BasicPostingArray()
+        : doc_ids(0), doc_id_set(), weights(0), docs(0), block_last_ids(0), block_max_weights(0),
+        upper_bound(0), length(0), storage(0) {
+    }
+
+    ~BasicPostingArray() {
+        delete [] storage;
+    }
+
+    // without the sentinel
+    size_t size() const {
+        return length - 1;
+    }
+
+    size_t block_count() const {
+        return (length + kPostingBlockSize - 1) / kPostingBlockSize;
+    }
+
+    // Bytes of the arrays of 'length' postings, each one aligned to 8 bytes,
+    // and bytes of the block arrays among them.
+    // 'set_bytes' is DocIdSet::get_bytes if doc ids are in a DocIdSet, otherwise 0.
+    static size_t get_bytes(size_t length, size_t * skip_bytes = 0, size_t set_bytes = 0);
+
+private:
+    BasicPostingArray(BasicPostingArray& other);
+    BasicPostingArray& operator=(BasicPostingArray& other);
+};
+
+template <typename Traits>
+class BasicPostingList {
+public:
+    typedef typename Traits::WeightType WeightType;
+    typedef BasicPostingListNode<Traits> PostingListNode;
+    typedef BasicPostingArray<Traits> PostingArray;
+
 private:
     PostingListNode * first_;
     PostingListNode * last_;
     IdType upper_id_;
-    ScoreType upper_bound_;
+    WeightType upper_bound_;
     size_t size_;
+    PostingArray * array_;
 
 public:
-    PostingList() :
+    BasicPostingList() :
         first_(PostingListNode::get_sentinel_node()),
         last_(0),
         upper_id_(0),
         upper_bound_(0),
-        size_(0) {
+        size_(0),
+        array_(0) {
         }
 
-    ~PostingList() {
+    ~BasicPostingList() {
+        delete array_;
         PostingListNode * p = first_;
         PostingListNode * pp;
         while (p) {
@@ -71,7 +142,7 @@ public:
         return first_;
     }
 
-    ScoreType get_upper_bound() const {
+    WeightType get_upper_bound() const {
         return upper_bound_;
     }
 
@@ -83,37 +154,132 @@ public:
         return size_ == 0;
     }
 
+    // 0 if not sealed
+    const PostingArray * array() const {
+        return array_;
+    }
+
     // node and node->doc must be produced by "get_node"
     // node->doc, node->bound must be filled before insertion
+    // It unseals the list.
     void insert(PostingListNode * node);
+    // Build "array()" in 'arena', which must outlive the array.
+    // Without 'arena' the array owns its memory and an existing array is kept,
+    // with 'arena' an existing array is rebuilt in it.
+    void seal(Arena * arena = 0);
+    // bytes seal allocates for the array
+    size_t get_seal_bytes() const;
     std::ostream& dump(std::ostream& os) const;
 
 private:
-    PostingList(PostingList& other);
-    PostingList& operator=(PostingList& other);
+    // Fill 'ids' with the doc ids, return the bytes of the array
+    // and set 'set_bytes' as BasicPostingArray::get_bytes takes it.
+    size_t plan_seal(std::vector<IdType> * ids, size_t * set_bytes) const;
+
+    BasicPostingList(BasicPostingList& other);
+    BasicPostingList& operator=(BasicPostingList& other);
 };
 
-class InvertedIndex {
+// Bytes used by an InvertedIndex, filled by InvertedIndex::memory_usage.
+struct IndexMemoryUsage {
+    size_t dictionary;// hash table from term ids to posting lists, and PostingList objects
+    size_t posting_nodes;// linked list nodes, including the sentinel nodes
+    size_t posting_arrays;// doc ids, weights and docs of sealed posting lists
+    size_t skip_data;// block last ids and block max weights of sealed posting lists
+    size_t documents;// Document objects
+    size_t term_vectors;// Document::terms
+    size_t attributes;// AttributeStore columns
+    // Unused capacity of vectors and arenas, alignment padding, and malloc overhead
+    // of every allocation, estimated as glibc does: 8 bytes of header,
+    // 16 bytes alignment, 32 bytes at least.
+    size_t slack;
+    // bytes of the above in huge page arenas, not a part of total()
+    size_t huge_pages;
+    // bytes of the above in arenas bound to NUMA nodes, not a part of total()
+    size_t numa_bound;
+
+    IndexMemoryUsage() {
+        clear();
+    }
+
+    void clear();
+    size_t total() const;
+    std::ostream& dump(std::ostream& os) const;
+};
+
+inline std::ostream& operator << (std::ostream& os, const IndexMemoryUsage& usage) {
+    usage.dump(os);
+    return os;
+}
+
+template <typename Traits>
+class BasicInvertedIndex {
+public:
+    typedef BasicDocument<Traits> Document;
+    typedef BasicPostingList<Traits> PostingList;
+
 private:
     class Impl;
     Impl * impl_;
 public:
-    InvertedIndex();
-    ~InvertedIndex();
+    BasicInvertedIndex();
+    ~BasicInvertedIndex();
 
     // callers can't use "doc" any more.
+    // "doc->ordinal" is assigned in [0, doc_count()),
+    // "doc->attributes" are moved into attributes().
     void insert(Document * doc);
     const PostingList * find(IdType term_id) const;
+    // attributes of all docs by ordinal
+    const AttributeStore& attributes() const;
     void clear();
+    size_t doc_count() const;
+    // Build arrays of all posting lists, which search uses instead of linked lists,
+    // and a flat term dictionary, which find uses instead of the hash table.
+    // With 'huge_pages' they are allocated from huge page backed memory(see Arena),
+    // 'numa_node' places them on a NUMA node or interleaves them(see Numa::bind).
+    // Call it after all docs are inserted, "insert" and "clear" unseal the index.
+    // The linked lists stay next to the arrays, so a sealed index takes about
+    // a third more memory than a linked one: "insert" rebuilds arrays from them,
+    // and search_taat_v1, search_taat_v2 and TermGroupCache read them.
+    void seal(bool huge_pages = true, int numa_node = Numa::kAnyNode);
+    bool sealed() const;
+    // changes whenever the index is modified,
+    // and is unique among all InvertedIndex instances.
+    uint64_t version() const;
+    // Read every page of the sealed arrays and the head of every posting list,
+    // so the first queries of a new index don't take the page faults and cache misses.
+    // Return a sum of what was read, only to keep the reads.
+    uint64_t warm() const;
+    // Walk the whole index, it takes about as long as seal.
+    void memory_usage(IndexMemoryUsage * usage) const;
     std::ostream& dump(std::ostream& os) const;
 
 private:
-    InvertedIndex(InvertedIndex& other);
-    InvertedIndex& operator=(InvertedIndex& other);
+    BasicInvertedIndex(BasicInvertedIndex& other);
+    BasicInvertedIndex& operator=(BasicInvertedIndex& other);
 };
 
-std::ostream& operator << (std::ostream& os, const PostingListNode& doc);
-std::ostream& operator << (std::ostream& os, const PostingList& doc);
-std::ostream& operator << (std::ostream& os, const InvertedIndex& doc);
+template <typename Traits>
+inline std::ostream& operator << (std::ostream& os, const BasicPostingListNode<Traits>& node) {
+    node.dump(os);
+    return os;
+}
+
+template <typename Traits>
+inline std::ostream& operator << (std::ostream& os, const BasicPostingList<Traits>& pl) {
+    pl.dump(os);
+    return os;
+}
+
+template <typename Traits>
+inline std::ostream& operator << (std::ostream& os, const BasicInvertedIndex<Traits>& ii) {
+    ii.dump(os);
+    return os;
+}
+
+typedef BasicPostingListNode<DefaultScoreTraits> PostingListNode;
+typedef BasicPostingList<DefaultScoreTraits> PostingList;
+typedef BasicInvertedIndex<DefaultScoreTraits> InvertedIndex;
 
 #endif// WAND_ENGINE_INDEX_H
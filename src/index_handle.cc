@@ -0,0 +1,241 @@
+#include "index_handle.h"
+#include "atomic.h"
+#include <sched.h>
+
+template <typename Traits>
+BasicIndexHandle<Traits>::BasicIndexHandle(size_t heap_size, ScoreType threshold,
+        bool huge_pages)
+    : heap_size_(heap_size), threshold_(threshold), huge_pages_(huge_pages),
+    warm_queries_(), load_task_(), load_joinable_(false),
+    acquiring_(0), current_(0), published_(0), retired_(), reclaimed_(0),
+    stopping_(false), reclaiming_(false), loading_(false), load_result_(false) {
+    pthread_mutex_init(&mutex_, 0);
+    pthread_cond_init(&reclaim_cond_, 0);
+    reclaiming_ = pthread_create(&reclaimer_, 0, reclaimer_main, this) == 0;
+}
+
+template <typename Traits>
+BasicIndexHandle<Traits>::~BasicIndexHandle() {
+    wait_load();
+
+    pthread_mutex_lock(&mutex_);
+    stopping_ = true;
+    pthread_cond_signal(&reclaim_cond_);
+    pthread_mutex_unlock(&mutex_);
+    if (reclaiming_) {
+        pthread_join(reclaimer_, 0);
+        reclaiming_ = false;
+    }
+
+    delete current_;
+    pthread_cond_destroy(&reclaim_cond_);
+    pthread_mutex_destroy(&mutex_);
+}
+
+template <typename Traits>
+void * BasicIndexHandle<Traits>::reclaimer_main(void * arg) {
+    ((BasicIndexHandle *)arg)->reclaim();
+    return 0;
+}
+
+template <typename Traits>
+void BasicIndexHandle<Traits>::reclaim() {
+    std::vector<Version *> versions;
+    pthread_mutex_lock(&mutex_);
+    for (;;) {
+        while (retired_.empty() && !stopping_) {
+            pthread_cond_wait(&reclaim_cond_, &mutex_);
+        }
+        if (retired_.empty()) {
+            break;
+        }
+        versions.swap(retired_);
+        pthread_mutex_unlock(&mutex_);
+        wait_acquires();
+        // freeing a large index takes milliseconds, out of the lock
+        for (size_t i = 0; i < versions.size(); i++) {
+            delete versions[i];
+        }
+        pthread_mutex_lock(&mutex_);
+        reclaimed_ += versions.size();
+        versions.clear();
+    }
+    pthread_mutex_unlock(&mutex_);
+}
+
+template <typename Traits>
+void BasicIndexHandle<Traits>::wait_acquires() {
+    // An acquire reading a retired version started before it was replaced,
+    // it's over when the counter gets to 0 once. It's 0 most of the time,
+    // acquires are a few instructions long.
+    while (atomic_fetch_add(&acquiring_, (size_t)0) != 0) {
+        sched_yield();
+    }
+}
+
+template <typename Traits>
+void BasicIndexHandle<Traits>::retire(Version * version) {
+    pthread_mutex_lock(&mutex_);
+    bool reclaiming = reclaiming_;
+    if (reclaiming) {
+        retired_.push_back(version);
+        pthread_cond_signal(&reclaim_cond_);
+    } else {
+        reclaimed_++;
+    }
+    pthread_mutex_unlock(&mutex_);
+    if (!reclaiming) {
+        wait_acquires();
+        delete version;
+    }
+}
+
+template <typename Traits>
+void BasicIndexHandle<Traits>::unref(Version * version) {
+    if (atomic_fetch_add(&version->refs_, (size_t)-1) == 1) {
+        retire(version);
+    }
+}
+
+template <typename Traits>
+const typename BasicIndexHandle<Traits>::Version * BasicIndexHandle<Traits>::acquire() {
+    // 'acquiring_' keeps the version read alive until the reference is taken.
+    // A version without references was replaced already and is being retired,
+    // it must not get one again, read the new one.
+    atomic_fetch_add(&acquiring_, (size_t)1);
+    Version * version;
+    for (;;) {
+        version = current_;
+        if (!version) {
+            break;
+        }
+        size_t refs = version->refs_;
+        if (refs != 0 && atomic_compare_exchange(&version->refs_, refs, refs + 1)) {
+            break;
+        }
+    }
+    atomic_fetch_add(&acquiring_, (size_t)-1);
+    return version;
+}
+
+template <typename Traits>
+void BasicIndexHandle<Traits>::release(const Version * version) {
+    unref(const_cast<Version *>(version));
+}
+
+template <typename Traits>
+void BasicIndexHandle<Traits>::publish(InvertedIndex * ii) {
+    if (!ii->sealed()) {
+        ii->seal(huge_pages_);
+    }
+    ii->warm();
+    Version * version = new Version();
+    version->index_ = ii;
+    version->wand_ = new Wand(*ii, heap_size_, threshold_);
+    if (!warm_queries_.empty()) {
+        typename Wand::QueryContext context;
+        std::vector<typename Wand::DocIdScore> result;
+        TermVector query;
+        for (size_t i = 0, s = warm_queries_.size(); i < s; i++) {
+            query = warm_queries_[i];
+            version->wand_->search(&context, query, &result);
+        }
+    }
+
+    pthread_mutex_lock(&mutex_);
+    Version * old = current_;
+    version->number_ = ++published_;
+    current_ = version;
+    pthread_mutex_unlock(&mutex_);
+    if (old) {
+        unref(old);
+    }
+}
+
+template <typename Traits>
+bool BasicIndexHandle<Traits>::load(Loader loader, void * arg) {
+    InvertedIndex * ii = new InvertedIndex();
+    if (!loader(ii, arg)) {
+        delete ii;
+        return false;
+    }
+    publish(ii);
+    return true;
+}
+
+template <typename Traits>
+void * BasicIndexHandle<Traits>::loader_main(void * arg) {
+    LoadTask * task = (LoadTask *)arg;
+    BasicIndexHandle * handle = task->handle;
+    bool result = handle->load(task->loader, task->arg);
+    pthread_mutex_lock(&handle->mutex_);
+    handle->load_result_ = result;
+    handle->loading_ = false;
+    pthread_mutex_unlock(&handle->mutex_);
+    return 0;
+}
+
+template <typename Traits>
+bool BasicIndexHandle<Traits>::load_async(Loader loader, void * arg) {
+    pthread_mutex_lock(&mutex_);
+    bool loading = loading_;
+    loading_ = true;
+    pthread_mutex_unlock(&mutex_);
+    if (loading) {
+        return false;
+    }
+    if (load_joinable_) {
+        pthread_join(loader_, 0);
+        load_joinable_ = false;
+    }
+
+    load_task_.handle = this;
+    load_task_.loader = loader;
+    load_task_.arg = arg;
+    if (pthread_create(&loader_, 0, loader_main, &load_task_) != 0) {
+        // no thread, load in the calling one
+        loader_main(&load_task_);
+        return true;
+    }
+    load_joinable_ = true;
+    return true;
+}
+
+template <typename Traits>
+bool BasicIndexHandle<Traits>::wait_load() {
+    if (load_joinable_) {
+        pthread_join(loader_, 0);
+        load_joinable_ = false;
+    }
+    pthread_mutex_lock(&mutex_);
+    bool result = load_result_;
+    load_result_ = false;
+    pthread_mutex_unlock(&mutex_);
+    return result;
+}
+
+template <typename Traits>
+bool BasicIndexHandle<Traits>::loading() {
+    pthread_mutex_lock(&mutex_);
+    bool loading = loading_;
+    pthread_mutex_unlock(&mutex_);
+    return loading;
+}
+
+template <typename Traits>
+uint64_t BasicIndexHandle<Traits>::version_number() {
+    pthread_mutex_lock(&mutex_);
+    uint64_t number = current_ ? current_->number_ : 0;
+    pthread_mutex_unlock(&mutex_);
+    return number;
+}
+
+template <typename Traits>
+size_t BasicIndexHandle<Traits>::reclaimed_count() {
+    pthread_mutex_lock(&mutex_);
+    size_t count = reclaimed_;
+    pthread_mutex_unlock(&mutex_);
+    return count;
+}
+
+WAND_ENGINE_INSTANTIATE(class BasicIndexHandle)
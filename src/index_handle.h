@@ -0,0 +1,157 @@
+#ifndef WAND_ENGINE_INDEX_HANDLE_H
+#define WAND_ENGINE_INDEX_HANDLE_H
+
+#include "index.h"
+#include "wand.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <vector>
+
+// An InvertedIndex which can be replaced by a new version while it is searched.
+//
+// A version is an InvertedIndex with its Wand. Queries acquire the current version,
+// search it and release it. load fills a new index, in a background thread with
+// load_async, seals and warms it(see InvertedIndex::warm), searches the warm queries
+// on it, then switches acquire to it by a pointer store. acquire takes no lock,
+// it costs three atomic operations: on a counter of the handle, which all
+// concurrent queries share, and on the reference count of the version. An old
+// version goes away when its last query releases it, and is deleted by a thread
+// of the handle, not by the query releasing it.
+template <typename Traits>
+class BasicIndexHandle {
+public:
+    typedef BasicInvertedIndex<Traits> InvertedIndex;
+    typedef BasicWand<Traits> Wand;
+    typedef typename Traits::ScoreType ScoreType;
+    typedef typename BasicDocument<Traits>::TermVector TermVector;
+
+    // Fill 'ii', which is empty, from 'arg'. Return false to keep the current version.
+    typedef bool (*Loader)(InvertedIndex * ii, void * arg);
+
+    class Version {
+    private:
+        friend class BasicIndexHandle;
+
+        InvertedIndex * index_;
+        Wand * wand_;
+        uint64_t number_;
+        // one for every acquire, and one while it is the current version
+        volatile size_t refs_;
+
+        Version() : index_(0), wand_(0), number_(0), refs_(1) {}
+
+        ~Version() {
+            delete wand_;
+            delete index_;
+        }
+
+    public:
+        const InvertedIndex& index() const {
+            return *index_;
+        }
+
+        const Wand& wand() const {
+            return *wand_;
+        }
+
+        // 1 for the first version published by a handle
+        uint64_t number() const {
+            return number_;
+        }
+
+    private:
+        Version(Version& other);
+        Version& operator=(Version& other);
+    };
+
+private:
+    struct LoadTask {
+        BasicIndexHandle * handle;
+        Loader loader;
+        void * arg;
+    };
+
+    const size_t heap_size_;
+    const ScoreType threshold_;
+    const bool huge_pages_;
+    std::vector<TermVector> warm_queries_;
+    pthread_t reclaimer_;
+    // background load, only used by the thread calling load_async
+    LoadTask load_task_;
+    pthread_t loader_;
+    bool load_joinable_;
+
+    // acquires between reading 'current_' and taking their reference,
+    // versions are deleted only when there is none
+    volatile size_t acquiring_;
+    // written under 'mutex_', read without it by acquire
+    Version * volatile current_;
+
+    // guards all below
+    pthread_mutex_t mutex_;
+    pthread_cond_t reclaim_cond_;
+    uint64_t published_;
+    // released by their last query, deleted by 'reclaimer_'
+    std::vector<Version *> retired_;
+    size_t reclaimed_;
+    bool stopping_;
+    bool reclaiming_;// 'reclaimer_' is running, otherwise release deletes
+    bool loading_;
+    bool load_result_;
+
+    static void * reclaimer_main(void * arg);
+    static void * loader_main(void * arg);
+    void reclaim();
+    // Wait for the acquires which may have read a version retired by now.
+    void wait_acquires();
+    // the last reference of 'version' is gone
+    void retire(Version * version);
+    void unref(Version * version);
+
+public:
+    // Wands of versions are BasicWand(index, heap_size, threshold),
+    // indexes are sealed into huge pages if 'huge_pages'.
+    explicit BasicIndexHandle(size_t heap_size = 1000, ScoreType threshold = 0,
+            bool huge_pages = true);
+    // Wait for a background load. All versions must be released.
+    ~BasicIndexHandle();
+
+    // The current version, 0 if none is published yet.
+    // It stays valid until it is given to release, however many swaps happen meanwhile.
+    const Version * acquire();
+    void release(const Version * version);
+
+    // Fill a new index by 'loader' in the calling thread and publish it,
+    // return false if 'loader' failed.
+    bool load(Loader loader, void * arg);
+    // load in a background thread, return false if a load is running already.
+    // 'arg' must live until it is done.
+    // load_async and wait_load may be called by one thread at a time.
+    bool load_async(Loader loader, void * arg);
+    // Wait for the background load, return what it returned, false if there was none.
+    bool wait_load();
+    // whether the background load is running
+    bool loading();
+
+    // Seal 'ii' if it's not, warm it, then switch new queries to it. It takes 'ii'.
+    void publish(InvertedIndex * ii);
+
+    // Queries searched on every new version before it is published,
+    // so the posting lists they read are in cache. Not while a load is running.
+    void set_warm_queries(const std::vector<TermVector>& queries) {
+        warm_queries_ = queries;
+    }
+
+    // number of the current version, 0 if none
+    uint64_t version_number();
+    // old versions deleted so far
+    size_t reclaimed_count();
+
+private:
+    BasicIndexHandle(BasicIndexHandle& other);
+    BasicIndexHandle& operator=(BasicIndexHandle& other);
+};
+
+typedef BasicIndexHandle<DefaultScoreTraits> IndexHandle;
+
+#endif// WAND_ENGINE_INDEX_HANDLE_H
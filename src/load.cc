@@ -0,0 +1,399 @@
+// Send a query log to wand-server and report latency percentiles, like wand-replay.
+//
+// Queries are read like wand-replay and sent over 'connections' connections,
+// each keeping at most 'pipeline' requests outstanding. Requests go back to back
+// (closed loop), or at a target 'qps' over all connections(open loop) where latency
+// is measured from the time a request is scheduled, so a server falling behind
+// is not hidden by a full pipeline delaying requests.
+//
+// usage: wand-load (--socket=PATH | --port=N) --queries=FILE [--name=value ...],
+// run "wand-load --help" for options.
+#include "atomic.h"
+#include "cap_features.h"
+#include "histogram.h"
+#include "protocol.h"
+#include "timer.h"
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct LoadOptions {
+    std::string socket;
+    int port;
+    std::string queries;
+    size_t connections;
+    size_t pipeline;// outstanding requests per connection
+    double qps;// 0 means closed loop
+    size_t repeat;// times to send the query file
+    uint32_t k;// 0 means the k of the server
+    uint32_t timeout_us;// 0 means the timeout of the server
+
+    LoadOptions()
+        : socket(), port(0), queries(), connections(1), pipeline(1), qps(0), repeat(1),
+        k(0), timeout_us(0) {
+    }
+};
+
+// Return a connected socket, -1 on failure.
+int connect_to(const LoadOptions& options) {
+    int fd;
+    if (!options.socket.empty()) {
+        struct sockaddr_un addr;
+        if (options.socket.size() >= sizeof(addr.sun_path)) {
+            return -1;
+        }
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, options.socket.c_str());
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd != -1 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+            close(fd);
+            return -1;
+        }
+    } else {
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((uint16_t)options.port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd == -1) {
+            return -1;
+        }
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+            close(fd);
+            return -1;
+        }
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+    return fd;
+}
+
+bool send_all(int fd, const std::vector<char>& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(fd, &data[sent], data.size() - sent, MSG_NOSIGNAL);
+        if (n > 0) {
+            sent += n;
+        } else if (n == -1 && errno == EINTR) {
+            continue;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+void sleep_until_ns(uint64_t time) {
+    uint64_t now = now_ns();
+    if (now >= time) {
+        return;
+    }
+    struct timespec ts;
+    ts.tv_sec = (time_t)((time - now) / 1000000000);
+    ts.tv_nsec = (long)((time - now) % 1000000000);
+    nanosleep(&ts, 0);
+}
+
+class Load {
+private:
+    // Every connection has a thread sending requests and one receiving responses.
+    struct Connection {
+        Load * load;
+        int fd;
+        pthread_t sender;
+        pthread_t receiver;
+        pthread_mutex_t mutex;
+        pthread_cond_t cond;
+        size_t outstanding;
+        bool sending;// the sender is not done
+        bool failed;
+        Histogram histogram;
+        size_t statuses[RESPONSE_BAD_REQUEST + 1];
+        size_t results;
+    };
+
+    const LoadOptions& options_;
+    const std::vector<TermVector>& queries_;
+    const size_t total_;
+    const uint64_t interval_ns_;// between scheduled requests, 0 for closed loop
+    uint64_t start_ns_;
+    volatile size_t next_request_;
+    // begin time of request i, written by its sender before sending
+    std::vector<uint64_t> begin_ns_;
+
+    static void * sender_main(void * arg) {
+        Connection * connection = (Connection *)arg;
+        connection->load->send_requests(connection);
+        return 0;
+    }
+
+    static void * receiver_main(void * arg) {
+        Connection * connection = (Connection *)arg;
+        connection->load->receive_responses(connection);
+        return 0;
+    }
+
+    void send_requests(Connection * connection) {
+        SearchRequest request;
+        request.k = options_.k;
+        request.timeout_us = options_.timeout_us;
+        std::vector<char> frame;
+        for (;;) {
+            size_t i = atomic_fetch_add(&next_request_, (size_t)1);
+            if (i >= total_) {
+                break;
+            }
+            uint64_t begin = 0;
+            if (interval_ns_) {
+                begin = start_ns_ + i * interval_ns_;
+                sleep_until_ns(begin);
+            }
+            pthread_mutex_lock(&connection->mutex);
+            while (connection->outstanding >= options_.pipeline && !connection->failed) {
+                pthread_cond_wait(&connection->cond, &connection->mutex);
+            }
+            bool failed = connection->failed;
+            connection->outstanding++;
+            begin_ns_[i] = begin ? begin : now_ns();
+            pthread_mutex_unlock(&connection->mutex);
+            if (failed) {
+                break;
+            }
+
+            request.request_id = i;
+            request.terms = queries_[i % queries_.size()];
+            frame.clear();
+            request.encode(&frame);
+            if (!send_all(connection->fd, frame)) {
+                break;
+            }
+        }
+        pthread_mutex_lock(&connection->mutex);
+        connection->sending = false;
+        pthread_mutex_unlock(&connection->mutex);
+        // the server answers what it has read and closes
+        shutdown(connection->fd, SHUT_WR);
+    }
+
+    void receive_responses(Connection * connection) {
+        std::vector<char> in;
+        size_t offset = 0;
+        char buffer[64 * 1024];
+        SearchResponse response;
+        for (;;) {
+            ssize_t n = recv(connection->fd, buffer, sizeof(buffer), 0);
+            if (n == -1 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                break;
+            }
+            in.insert(in.end(), buffer, buffer + n);
+            long bytes = 0;
+            while (offset < in.size()
+                    && (bytes = response.decode(&in[offset], in.size() - offset)) > 0) {
+                offset += bytes;
+                if (response.request_id >= total_) {
+                    bytes = -1;
+                    break;
+                }
+                uint64_t end = now_ns();
+                pthread_mutex_lock(&connection->mutex);
+                uint64_t begin = begin_ns_[response.request_id];
+                connection->outstanding--;
+                pthread_cond_signal(&connection->cond);
+                pthread_mutex_unlock(&connection->mutex);
+                connection->histogram.record(end - begin);
+                connection->statuses[response.status <= RESPONSE_BAD_REQUEST
+                    ? response.status : (uint32_t)RESPONSE_BAD_REQUEST]++;
+                connection->results += response.results.size();
+            }
+            if (bytes < 0) {
+                break;
+            }
+            in.erase(in.begin(), in.begin() + offset);
+            offset = 0;
+        }
+        pthread_mutex_lock(&connection->mutex);
+        // requests still outstanding are lost
+        connection->failed = connection->outstanding > 0 || connection->sending;
+        pthread_cond_signal(&connection->cond);
+        pthread_mutex_unlock(&connection->mutex);
+    }
+
+public:
+    Load(const LoadOptions& options, const std::vector<TermVector>& queries)
+        : options_(options), queries_(queries), total_(queries.size() * options.repeat),
+        interval_ns_(options.qps > 0 ? (uint64_t)(1e9 / options.qps) : 0),
+        start_ns_(0), next_request_(0), begin_ns_(total_, 0) {
+    }
+
+    // Return the wall time in nanoseconds, 0 if no connection could be made.
+    // 'statuses' counts responses by status, '*lost' is set to requests without one.
+    uint64_t run(Histogram * histogram, size_t * statuses, size_t * results, bool * lost) {
+        std::vector<Connection *> connections;
+        for (size_t i = 0; i < options_.connections; i++) {
+            Connection * connection = new Connection();
+            connection->load = this;
+            connection->fd = connect_to(options_);
+            connection->outstanding = 0;
+            connection->sending = true;
+            connection->failed = false;
+            memset(connection->statuses, 0, sizeof(connection->statuses));
+            connection->results = 0;
+            if (connection->fd == -1) {
+                delete connection;
+                break;
+            }
+            pthread_mutex_init(&connection->mutex, 0);
+            pthread_cond_init(&connection->cond, 0);
+            connections.push_back(connection);
+        }
+        if (connections.empty()) {
+            return 0;
+        }
+
+        start_ns_ = now_ns();
+        for (size_t i = 0; i < connections.size(); i++) {
+            pthread_create(&connections[i]->receiver, 0, receiver_main, connections[i]);
+            pthread_create(&connections[i]->sender, 0, sender_main, connections[i]);
+        }
+        *lost = false;
+        for (size_t i = 0; i < connections.size(); i++) {
+            Connection * connection = connections[i];
+            pthread_join(connection->sender, 0);
+            pthread_join(connection->receiver, 0);
+            histogram->merge(connection->histogram);
+            for (int j = 0; j <= RESPONSE_BAD_REQUEST; j++) {
+                statuses[j] += connection->statuses[j];
+            }
+            *results += connection->results;
+            *lost = *lost || connection->failed;
+        }
+        uint64_t wall_ns = now_ns() - start_ns_;
+        for (size_t i = 0; i < connections.size(); i++) {
+            close(connections[i]->fd);
+            pthread_cond_destroy(&connections[i]->cond);
+            pthread_mutex_destroy(&connections[i]->mutex);
+            delete connections[i];
+        }
+        return wall_ns;
+    }
+
+private:
+    Load(Load& other);
+    Load& operator=(Load& other);
+};
+
+void usage(const LoadOptions& defaults) {
+    std::cout << "usage: wand-load (--socket=PATH | --port=N) --queries=FILE [--name=value ...]\n"
+        << "  --socket=PATH         Unix domain socket of wand-server\n"
+        << "  --port=N              TCP port of wand-server on 127.0.0.1\n"
+        << "  --queries=FILE        one query per line, \"feature:weight ...\"\n"
+        << "  --connections=" << defaults.connections << "\n"
+        << "  --pipeline=" << defaults.pipeline << "          outstanding requests per connection\n"
+        << "  --qps=" << defaults.qps << "               target rate, 0 sends back to back\n"
+        << "  --repeat=" << defaults.repeat << "\n"
+        << "  --k=" << defaults.k << "                 0 for the k of the server\n"
+        << "  --timeout-us=" << defaults.timeout_us << "        0 for the timeout of the server\n";
+}
+
+bool parse_options(int argc, char ** argv, LoadOptions * options) {
+    for (int i = 1; i < argc; i++) {
+        const char * arg = argv[i];
+        const char * eq = strchr(arg, '=');
+        if (strncmp(arg, "--", 2) != 0 || !eq) {
+            return false;
+        }
+        std::string name(arg + 2, eq);
+        const char * value = eq + 1;
+        if (name == "socket") {
+            options->socket = value;
+        } else if (name == "port") {
+            options->port = atoi(value);
+        } else if (name == "queries") {
+            options->queries = value;
+        } else if (name == "connections") {
+            options->connections = (size_t)strtoul(value, 0, 10);
+        } else if (name == "pipeline") {
+            options->pipeline = (size_t)strtoul(value, 0, 10);
+        } else if (name == "qps") {
+            options->qps = atof(value);
+        } else if (name == "repeat") {
+            options->repeat = (size_t)strtoul(value, 0, 10);
+        } else if (name == "k") {
+            options->k = (uint32_t)strtoul(value, 0, 10);
+        } else if (name == "timeout-us") {
+            options->timeout_us = (uint32_t)strtoul(value, 0, 10);
+        } else {
+            return false;
+        }
+    }
+    return (!options->socket.empty() != (options->port > 0)) && !options->queries.empty()
+        && options->connections > 0 && options->pipeline > 0;
+}
+
+}
+
+int main(int argc, char ** argv) {
+    LoadOptions options;
+    if (!parse_options(argc, argv, &options)) {
+        usage(LoadOptions());
+        return 1;
+    }
+
+    std::vector<TermVector> queries;
+    if (load_queries(options.queries.c_str(), &queries) == -1) {
+        std::cerr << "can't open " << options.queries << "\n";
+        return 1;
+    }
+    if (queries.empty()) {
+        std::cerr << "no query in " << options.queries << "\n";
+        return 1;
+    }
+    printf("connections: %lu, pipeline: %lu, target qps: %.1f, requests: %lu\n\n",
+        (unsigned long)options.connections, (unsigned long)options.pipeline, options.qps,
+        (unsigned long)(queries.size() * options.repeat));
+
+    Load load(options, queries);
+    Histogram h;
+    size_t statuses[RESPONSE_BAD_REQUEST + 1] = {0};
+    size_t results = 0;
+    bool lost = false;
+    uint64_t wall_ns = load.run(&h, statuses, &results, &lost);
+    if (wall_ns == 0) {
+        std::cerr << "can't connect: " << strerror(errno) << "\n";
+        return 1;
+    }
+
+    printf("%10s %10s %10s %10s %10s %10s %10s %10s\n",
+        "responses", "qps", "mean(us)", "p50", "p95", "p99", "p99.9", "max");
+    printf("%10lu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+        (unsigned long)h.count(), h.count() / (wall_ns / 1e9), h.mean() / 1e3,
+        h.percentile(50) / 1e3, h.percentile(95) / 1e3, h.percentile(99) / 1e3,
+        h.percentile(99.9) / 1e3, h.max() / 1e3);
+    for (int i = 0; i <= RESPONSE_BAD_REQUEST; i++) {
+        printf("%s%s: %lu", i ? ", " : "", get_status_name(i), (unsigned long)statuses[i]);
+    }
+    printf("\nmean results: %.2f\n", h.count() ? (double)results / h.count() : 0.0);
+    if (lost) {
+        std::cerr << "connection closed with requests outstanding\n";
+        return 1;
+    }
+    return 0;
+}
@@ -1,9 +1,15 @@
 #include "wand.h"
-#include "city.h"
+#include "cap_features.h"
+#include "dot_product.h"
+#include "query_executor.h"
+#include "result_cache.h"
+#include "timer.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <algorithm>
 #include <iostream>
+#include <iterator>
 
 #if !defined _WIN32
 # include <sys/time.h>
@@ -33,7 +39,6 @@ static void simple_test() {
     ii.insert(db.id(78).term(4, 4).build());
 
     Wand wand(ii, 500, 1);
-    wand.set_verbose(1);
 
     Document * query = db
         .term(0, 1)
@@ -43,13 +48,22 @@ static void simple_test() {
         .term(4, 1)
         .build();
     std::vector<Wand::DocIdScore> result;
+    Wand::QueryStats stats;
 
-    wand.search(query->terms, &result);
+    wand.search(query->terms, &result, 0, &stats);
+    std::cout << "search stats:\n" << stats;
     std::cout << "search final result:\n";
     for (size_t i = 0; i < result.size(); i++) {
         std::cout << result[i];
     }
 
+    wand.search_taat(query->terms, &result, 0, &stats);
+    std::cout << "search_taat stats:\n" << stats;
+    std::cout << "search_taat final result:\n";
+    for (size_t i = 0; i < result.size(); i++) {
+        std::cout << result[i];
+    }
+
     wand.search_taat_v1(query->terms, &result);
     std::cout << "search_taat_v1 final result:\n";
     for (size_t i = 0; i < result.size(); i++) {
@@ -65,9 +79,723 @@ static void simple_test() {
     query->release_ref();
 }
 
-static IdType hash_string(const char * buf, size_t len) {
-    uint64 hash = CityHash64(buf, len);
-    return (IdType)hash;
+// The same random index and query with other weight/score types.
+template <typename Traits>
+static void score_type_test(const char * name) {
+    typedef typename Traits::WeightType WeightType;
+    BasicDocumentBuilder<Traits> db;
+    BasicInvertedIndex<Traits> ii;
+
+    srand(0);
+    for (IdType id = 1; id <= 10000; id++) {
+        db.id(id);
+        for (int i = 0; i < 20; i++) {
+            db.term((IdType)rand() % 1000, (WeightType)(rand() % 100 + 1));
+        }
+        ii.insert(db.build());
+    }
+    for (int i = 0; i < 50; i++) {
+        db.term((IdType)rand() % 1000, (WeightType)(rand() % 100 + 1));
+    }
+    BasicDocument<Traits> * query = db.build();
+
+    BasicWand<Traits> wand(ii, 10);
+    std::vector<typename BasicWand<Traits>::DocIdScore> result, result_taat;
+    wand.search(query->terms, &result);
+    wand.search_taat(query->terms, &result_taat);
+    std::cout << name << " weight " << sizeof(WeightType)
+        << " bytes, term " << sizeof(BasicTerm<Traits>)
+        << " bytes, posting node " << sizeof(BasicPostingListNode<Traits>) << " bytes\n";
+    for (size_t i = 0; i < result.size() && i < result_taat.size(); i++) {
+        std::cout << "  " << result[i].score << " " << result_taat[i].score << "\n";
+    }
+
+    query->release_ref();
+}
+
+static TermVector random_term_vector(size_t size, IdType id_range) {
+    DocumentBuilder db;
+    while (db.terms.size() < size) {
+        db.term((IdType)rand() % id_range, (ScoreType)(rand() % 100 + 1));
+    }
+    Document * doc = db.build();
+    TermVector terms;
+    terms.swap(doc->terms);
+    doc->release_ref();
+    return terms;
+}
+
+static void dot_product_test() {
+    typedef ScoreType (*DotProductType)(const TermVector&, const TermVector&);
+    const struct {
+        const char * name;
+        DotProductType dot_product;
+    } kernels[] = {
+        {"merge", sparse_dot_product_merge},
+        {"galloping", sparse_dot_product_galloping},
+        {"simd", sparse_dot_product_simd},
+        {"auto", sparse_dot_product},
+    };
+    // (query size, doc size), ids of both are from [0, 4 * query size)
+    const size_t sizes[][2] = {
+        {1000, 10}, {1000, 20}, {1000, 50}, {1000, 100}, {1000, 300}, {1000, 1000},
+        {100, 20}, {20, 20},
+    };
+    const size_t vectors = 64;
+
+    srand(0);
+    for (size_t s = 0; s < sizeof(sizes)/sizeof(sizes[0]); s++) {
+        std::vector<TermVector> queries, docs;
+        for (size_t i = 0; i < vectors; i++) {
+            queries.push_back(random_term_vector(sizes[s][0], sizes[s][0] * 4));
+            docs.push_back(random_term_vector(sizes[s][1], sizes[s][0] * 4));
+        }
+        size_t times = 20000000 / (sizes[s][0] + sizes[s][1]);
+
+        std::cout << "dot product " << sizes[s][0] << " x " << sizes[s][1] << ":";
+        for (size_t k = 0; k < sizeof(kernels)/sizeof(kernels[0]); k++) {
+            ScoreType sum = 0;
+            uint64_t begin = now_us();
+            for (size_t i = 0; i < times; i++) {
+                sum += kernels[k].dot_product(queries[i % vectors], docs[(i / vectors) % vectors]);
+            }
+            uint64_t end = now_us();
+            std::cout << " " << kernels[k].name << " "
+                << (end - begin) * 1000.0 / times << "ns(" << sum % 10 << ")";
+        }
+        std::cout << "\n";
+    }
+}
+
+// scores rank by rank, docs of equal scores may come in any order
+static bool same_scores(const std::vector<Wand::DocIdScore>& a,
+        const std::vector<Wand::DocIdScore>& b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); i++) {
+        if (a[i].score != b[i].score) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Wand::search with a TermGroupCache built from a query log against the same
+// search without it, on the linked and the sealed index.
+static void term_group_test() {
+    DocumentBuilder db;
+    InvertedIndex ii;
+    srand(1);
+    for (IdType id = 1; id <= 20000; id++) {
+        db.id(id);
+        for (int i = 0; i < 20; i++) {
+            db.term((IdType)rand() % 1000, (WeightType)(rand() % 100 + 1));
+        }
+        ii.insert(db.build());
+    }
+
+    // Every query has the same 6 terms and weights, and 10 random terms.
+    std::vector<TermVector> queries;
+    for (int q = 0; q < 200; q++) {
+        for (IdType id = 0; id < 6; id++) {
+            db.term(id, (WeightType)(10 * id + 10));
+        }
+        for (int i = 0; i < 10; i++) {
+            db.term((IdType)(rand() % 994 + 6), (WeightType)(rand() % 100 + 1));
+        }
+        Document * query = db.build();
+        queries.push_back(query->terms);
+        query->release_ref();
+    }
+
+    TermGroupCache cache;
+    for (size_t i = 0; i < queries.size(); i++) {
+        cache.observe(queries[i]);
+    }
+    cache.rebuild(ii);
+    std::cout << "TermGroupCache " << cache.size() << " groups, "
+        << cache.postings() << " postings\n";
+
+    Wand wand(ii, 100);
+    std::vector<Wand::DocIdScore> expected, result;
+    Wand::QueryStats stats;
+    TermVector query;
+    for (int sealed = 0; sealed < 2; sealed++) {
+        if (sealed) {
+            ii.seal();
+        }
+        size_t mismatches = 0, groups_matched = 0;
+        for (size_t i = 0; i < queries.size(); i++) {
+            query = queries[i];
+            wand.set_term_group_cache(0);
+            wand.search(query, &expected);
+            query = queries[i];
+            wand.set_term_group_cache(&cache);
+            wand.search(query, &result, 0, &stats);
+            groups_matched += stats.groups_matched;
+            if (!same_scores(expected, result)) {
+                mismatches++;
+            }
+        }
+        wand.set_term_group_cache(0);
+        std::cout << "  " << (sealed ? "sealed" : "linked") << " index: "
+            << queries.size() << " queries, " << groups_matched << " groups matched, "
+            << mismatches << " mismatches"
+            << (groups_matched > 0 && mismatches == 0 ? " ok" : " FAILED") << "\n";
+    }
+}
+
+// Wand::search_batch against Wand::search of every query of the batch,
+// on the linked and the sealed index.
+static void search_batch_test() {
+    DocumentBuilder db;
+    InvertedIndex ii;
+    srand(2);
+    for (IdType id = 1; id <= 20000; id++) {
+        db.id(id);
+        for (int i = 0; i < 20; i++) {
+            db.term((IdType)rand() % 1000, (WeightType)(rand() % 100 + 1));
+        }
+        ii.insert(db.build());
+    }
+    std::vector<TermVector> queries;
+    for (int q = 0; q < 64; q++) {
+        for (int i = 0; i < 16; i++) {
+            db.term((IdType)rand() % 1000, (WeightType)(rand() % 100 + 1));
+        }
+        Document * query = db.build();
+        queries.push_back(query->terms);
+        query->release_ref();
+    }
+
+    Wand wand(ii, 100, 1000);
+    std::vector<std::vector<Wand::DocIdScore> > results;
+    std::vector<Wand::DocIdScore> expected;
+    TermVector query;
+    for (int sealed = 0; sealed < 2; sealed++) {
+        if (sealed) {
+            ii.seal();
+        }
+        wand.search_batch(queries, &results);
+        size_t mismatches = 0;
+        for (size_t i = 0; i < queries.size(); i++) {
+            query = queries[i];
+            wand.search(query, &expected);
+            if (!same_scores(expected, results[i])) {
+                mismatches++;
+            }
+        }
+        std::cout << "Wand::search_batch on " << (sealed ? "sealed" : "linked") << " index: "
+            << queries.size() << " queries, " << mismatches << " mismatches"
+            << (results.size() == queries.size() && mismatches == 0 ? " ok" : " FAILED") << "\n";
+    }
+}
+
+static WeightType weight_of_doc(IdType id) {
+    return (WeightType)(id % 100 + 1);
+}
+
+// Walk and randomly skip an ArrayPostingCursor on the list of 'ids', sorted,
+// comparing every stop with std::lower_bound on 'ids'.
+// Set the bit (1 << type) of 'container_types' for each DocIdSet container type in it,
+// and (1 << 3) if doc ids are plain.
+static size_t check_array_cursor(const std::vector<IdType>& ids, unsigned int * container_types) {
+    typedef Wand::ArrayCursor ArrayCursor;
+    DocumentBuilder db;
+    InvertedIndex ii;
+    for (size_t i = 0; i < ids.size(); i++) {
+        ii.insert(db.id(ids[i]).term(0, weight_of_doc(ids[i])).build());
+    }
+    ii.seal();
+    const InvertedIndex::PostingList * posting_list = ii.find(0);
+    const DocIdSet& set = posting_list->array()->doc_id_set;
+    if (posting_list->array()->doc_ids) {
+        *container_types |= 1 << 3;
+    }
+    for (size_t c = 0; c < set.chunk_count; c++) {
+        *container_types |= 1 << set.chunks[c].type;
+    }
+
+    size_t mismatches = 0;
+    ArrayCursor cursor(posting_list);
+    for (size_t i = 0; i < ids.size(); i++, cursor.next()) {
+        if (cursor.docid() != ids[i] || cursor.weight() != weight_of_doc(ids[i])) {
+            mismatches++;
+        }
+    }
+    if (!Document::is_sentinel(cursor.docid())) {
+        mismatches++;
+    }
+
+    for (int round = 0; round < 100; round++) {
+        ArrayCursor cursor(posting_list);
+        size_t pos = 0;
+        IdType target = 0;
+        // strides from a few ids to several chunks
+        IdType max_stride = (IdType)1 << (rand() % 20);
+        while (!Document::is_sentinel(cursor.docid())) {
+            if (rand() % 4 == 0) {
+                cursor.next();
+                pos++;
+            } else {
+                target += 1 + (IdType)rand() % max_stride;
+                cursor.skip_to(target);
+                pos = std::lower_bound(ids.begin() + pos, ids.end(), target) - ids.begin();
+            }
+            if (pos == ids.size()) {
+                if (!Document::is_sentinel(cursor.docid())) {
+                    mismatches++;
+                }
+                break;
+            }
+            if (cursor.docid() != ids[pos] || cursor.weight() != weight_of_doc(ids[pos])) {
+                mismatches++;
+                break;
+            }
+        }
+    }
+    return mismatches;
+}
+
+// ArrayPostingCursor on DocIdSet ARRAY, BITMAP and RUN containers and on plain doc ids.
+static void array_cursor_test() {
+    srand(5);
+    std::vector<IdType> dense_ids, sparse_ids;
+    // ARRAY
+    for (IdType id = 1; id < 65536; id += 1 + (IdType)rand() % 200) {
+        dense_ids.push_back(id);
+    }
+    // BITMAP
+    for (IdType id = 65536; id < 2 * 65536; id++) {
+        if (rand() % 2) {
+            dense_ids.push_back(id);
+        }
+    }
+    // RUN
+    for (IdType id = 2 * 65536; id < 3 * 65536; id += 4096) {
+        for (IdType i = 0; i < 1000; i++) {
+            dense_ids.push_back(id + i);
+        }
+    }
+    // a few ids per chunk, plain doc ids
+    for (IdType id = 1; id < 10000000; id += 1 + (IdType)rand() % 40000) {
+        sparse_ids.push_back(id);
+    }
+
+    unsigned int container_types = 0;
+    size_t mismatches = check_array_cursor(dense_ids, &container_types)
+        + check_array_cursor(sparse_ids, &container_types);
+    bool all_types = container_types == (1 << DocIdSet::ARRAY | 1 << DocIdSet::BITMAP
+        | 1 << DocIdSet::RUN | 1 << 3);
+    std::cout << "ArrayPostingCursor next/skip_to on array, bitmap, run containers"
+        << " and doc ids: " << mismatches << " mismatches"
+        << (all_types && mismatches == 0 ? " ok" : " FAILED") << "\n";
+}
+
+// 'docs' docs of 20 random terms in [0, 1000) weighted in [1, 100], ids from 1
+static void build_random_index(InvertedIndex * ii, unsigned int seed, IdType docs) {
+    DocumentBuilder db;
+    srand(seed);
+    for (IdType id = 1; id <= docs; id++) {
+        db.id(id);
+        for (int i = 0; i < 20; i++) {
+            db.term((IdType)rand() % 1000, (WeightType)(rand() % 100 + 1));
+        }
+        ii->insert(db.build());
+    }
+}
+
+// the top 'k' of 'all', sorted by score, whose docs 'accept' is 1 for, by doc id
+static std::vector<Wand::DocIdScore> post_filter(const std::vector<Wand::DocIdScore>& all,
+        const std::vector<char>& accept, size_t k) {
+    std::vector<Wand::DocIdScore> result;
+    for (size_t i = 0; i < all.size() && result.size() < k; i++) {
+        if (all[i].doc_id < accept.size() && accept[all[i].doc_id]) {
+            result.push_back(all[i]);
+        }
+    }
+    return result;
+}
+
+// 'has_term' of every doc id, 1 if the doc contains 'term_id'
+static void mark_docs_of_term(const InvertedIndex& ii, IdType term_id, std::vector<char> * has_term) {
+    const InvertedIndex::PostingList * posting_list = ii.find(term_id);
+    if (!posting_list) {
+        return;
+    }
+    for (const InvertedIndex::PostingList::PostingListNode * node = posting_list->front();
+            !node->doc->is_sentinel(); node = node->next) {
+        (*has_term)[node->doc->id] = 1;
+    }
+}
+
+// search with required and excluded terms against an unconstrained search of all docs
+// filtered by their terms, on the linked and the sealed index.
+static void constraints_test() {
+    const IdType docs = 20000;
+    InvertedIndex ii;
+    build_random_index(&ii, 6, docs);
+    const size_t k = 100;
+    Wand wand(ii, k), wand_all(ii, docs);
+    for (int sealed = 0; sealed < 2; sealed++) {
+        if (sealed) {
+            ii.seal();
+        }
+        srand(7);
+        const size_t queries = 60;
+        size_t mismatches = 0, results = 0;
+        std::vector<Wand::DocIdScore> all, result;
+        TermVector query;
+        for (size_t q = 0; q < queries; q++) {
+            TermVector terms = random_term_vector(16, 1000);
+            Wand::SearchOptions options;
+            // required only, excluded only, or both, in the query or not
+            if (q % 3 != 1) {
+                options.required_terms.push_back(terms[rand() % terms.size()].id);
+                options.required_terms.push_back((IdType)rand() % 1000);
+            }
+            if (q % 3 != 0) {
+                options.excluded_terms.push_back(terms[rand() % terms.size()].id);
+                options.excluded_terms.push_back((IdType)rand() % 1000);
+            }
+
+            std::vector<char> accept(docs + 1, 1);
+            for (size_t i = 0; i < options.required_terms.size(); i++) {
+                std::vector<char> has_term(docs + 1, 0);
+                mark_docs_of_term(ii, options.required_terms[i], &has_term);
+                for (size_t d = 0; d < accept.size(); d++) {
+                    accept[d] = accept[d] && has_term[d];
+                }
+            }
+            for (size_t i = 0; i < options.excluded_terms.size(); i++) {
+                std::vector<char> has_term(docs + 1, 0);
+                mark_docs_of_term(ii, options.excluded_terms[i], &has_term);
+                for (size_t d = 0; d < accept.size(); d++) {
+                    accept[d] = accept[d] && !has_term[d];
+                }
+            }
+
+            query = terms;
+            wand_all.search(query, &all);
+            query = terms;
+            wand.search(query, &result, &options);
+            results += result.size();
+            if (!same_scores(post_filter(all, accept, k), result)) {
+                mismatches++;
+            }
+            for (size_t i = 0; i < result.size(); i++) {
+                if (!accept[result[i].doc_id]) {
+                    mismatches++;
+                }
+            }
+        }
+        std::cout << "Wand::search with required and excluded terms on "
+            << (sealed ? "sealed" : "linked") << " index: " << queries << " queries, "
+            << results << " results, " << mismatches << " mismatches"
+            << (results > 0 && mismatches == 0 ? " ok" : " FAILED") << "\n";
+    }
+}
+
+// Attribute 'attribute_id' of doc 'id' in filter_test, false if the doc hasn't it.
+static bool attribute_of_doc(IdType id, IdType attribute_id, AttributeValue * value) {
+    switch (attribute_id) {
+    case 1:
+        *value = (AttributeValue)(id % 100) - 50;
+        return id % 10 != 0;
+    case 2:
+        *value = (AttributeValue)(id % 7);
+        return id % 11 != 0;
+    case 3:
+        *value = (AttributeValue)(id * 7919 % 100000);
+        return id % 13 != 0;
+    default:
+        *value = (AttributeValue)(id % 500);
+        return id % 17 != 0;
+    }
+}
+
+// search and search_taat with an AttributeFilter against an unfiltered search of all docs
+// filtered by their attributes, on the linked and the sealed index.
+static void filter_test() {
+    const IdType docs = 20000;
+    DocumentBuilder db;
+    InvertedIndex ii;
+    srand(8);
+    for (IdType id = 1; id <= docs; id++) {
+        db.id(id);
+        for (int i = 0; i < 20; i++) {
+            db.term((IdType)rand() % 1000, (WeightType)(rand() % 100 + 1));
+        }
+        for (IdType attribute_id = 1; attribute_id <= 4; attribute_id++) {
+            AttributeValue value;
+            if (attribute_of_doc(id, attribute_id, &value)) {
+                db.attribute(attribute_id, value);
+            }
+        }
+        ii.insert(db.build());
+    }
+
+    // IN of attribute 4 spans less than 500 values and is tested by a bitmap,
+    // IN of attribute 3 spans most of [0, 100000) and is binary searched.
+    std::vector<AttributeValue> small_span, large_span;
+    for (int i = 0; i < 50; i++) {
+        small_span.push_back(rand() % 500);
+    }
+    for (int i = 0; i < 2000; i++) {
+        large_span.push_back(rand() % 100000);
+    }
+    const size_t filter_count = 6;
+    AttributeFilter filters[filter_count];
+    filters[0].range(1, -40, 9);
+    filters[1].equal(2, 3);
+    filters[2].in(4, small_span);
+    filters[3].in(3, large_span);
+    filters[4].range(1, -50, 49).equal(2, 5).in(4, small_span);
+    // every value, only docs missing it fail
+    filters[5].range(3, 0, 100000);
+
+    const size_t k = 100;
+    Wand wand(ii, k), wand_all(ii, docs);
+    for (int sealed = 0; sealed < 2; sealed++) {
+        if (sealed) {
+            ii.seal();
+        }
+        srand(9);
+        size_t queries = 0, mismatches = 0, results = 0;
+        std::vector<Wand::DocIdScore> all, result;
+        TermVector query;
+        for (size_t f = 0; f < filter_count; f++) {
+            const std::vector<AttributeFilter::Predicate>& predicates = filters[f].predicates();
+            std::vector<char> accept(docs + 1, 0);
+            for (IdType id = 1; id <= docs; id++) {
+                accept[id] = 1;
+                for (size_t p = 0; p < predicates.size(); p++) {
+                    const AttributeFilter::Predicate& predicate = predicates[p];
+                    AttributeValue value;
+                    if (!attribute_of_doc(id, predicate.attribute_id, &value)) {
+                        accept[id] = 0;
+                    } else if (predicate.type == AttributeFilter::RANGE) {
+                        accept[id] = accept[id] && value >= predicate.min && value <= predicate.max;
+                    } else {
+                        accept[id] = accept[id] && std::find(predicate.values.begin(),
+                            predicate.values.end(), value) != predicate.values.end();
+                    }
+                }
+            }
+
+            Wand::SearchOptions options;
+            options.filter = &filters[f];
+            for (int q = 0; q < 10; q++, queries++) {
+                TermVector terms = random_term_vector(16, 1000);
+                query = terms;
+                wand_all.search(query, &all);
+                std::vector<Wand::DocIdScore> expected = post_filter(all, accept, k);
+                query = terms;
+                wand.search(query, &result, &options);
+                results += result.size();
+                if (!same_scores(expected, result)) {
+                    mismatches++;
+                }
+                query = terms;
+                wand.search_taat(query, &result, &options);
+                if (!same_scores(expected, result)) {
+                    mismatches++;
+                }
+            }
+        }
+        std::cout << "Wand::search and search_taat with filters on "
+            << (sealed ? "sealed" : "linked") << " index: " << queries << " queries, "
+            << results << " results, " << mismatches << " mismatches"
+            << (results > 0 && mismatches == 0 ? " ok" : " FAILED") << "\n";
+    }
+}
+
+// Docs streamed by search_stream, it stops the search after 'limit' of them.
+struct StreamCollector {
+    std::vector<Wand::DocIdScore> docs;
+    size_t limit;
+};
+
+static bool collect_stream(const Wand::DocIdScore& doc, void * arg) {
+    StreamCollector * collector = (StreamCollector *)arg;
+    collector->docs.push_back(doc);
+    return collector->docs.size() < collector->limit;
+}
+
+static bool doc_id_less(const Wand::DocIdScore& a, const Wand::DocIdScore& b) {
+    return a.doc_id < b.doc_id;
+}
+
+// search_stream against search with k of all docs and the same threshold,
+// then a callback stopping it after a few docs, on the linked and the sealed index.
+static void search_stream_test() {
+    const IdType docs = 20000;
+    const ScoreType threshold = 5000;
+    InvertedIndex ii;
+    build_random_index(&ii, 10, docs);
+    Wand wand(ii, 100, threshold), wand_all(ii, docs, threshold);
+    for (int sealed = 0; sealed < 2; sealed++) {
+        if (sealed) {
+            ii.seal();
+        }
+        srand(11);
+        const size_t queries = 50;
+        size_t mismatches = 0, streamed = 0;
+        std::vector<Wand::DocIdScore> all;
+        TermVector query;
+        for (size_t q = 0; q < queries; q++) {
+            TermVector terms = random_term_vector(16, 1000);
+            query = terms;
+            wand_all.search(query, &all);
+            std::sort(all.begin(), all.end(), doc_id_less);
+
+            StreamCollector collector;
+            collector.limit = (size_t)-1;
+            query = terms;
+            if (!wand.search_stream(query, collect_stream, &collector)) {
+                mismatches++;
+            }
+            streamed += collector.docs.size();
+            // in doc id order already
+            bool same = collector.docs.size() == all.size();
+            for (size_t i = 0; same && i < all.size(); i++) {
+                same = collector.docs[i].doc_id == all[i].doc_id
+                    && collector.docs[i].score == all[i].score;
+            }
+            if (!same) {
+                mismatches++;
+            }
+
+            if (all.size() > 3) {
+                // stopped on the third doc, no doc comes after it
+                collector.docs.clear();
+                collector.limit = 3;
+                query = terms;
+                if (wand.search_stream(query, collect_stream, &collector)
+                        || collector.docs.size() != 3 || collector.docs[2].doc_id != all[2].doc_id) {
+                    mismatches++;
+                }
+            }
+        }
+        std::cout << "Wand::search_stream on " << (sealed ? "sealed" : "linked") << " index: "
+            << queries << " queries, " << streamed << " docs streamed, " << mismatches
+            << " mismatches" << (streamed > 0 && mismatches == 0 ? " ok" : " FAILED") << "\n";
+    }
+}
+
+// search out of max_postings, max_evaluations or deadline_us budget must return false
+// with docs of their exact scores only, on the linked and the sealed index.
+static void budget_test() {
+    const IdType docs = 20000;
+    InvertedIndex ii;
+    build_random_index(&ii, 12, docs);
+    const size_t k = 100;
+    Wand wand(ii, k), wand_all(ii, docs);
+    for (int sealed = 0; sealed < 2; sealed++) {
+        if (sealed) {
+            ii.seal();
+        }
+        srand(13);
+        const size_t queries = 20;
+        size_t mismatches = 0, results = 0;
+        std::vector<Wand::DocIdScore> all, result;
+        Wand::QueryStats stats;
+        TermVector query;
+        for (size_t q = 0; q < queries; q++) {
+            TermVector terms = random_term_vector(16, 1000);
+            query = terms;
+            if (!wand_all.search(query, &all)) {
+                mismatches++;
+            }
+            std::vector<ScoreType> exact_scores(docs + 1, 0);
+            for (size_t i = 0; i < all.size(); i++) {
+                exact_scores[all[i].doc_id] = all[i].score;
+            }
+
+            for (int budget = 0; budget < 3; budget++) {
+                Wand::SearchOptions options;
+                if (budget == 0) {
+                    options.max_postings = 200;
+                } else if (budget == 1) {
+                    options.max_evaluations = 20;
+                } else {
+                    // passed by the first check
+                    options.deadline_us = now_us();
+                }
+                query = terms;
+                bool complete = wand.search(query, &result, &options, &stats);
+                results += result.size();
+                if (complete || result.size() > k) {
+                    mismatches++;
+                }
+                if (budget == 1 && stats.evaluations > options.max_evaluations) {
+                    mismatches++;
+                }
+                // partial top k, sorted by score, every doc once with its exact score
+                std::vector<char> seen(docs + 1, 0);
+                for (size_t i = 0; i < result.size(); i++) {
+                    IdType doc_id = result[i].doc_id;
+                    if (doc_id > docs || seen[doc_id] || exact_scores[doc_id] != result[i].score
+                            || (i > 0 && result[i - 1].score < result[i].score)) {
+                        mismatches++;
+                        break;
+                    }
+                    seen[doc_id] = 1;
+                }
+            }
+        }
+        std::cout << "Wand::search out of max_postings, max_evaluations and deadline_us on "
+            << (sealed ? "sealed" : "linked") << " index: "
+            << queries << " queries, " << results << " partial results, " << mismatches
+            << " mismatches" << (results > 0 && mismatches == 0 ? " ok" : " FAILED") << "\n";
+    }
+}
+
+// An approximate search must not leave its result in the ResultCache
+// for later exact searches of the same query.
+static void result_cache_test() {
+    InvertedIndex ii;
+    build_random_index(&ii, 3, 20000);
+    Wand wand(ii, 100);
+    ResultCache cache(16 * 1024 * 1024);
+    Wand::SearchOptions approximate_options;
+    approximate_options.threshold_factor = 3.0;
+    std::vector<Wand::DocIdScore> exact, approximate, result;
+    Wand::QueryStats stats;
+    const size_t queries = 50;
+    size_t pruned = 0, mismatches = 0;
+    TermVector query;
+    for (size_t i = 0; i < queries; i++) {
+        TermVector terms = random_term_vector(16, 1000);
+        query = terms;
+        wand.set_result_cache(0);
+        wand.search(query, &exact);
+
+        wand.set_result_cache(&cache);
+        query = terms;
+        wand.search(query, &approximate, &approximate_options);
+        if (!same_scores(exact, approximate)) {
+            pruned++;
+        }
+        // searched, not found in the cache
+        query = terms;
+        wand.search(query, &result, 0, &stats);
+        if (stats.cache_hit || !same_scores(exact, result)) {
+            mismatches++;
+        }
+        // now it's cached
+        query = terms;
+        wand.search(query, &result, 0, &stats);
+        if (!stats.cache_hit || !same_scores(exact, result)) {
+            mismatches++;
+        }
+    }
+    wand.set_result_cache(0);
+    std::cout << "ResultCache after approximate searches: " << queries << " queries, "
+        << pruned << " pruned by threshold factor " << approximate_options.threshold_factor
+        << ", " << mismatches << " mismatches"
+        << (pruned > 0 && mismatches == 0 ? " ok" : " FAILED") << "\n";
 }
 
 static void timeval_diff(const struct timeval& begin, const struct timeval& end) {
@@ -79,56 +807,74 @@ static void timeval_diff(const struct timeval& begin, const struct timeval& end)
         diff.tv_sec = end.tv_sec - begin.tv_sec;
         diff.tv_usec = end.tv_usec - begin.tv_usec;
     }
-    std::cout << "cost " << diff.tv_sec << "." << diff.tv_usec / 1000 << " seconds\n";
+    printf("cost %ld.%06ld seconds\n", (long)diff.tv_sec, (long)diff.tv_usec);
 }
 
-static void load_cap_features(InvertedIndex * ii, FILE * fp) {
-    char line[4096];
-    char feature[128];
-    int score;
-    DocumentBuilder db;
-    IdType id = 0;
-    struct timeval begin, end;
-
-    std::cout << "loading index\n";
-    gettimeofday(&begin, 0);
-    while((fgets(line, sizeof(line), fp))) {
-        if (strcmp("cap_features\n", line) == 0) {
-            if (id != 0) {
-                ii->insert(db.build());
-            }
-            db.id(id);
-            id++;
-            if (id % 10000 == 0) {
-                std::cout << "loaded " << id << " documents\n";
-            }
-        } else {
-            if (fscanf(fp, "    %s %d\n", feature, &score) == 2) {
-                IdType hash = hash_string(feature, strlen(feature));
-                db.term(hash, (ScoreType)score);
-            }
-        }
+// fraction of docs in 'exact' also in 'approximate'
+static double recall(const std::vector<Wand::DocIdScore>& exact,
+        const std::vector<Wand::DocIdScore>& approximate) {
+    if (exact.empty()) {
+        return 1.0;
     }
-    gettimeofday(&end, 0);
-    std::cout << "loaded " << id << " documents, ";
-    timeval_diff(begin, end);
+    std::vector<IdType> exact_ids, approximate_ids, common_ids;
+    for (size_t i = 0; i < exact.size(); i++) {
+        exact_ids.push_back(exact[i].doc_id);
+    }
+    for (size_t i = 0; i < approximate.size(); i++) {
+        approximate_ids.push_back(approximate[i].doc_id);
+    }
+    std::sort(exact_ids.begin(), exact_ids.end());
+    std::sort(approximate_ids.begin(), approximate_ids.end());
+    std::set_intersection(exact_ids.begin(), exact_ids.end(),
+        approximate_ids.begin(), approximate_ids.end(), std::back_inserter(common_ids));
+    return (double)common_ids.size() / exact.size();
 }
 
-static int load_cap_features(InvertedIndex * ii, const char * filename) {
+// number of "cap_features" lines, the docs of the file
+static size_t count_cap_features_docs(const char * filename) {
     FILE * fp = fopen(filename, "r");
     if (fp == NULL) {
+        return 0;
+    }
+    size_t count = 0;
+    bool line_begin = true;
+    char line[64];
+    while (fgets(line, sizeof(line), fp)) {
+        if (line_begin && strncmp("cap_features", line, 12) == 0
+                && line[12 + strspn(line + 12, "\r\n")] == '\0') {
+            count++;
+        }
+        line_begin = strchr(line, '\n') != NULL;
+    }
+    fclose(fp);
+    return count;
+}
+
+static int load_cap_features_verbose(InvertedIndex * ii, const char * filename) {
+    struct timeval begin, end;
+    std::cout << "loading index " << filename << "\n";
+    gettimeofday(&begin, 0);
+    int loaded = load_cap_features(ii, filename);
+    if (loaded == -1) {
         std::cout << "can't open " << filename << "\n";
         return -1;
     }
-    load_cap_features(ii, fp);
-    fclose(fp);
+    gettimeofday(&end, 0);
+    std::cout << "loaded " << ii->doc_count() << " documents, ";
+    timeval_diff(begin, end);
+    if (loaded == -2) {
+        std::cout << "  bad lines in " << filename << "\n";
+    }
+    size_t file_docs = count_cap_features_docs(filename);
+    std::cout << "  docs in file: " << file_docs
+        << (file_docs == ii->doc_count() ? " ok" : " MISMATCH") << "\n";
     return 0;
 }
 
 static void cap_features_test() {
     InvertedIndex ii;
-    if (load_cap_features(&ii, "cap-features/offnet-cap") == -1) {
-        if (load_cap_features(&ii, "../cap-features/offnet-cap") == -1) {
+    if (load_cap_features_verbose(&ii, "cap-features/offnet-cap") == -1) {
+        if (load_cap_features_verbose(&ii, "../cap-features/offnet-cap") == -1) {
             return;
         }
     }
@@ -143,8 +889,9 @@ static void cap_features_test() {
     }
     Document * query = db.build();
     std::vector<Wand::DocIdScore> result, result_taat;
-    Wand wand(ii, 200, 10000);
-    wand.set_verbose(0);
+    const size_t heap_size = 200;
+    const ScoreType threshold = 10000;
+    Wand wand(ii, heap_size, threshold);
 
     int times = 100;
     struct timeval begin, end;
@@ -165,6 +912,76 @@ static void cap_features_test() {
     gettimeofday(&end, 0);
     timeval_diff(begin, end);
 
+    std::cout << "Wand::search_taat query " << times << " times, ";
+    gettimeofday(&begin, 0);
+    for (int i = 0; i < times; i++) {
+        wand.search_taat(query->terms, &result);
+    }
+    gettimeofday(&end, 0);
+    timeval_diff(begin, end);
+
+    // array posting lists from here on
+    ii.seal();
+    std::cout << "Wand::search on sealed index query " << times << " times, ";
+    gettimeofday(&begin, 0);
+    for (int i = 0; i < times; i++) {
+        wand.search(query->terms, &result);
+    }
+    gettimeofday(&end, 0);
+    timeval_diff(begin, end);
+
+    std::cout << "Wand::search_taat on sealed index query " << times << " times, ";
+    gettimeofday(&begin, 0);
+    for (int i = 0; i < times; i++) {
+        wand.search_taat(query->terms, &result);
+    }
+    gettimeofday(&end, 0);
+    timeval_diff(begin, end);
+
+    ResultCache cache(64 * 1024 * 1024);
+    wand.set_result_cache(&cache);
+    std::cout << "Wand::search with result cache query " << times << " times, ";
+    gettimeofday(&begin, 0);
+    for (int i = 0; i < times; i++) {
+        wand.search(query->terms, &result);
+    }
+    gettimeofday(&end, 0);
+    timeval_diff(begin, end);
+    std::cout << cache.get_stats();
+    wand.set_result_cache(0);
+
+    std::vector<TermVector> queries(times, query->terms);
+    std::vector<std::vector<Wand::DocIdScore> > results;
+    QueryExecutor executor(wand);
+    std::cout << "QueryExecutor::search query " << times << " times in "
+        << executor.thread_count() << " threads, ";
+    gettimeofday(&begin, 0);
+    executor.search(queries, &results);
+    gettimeofday(&end, 0);
+    timeval_diff(begin, end);
+
+    // Approximate Wand::search, recall@k against search_taat_v1.
+    std::vector<Wand::DocIdScore> exact;
+    for (size_t i = 0; i < result_taat.size() && exact.size() < heap_size; i++) {
+        if (result_taat[i].score > threshold) {
+            exact.push_back(result_taat[i]);
+        }
+    }
+    const double threshold_factors[] = {1.0, 1.1, 1.2, 1.5, 2.0, 3.0};
+    for (size_t f = 0; f < sizeof(threshold_factors)/sizeof(threshold_factors[0]); f++) {
+        Wand::SearchOptions options;
+        options.threshold_factor = threshold_factors[f];
+        std::cout << "Wand::search threshold factor " << options.threshold_factor
+            << " query " << times << " times, ";
+        gettimeofday(&begin, 0);
+        for (int i = 0; i < times; i++) {
+            wand.search(query->terms, &result, &options);
+        }
+        gettimeofday(&end, 0);
+        timeval_diff(begin, end);
+        std::cout << "  recall@" << heap_size << ": " << recall(exact, result) << "\n";
+    }
+
     query->release_ref();
 
     // std::cout << "search result:\n";
@@ -175,6 +992,18 @@ static void cap_features_test() {
 
 int main() {
     simple_test();
+    score_type_test<DefaultScoreTraits>("uint64_t");
+    score_type_test<FloatScoreTraits>("float");
+    score_type_test<Uint16ScoreTraits>("uint16_t");
+    dot_product_test();
+    term_group_test();
+    search_batch_test();
+    array_cursor_test();
+    constraints_test();
+    filter_test();
+    search_stream_test();
+    budget_test();
+    result_cache_test();
     cap_features_test();
     return 0;
 }
@@ -0,0 +1,75 @@
+// Print the memory used by a cap features index, broken down by structure,
+// before and after sealing.
+//
+// usage: wand-memory FILE
+#include "index.h"
+#include "cap_features.h"
+#include "timer.h"
+#include <stdio.h>
+#include <iostream>
+
+#if defined __linux__
+# include <unistd.h>
+#endif
+
+namespace {
+
+// resident set size of this process in bytes, 0 if unknown
+size_t get_rss() {
+#if defined __linux__
+    FILE * fp = fopen("/proc/self/statm", "r");
+    if (!fp) {
+        return 0;
+    }
+    unsigned long size = 0, resident = 0;
+    int n = fscanf(fp, "%lu %lu", &size, &resident);
+    fclose(fp);
+    return n == 2 ? (size_t)resident * (size_t)sysconf(_SC_PAGESIZE) : 0;
+#else
+    return 0;
+#endif
+}
+
+void print_usage(const InvertedIndex& ii, size_t base_rss) {
+    IndexMemoryUsage usage;
+    ii.memory_usage(&usage);
+    std::cout << usage;
+    if (ii.doc_count()) {
+        std::cout << "per doc: " << usage.total() / ii.doc_count() << " bytes\n";
+    }
+    size_t rss = get_rss();
+    if (rss) {
+        std::cout << "rss growth since start: " << rss - base_rss << " bytes\n";
+    }
+}
+
+}
+
+int main(int argc, char ** argv) {
+    if (argc != 2) {
+        std::cout << "usage: wand-memory FILE\n";
+        return 1;
+    }
+
+    size_t base_rss = get_rss();
+    InvertedIndex ii;
+    uint64_t begin = now_us();
+    int loaded = load_cap_features(&ii, argv[1]);
+    if (loaded == -1) {
+        std::cout << "can't open " << argv[1] << "\n";
+        return 1;
+    } else if (loaded == -2) {
+        std::cout << "bad lines in " << argv[1] << "\n";
+        return 1;
+    }
+    std::cout << "loaded " << ii.doc_count() << " documents in "
+        << (now_us() - begin) / 1e6 << " seconds\n\n";
+
+    std::cout << "linked:\n";
+    print_usage(ii, base_rss);
+
+    ii.seal();
+    std::cout << "\nsealed:\n";
+    print_usage(ii, base_rss);
+    return 0;
+}
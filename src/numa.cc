@@ -0,0 +1,128 @@
+#include "numa.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#if defined __linux__
+# include <linux/mempolicy.h>
+# include <sched.h>
+# include <sys/syscall.h>
+# include <unistd.h>
+#endif
+
+namespace {
+
+// nodes mbind can address
+const int kMaxNodes = 1024;
+
+// Parse a sysfs list like "0-3,8-11" into 'ids', return false on failure.
+bool read_id_list(const char * path, std::vector<int> * ids) {
+    ids->clear();
+    FILE * fp = fopen(path, "r");
+    if (!fp) {
+        return false;
+    }
+    char buf[4096];
+    bool ok = fgets(buf, sizeof(buf), fp) != 0;
+    fclose(fp);
+    if (!ok) {
+        return false;
+    }
+
+    const char * p = buf;
+    while (*p >= '0' && *p <= '9') {
+        char * end;
+        long first = strtol(p, &end, 10);
+        long last = first;
+        if (*end == '-') {
+            last = strtol(end + 1, &end, 10);
+        }
+        for (long id = first; id <= last; id++) {
+            ids->push_back((int)id);
+        }
+        p = *end == ',' ? end + 1 : end;
+    }
+    return !ids->empty();
+}
+
+}
+
+const int Numa::kAnyNode;
+const int Numa::kInterleave;
+
+void Numa::get_nodes(std::vector<int> * nodes) {
+#if defined __linux__
+    if (read_id_list("/sys/devices/system/node/online", nodes)) {
+        return;
+    }
+#endif
+    nodes->assign(1, 0);
+}
+
+void Numa::get_node_cpus(int node, std::vector<int> * cpus) {
+#if defined __linux__
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    if (read_id_list(path, cpus)) {
+        return;
+    }
+    if (read_id_list("/sys/devices/system/cpu/online", cpus)) {
+        return;
+    }
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    cpus->clear();
+    for (long i = 0; i < (n > 0 ? n : 1); i++) {
+        cpus->push_back((int)i);
+    }
+#else
+    (void)node;
+    cpus->assign(1, 0);
+#endif
+}
+
+bool Numa::bind(void * addr, size_t size, int node) {
+#if defined __linux__ && defined __NR_mbind
+    const int kBits = (int)sizeof(unsigned long) * 8;
+    unsigned long mask[kMaxNodes / (sizeof(unsigned long) * 8)] = {0};
+    int mode;
+    if (node == kInterleave) {
+        std::vector<int> nodes;
+        get_nodes(&nodes);
+        for (size_t i = 0; i < nodes.size(); i++) {
+            if (nodes[i] < kMaxNodes) {
+                mask[nodes[i] / kBits] |= 1UL << (nodes[i] % kBits);
+            }
+        }
+        mode = MPOL_INTERLEAVE;
+    } else if (node >= 0 && node < kMaxNodes) {
+        mask[node / kBits] |= 1UL << (node % kBits);
+        mode = MPOL_BIND;
+    } else {
+        return false;
+    }
+    // the kernel reads 'maxnode' - 1 bits
+    return syscall(__NR_mbind, addr, size, mode, mask, (unsigned long)kMaxNodes + 1,
+        MPOL_MF_MOVE) == 0;
+#else
+    (void)addr;
+    (void)size;
+    (void)node;
+    return false;
+#endif
+}
+
+bool Numa::pin_current_thread(const std::vector<int>& cpus) {
+#if defined __linux__ && defined CPU_SET
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (size_t i = 0; i < cpus.size(); i++) {
+        if (cpus[i] >= 0 && cpus[i] < CPU_SETSIZE) {
+            CPU_SET(cpus[i], &set);
+        }
+    }
+    // 0 is the calling thread
+    return CPU_COUNT(&set) > 0 && sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+    (void)cpus;
+    return false;
+#endif
+}
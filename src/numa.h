@@ -0,0 +1,37 @@
+#ifndef WAND_ENGINE_NUMA_H
+#define WAND_ENGINE_NUMA_H
+
+#include <stddef.h>
+#include <vector>
+
+// NUMA topology, memory placement and CPU affinity without libnuma.
+//
+// The topology is read from /sys/devices/system/node, memory is placed by
+// the mbind system call and threads are pinned by sched_setaffinity.
+// Where any of them is missing(other platforms, kernels without NUMA,
+// containers denying the calls), the machine looks like one node holding
+// every CPU and placement does nothing, so callers need no special case.
+class Numa {
+public:
+    // placement policies besides a node id, see bind
+    static const int kAnyNode = -1;// the kernel default, first touch
+    static const int kInterleave = -2;// page by page over all nodes
+
+    // ids of online nodes in increasing order, never empty
+    static void get_nodes(std::vector<int> * nodes);
+    // CPUs of 'node', all online CPUs if unknown
+    static void get_node_cpus(int node, std::vector<int> * cpus);
+
+    // Place the pages of [addr, addr + size) on 'node', or by kInterleave.
+    // 'addr' must be page aligned. Pages already touched are migrated.
+    // Return false if the kernel refused, the range is then left as it was.
+    static bool bind(void * addr, size_t size, int node);
+
+    // Pin the calling thread to 'cpus'. Return false if it couldn't.
+    static bool pin_current_thread(const std::vector<int>& cpus);
+
+private:
+    Numa();
+};
+
+#endif// WAND_ENGINE_NUMA_H
@@ -0,0 +1,148 @@
+#include "perf_counters.h"
+#include <errno.h>
+#include <string.h>
+
+#if defined __linux__
+# include <linux/perf_event.h>
+# include <sys/ioctl.h>
+# include <sys/syscall.h>
+# include <unistd.h>
+#endif
+
+namespace {
+
+#if defined __linux__
+// glibc has no wrapper of perf_event_open
+int perf_event_open(struct perf_event_attr * attr) {
+    // this thread, any cpu
+    return (int)syscall(__NR_perf_event_open, attr, 0, -1, -1, 0);
+}
+
+void get_attr(PerfCounters::Event event, struct perf_event_attr * attr) {
+    memset(attr, 0, sizeof(*attr));
+    attr->size = sizeof(*attr);
+    attr->disabled = 1;
+    attr->exclude_kernel = 1;
+    attr->exclude_hv = 1;
+    attr->read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attr->type = PERF_TYPE_HARDWARE;
+    switch (event) {
+    case PerfCounters::CYCLES:
+        attr->config = PERF_COUNT_HW_CPU_CYCLES;
+        break;
+    case PerfCounters::INSTRUCTIONS:
+        attr->config = PERF_COUNT_HW_INSTRUCTIONS;
+        break;
+    case PerfCounters::BRANCH_MISSES:
+        attr->config = PERF_COUNT_HW_BRANCH_MISSES;
+        break;
+    case PerfCounters::L1D_MISSES:
+        attr->type = PERF_TYPE_HW_CACHE;
+        attr->config = PERF_COUNT_HW_CACHE_L1D
+            | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+            | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        break;
+    case PerfCounters::DTLB_MISSES:
+        attr->type = PERF_TYPE_HW_CACHE;
+        attr->config = PERF_COUNT_HW_CACHE_DTLB
+            | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+            | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        break;
+    default:
+        attr->config = PERF_COUNT_HW_CACHE_MISSES;
+        break;
+    }
+}
+#endif
+
+}
+
+void PerfCounters::Sample::clear() {
+    for (int i = 0; i < EVENT_COUNT; i++) {
+        values[i] = 0;
+        valid[i] = false;
+    }
+}
+
+PerfCounters::PerfCounters() : error_() {
+    for (int i = 0; i < EVENT_COUNT; i++) {
+        fds_[i] = -1;
+    }
+#if defined __linux__
+    for (int i = 0; i < EVENT_COUNT; i++) {
+        struct perf_event_attr attr;
+        get_attr((Event)i, &attr);
+        fds_[i] = perf_event_open(&attr);
+        if (fds_[i] == -1 && error_.empty()) {
+            error_ = std::string("perf_event_open: ") + strerror(errno);
+        }
+    }
+    if (available()) {
+        error_.clear();
+    }
+#else
+    error_ = "perf_event_open is only available on Linux";
+#endif
+}
+
+PerfCounters::~PerfCounters() {
+#if defined __linux__
+    for (int i = 0; i < EVENT_COUNT; i++) {
+        if (fds_[i] != -1) {
+            close(fds_[i]);
+        }
+    }
+#endif
+}
+
+bool PerfCounters::available() const {
+    for (int i = 0; i < EVENT_COUNT; i++) {
+        if (fds_[i] != -1) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void PerfCounters::start() {
+#if defined __linux__
+    for (int i = 0; i < EVENT_COUNT; i++) {
+        if (fds_[i] != -1) {
+            ioctl(fds_[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(fds_[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#endif
+}
+
+void PerfCounters::stop(Sample * sample) {
+    sample->clear();
+#if defined __linux__
+    for (int i = 0; i < EVENT_COUNT; i++) {
+        if (fds_[i] != -1) {
+            ioctl(fds_[i], PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+    for (int i = 0; i < EVENT_COUNT; i++) {
+        // value, time enabled, time running
+        uint64_t data[3];
+        if (fds_[i] == -1 || read(fds_[i], data, sizeof(data)) != (ssize_t)sizeof(data)) {
+            continue;
+        }
+        if (data[2] == 0) {
+            // never scheduled on the PMU
+            continue;
+        }
+        sample->values[i] = data[2] < data[1] ?
+            (uint64_t)((double)data[0] * data[1] / data[2]) : data[0];
+        sample->valid[i] = true;
+    }
+#endif
+}
+
+const char * PerfCounters::name(Event event) {
+    static const char * names[EVENT_COUNT] = {
+        "cycles", "instructions", "branch-misses", "L1d-misses", "LLC-misses", "dTLB-misses"
+    };
+    return names[event];
+}
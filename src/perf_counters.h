@@ -0,0 +1,70 @@
+#ifndef WAND_ENGINE_PERF_COUNTERS_H
+#define WAND_ENGINE_PERF_COUNTERS_H
+
+#include <stdint.h>
+#include <string>
+
+// Hardware performance counters of the calling thread, user space only.
+//
+// Uses perf_event_open on Linux. Each event is opened on its own,
+// so an event the CPU or the kernel doesn't support only loses itself.
+// Where counters are not allowed (other platforms, containers without
+// CAP_PERFMON, perf_event_paranoid > 2, virtual machines without a PMU),
+// nothing is opened and every sample is invalid.
+class PerfCounters {
+public:
+    enum Event {
+        CYCLES,
+        INSTRUCTIONS,
+        BRANCH_MISSES,
+        L1D_MISSES,// L1 data cache read misses
+        LLC_MISSES,// last level cache misses
+        DTLB_MISSES,// data TLB read misses
+        EVENT_COUNT
+    };
+
+    struct Sample {
+        uint64_t values[EVENT_COUNT];
+        bool valid[EVENT_COUNT];
+
+        Sample() {
+            clear();
+        }
+
+        void clear();
+    };
+
+private:
+    int fds_[EVENT_COUNT];
+    std::string error_;
+
+public:
+    PerfCounters();
+    ~PerfCounters();
+
+    // whether any event was opened
+    bool available() const;
+
+    bool available(Event event) const {
+        return fds_[event] != -1;
+    }
+
+    // why no event could be opened
+    const std::string& error() const {
+        return error_;
+    }
+
+    // Reset and enable the counters.
+    void start();
+    // Disable the counters and read them into 'sample',
+    // values are scaled up if the kernel multiplexed the counters.
+    void stop(Sample * sample);
+
+    static const char * name(Event event);
+
+private:
+    PerfCounters(PerfCounters& other);
+    PerfCounters& operator=(PerfCounters& other);
+};
+
+#endif// WAND_ENGINE_PERF_COUNTERS_H
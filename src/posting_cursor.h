@@ -0,0 +1,284 @@
+#ifndef WAND_ENGINE_POSTING_CURSOR_H
+#define WAND_ENGINE_POSTING_CURSOR_H
+
+#include "index.h"
+#include <algorithm>
+
+#if defined _MSC_VER
+# include <xmmintrin.h>
+#endif
+
+// Hint the cache to load 'address' for reading, it never faults.
+inline void prefetch(const void * address) {
+#if defined __GNUC__
+    __builtin_prefetch(address, 0, 3);
+#elif defined _MSC_VER
+    _mm_prefetch((const char *)address, _MM_HINT_T0);
+#else
+    (void)address;
+#endif
+}
+
+// Posting cursors walk one posting list in increasing doc id order.
+// Traversal loops of Wand are templates over the cursor type,
+// so every posting layout gets its own inlined loop.
+//
+// A cursor type provides:
+//   static const bool has_blocks;  whether block_max() is tighter than max_score()
+//   explicit Cursor(const PostingList * posting_list);
+//   IdType docid() const;          current doc id, the sentinel id at the end
+//   WeightType weight() const;     weight of the current posting
+//   Document * doc() const;        current doc
+//   void next();                   move to the next posting
+//   size_t skip_to(IdType doc_id); move to the first posting whose doc id >= 'doc_id',
+//                                  return the number of postings passed
+//   WeightType max_score() const;  max weight of the posting list
+//   WeightType block_max() const;  max weight of the block of the current posting
+//   size_t remains() const;        postings from the current one to the end
+//   void prefetch_postings(size_t distance) const;
+//                                  prefetch the posting 'distance' ahead of the current one
+//   void prefetch_doc(size_t distance) const;
+//                                  prefetch the doc of that posting
+// The linked list can't reach a node ahead without loading the ones between,
+// so its prefetches only cover the next node, whatever the distance.
+
+// cursor of the linked list
+template <typename Traits>
+class LinkedPostingCursor {
+public:
+    typedef typename Traits::WeightType WeightType;
+    typedef BasicDocument<Traits> Document;
+    typedef BasicPostingListNode<Traits> PostingListNode;
+    typedef BasicPostingList<Traits> PostingList;
+
+    static const bool has_blocks = false;
+
+private:
+    PostingListNode * current_;
+    WeightType max_score_;
+    size_t remains_;
+
+public:
+    LinkedPostingCursor() : current_(0), max_score_(0), remains_(0) {}
+
+    explicit LinkedPostingCursor(const PostingList * posting_list)
+        : current_(posting_list->front()),
+        max_score_(posting_list->get_upper_bound()),
+        remains_(posting_list->size()) {
+    }
+
+    IdType docid() const {
+        return current_->doc->id;
+    }
+
+    WeightType weight() const {
+        return current_->bound;
+    }
+
+    Document * doc() const {
+        return current_->doc;
+    }
+
+    void next() {
+        current_ = current_->next;
+        remains_--;
+    }
+
+    size_t skip_to(IdType doc_id) {
+        size_t advanced = 0;
+        while (current_->doc->id < doc_id) {
+            current_ = current_->next;
+            advanced++;
+        }
+        remains_ -= advanced;
+        return advanced;
+    }
+
+    WeightType max_score() const {
+        return max_score_;
+    }
+
+    WeightType block_max() const {
+        return max_score_;
+    }
+
+    size_t remains() const {
+        return remains_;
+    }
+
+    void prefetch_postings(size_t distance) const {
+        (void)distance;
+        ::prefetch(current_->next);
+    }
+
+    void prefetch_doc(size_t distance) const {
+        prefetch_postings(distance);
+    }
+};
+
+// cursor of the sealed arrays, PostingList::seal must have been called.
+// It walks doc ids in either layout of BasicPostingArray, the current one is
+// cached so both layouts cost the same to read it.
+template <typename Traits>
+class ArrayPostingCursor {
+public:
+    typedef typename Traits::WeightType WeightType;
+    typedef BasicDocument<Traits> Document;
+    typedef BasicPostingArray<Traits> PostingArray;
+    typedef BasicPostingList<Traits> PostingList;
+
+    static const bool has_blocks = true;
+
+private:
+    const PostingArray * array_;
+    const IdType * doc_ids_;// 0 if doc ids are in array_->doc_id_set
+    size_t pos_;
+    IdType doc_id_;
+    // position in the DocIdSet
+    uint32_t chunk_;
+    uint32_t in_;
+
+    // Move to the first doc id >= ('low' | key of chunk 'c' << 16), from position 'in_'
+    // of chunk 'c', which must be at or after the current chunk.
+    void seek_set(size_t c, uint32_t low) {
+        const DocIdSet& set = array_->doc_id_set;
+        for (; c < set.chunk_count; c++) {
+            uint32_t value, rank;
+            if (set.seek(c, low, &in_, &value, &rank)) {
+                chunk_ = (uint32_t)c;
+                pos_ = set.chunks[c].rank + rank;
+                doc_id_ = set.chunks[c].key << 16 | value;
+                return;
+            }
+            // all of the next chunk is greater
+            in_ = 0;
+            low = 0;
+        }
+        chunk_ = (uint32_t)c;
+        pos_ = set.size();
+        doc_id_ = Document::sentinel()->id;
+    }
+
+    void next_in_set() {
+        const DocIdSet& set = array_->doc_id_set;
+        if (pos_ == set.chunks[chunk_ + 1].rank) {
+            in_ = 0;
+            seek_set(chunk_ + 1, 0);
+            return;
+        }
+        uint32_t value = (uint32_t)(doc_id_ & 0xffff);
+        set.next(chunk_, &in_, &value);
+        doc_id_ = (doc_id_ & ~(IdType)0xffff) | value;
+    }
+
+    size_t skip_in_set(IdType doc_id) {
+        const DocIdSet& set = array_->doc_id_set;
+        size_t from = pos_;
+        IdType key = doc_id >> 16;
+        size_t c = chunk_;
+        if (set.chunks[c].key < key) {
+            // binary search the chunks after the current one
+            size_t count = set.chunk_count;
+            c++;
+            while (c < count) {
+                size_t middle = c + (count - c) / 2;
+                if (set.chunks[middle].key < key) {
+                    c = middle + 1;
+                } else {
+                    count = middle;
+                }
+            }
+            in_ = 0;
+        }
+        seek_set(c, c < set.chunk_count && set.chunks[c].key == key ?
+            (uint32_t)(doc_id & 0xffff) : 0);
+        return pos_ - from;
+    }
+
+public:
+    ArrayPostingCursor() : array_(0), doc_ids_(0), pos_(0), doc_id_(0), chunk_(0), in_(0) {}
+
+    explicit ArrayPostingCursor(const PostingList * posting_list)
+        : array_(posting_list->array()),
+        doc_ids_(array_->doc_ids),
+        pos_(0), doc_id_(0), chunk_(0), in_(0) {
+        if (doc_ids_) {
+            doc_id_ = doc_ids_[0];
+        } else {
+            seek_set(0, 0);
+        }
+    }
+
+    IdType docid() const {
+        return doc_id_;
+    }
+
+    WeightType weight() const {
+        return array_->weights[pos_];
+    }
+
+    Document * doc() const {
+        return array_->docs[pos_];
+    }
+
+    void next() {
+        if (doc_ids_) {
+            doc_id_ = doc_ids_[++pos_];
+        } else {
+            pos_++;
+            next_in_set();
+        }
+    }
+
+    size_t skip_to(IdType doc_id) {
+        if (doc_id_ >= doc_id) {
+            return 0;
+        }
+        if (!doc_ids_) {
+            return skip_in_set(doc_id);
+        }
+
+        // skip whole blocks, the last block ends with the sentinel
+        size_t from = pos_;
+        const IdType * block_last_ids = array_->block_last_ids;
+        size_t block = pos_ / kPostingBlockSize;
+        if (block_last_ids[block] < doc_id) {
+            do {
+                block++;
+            } while (block_last_ids[block] < doc_id);
+            pos_ = block * kPostingBlockSize;
+        }
+        while (doc_ids_[pos_] < doc_id) {
+            pos_++;
+        }
+        doc_id_ = doc_ids_[pos_];
+        return pos_ - from;
+    }
+
+    WeightType max_score() const {
+        return array_->upper_bound;
+    }
+
+    WeightType block_max() const {
+        return array_->block_max_weights[pos_ / kPostingBlockSize];
+    }
+
+    size_t remains() const {
+        return array_->size() - pos_;
+    }
+
+    void prefetch_postings(size_t distance) const {
+        size_t pos = std::min(pos_ + distance, array_->size());
+        if (doc_ids_) {
+            ::prefetch(doc_ids_ + pos);
+        }
+        ::prefetch(&array_->weights[pos]);
+    }
+
+    void prefetch_doc(size_t distance) const {
+        size_t pos = std::min(pos_ + distance, array_->size());
+        ::prefetch(array_->docs[pos]);
+    }
+};
+
+#endif// WAND_ENGINE_POSTING_CURSOR_H
@@ -0,0 +1,149 @@
+#include "protocol.h"
+
+namespace {
+
+const size_t kRequestHeaderSize = 4 + 8 + 4 + 4 + 4;
+const size_t kResponseHeaderSize = 4 + 8 + 4;
+const size_t kPairSize = 8 + 8;
+
+void put_u32(std::vector<char> * out, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        out->push_back((char)(value >> (i * 8)));
+    }
+}
+
+void put_u64(std::vector<char> * out, uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+        out->push_back((char)(value >> (i * 8)));
+    }
+}
+
+uint32_t get_u32(const char * p) {
+    uint32_t value = 0;
+    for (int i = 3; i >= 0; i--) {
+        value = (value << 8) | (unsigned char)p[i];
+    }
+    return value;
+}
+
+uint64_t get_u64(const char * p) {
+    uint64_t value = 0;
+    for (int i = 7; i >= 0; i--) {
+        value = (value << 8) | (unsigned char)p[i];
+    }
+    return value;
+}
+
+// Bytes of the frame at the start of 'data' with its size field,
+// 0 if not complete, -1 if its size is not in [header_size, kMaxFrameSize]
+// or not header_size + a multiple of 'pair_size'.
+long get_frame_size(const char * data, size_t size, size_t header_size) {
+    if (size < 4) {
+        return 0;
+    }
+    uint32_t frame_size = get_u32(data);
+    if (frame_size < header_size || frame_size > SearchRequest::kMaxFrameSize
+            || (frame_size - header_size) % kPairSize != 0) {
+        return -1;
+    }
+    if (size < 4 + (size_t)frame_size) {
+        return 0;
+    }
+    return 4 + (long)frame_size;
+}
+
+}
+
+const uint32_t SearchRequest::kRequestMagic;
+const size_t SearchRequest::kMaxFrameSize;
+
+void SearchRequest::encode(std::vector<char> * out) const {
+    put_u32(out, (uint32_t)(kRequestHeaderSize + terms.size() * kPairSize));
+    put_u32(out, kRequestMagic);
+    put_u64(out, request_id);
+    put_u32(out, timeout_us);
+    put_u32(out, k);
+    put_u32(out, (uint32_t)terms.size());
+    for (size_t i = 0, s = terms.size(); i < s; i++) {
+        put_u64(out, terms[i].id);
+        put_u64(out, (uint64_t)terms[i].weight);
+    }
+}
+
+long SearchRequest::decode(const char * data, size_t size) {
+    long frame_size = get_frame_size(data, size, kRequestHeaderSize);
+    if (frame_size <= 0) {
+        return frame_size;
+    }
+    const char * p = data + 4;
+    uint32_t term_count = get_u32(p + 20);
+    if (get_u32(p) != kRequestMagic
+            || term_count != (frame_size - 4 - kRequestHeaderSize) / kPairSize) {
+        return -1;
+    }
+    request_id = get_u64(p + 4);
+    timeout_us = get_u32(p + 12);
+    k = get_u32(p + 16);
+    p += kRequestHeaderSize;
+    terms.clear();
+    terms.reserve(term_count);
+    for (uint32_t i = 0; i < term_count; i++, p += kPairSize) {
+        terms.push_back(Term(get_u64(p), (WeightType)get_u64(p + 8)));
+    }
+    return frame_size;
+}
+
+void SearchResponse::encode(uint64_t request_id, ResponseStatus status,
+        const Wand::DocIdScore * results, size_t count, std::vector<char> * out) {
+    put_u32(out, (uint32_t)(kResponseHeaderSize + count * kPairSize));
+    put_u32(out, (uint32_t)status);
+    put_u64(out, request_id);
+    put_u32(out, (uint32_t)count);
+    for (size_t i = 0; i < count; i++) {
+        put_u64(out, results[i].doc_id);
+        put_u64(out, (uint64_t)results[i].score);
+    }
+}
+
+void SearchResponse::encode(std::vector<char> * out) const {
+    encode(request_id, (ResponseStatus)status, results.empty() ? 0 : &results[0],
+        results.size(), out);
+}
+
+long SearchResponse::decode(const char * data, size_t size) {
+    long frame_size = get_frame_size(data, size, kResponseHeaderSize);
+    if (frame_size <= 0) {
+        return frame_size;
+    }
+    const char * p = data + 4;
+    uint32_t result_count = get_u32(p + 12);
+    if (result_count != (frame_size - 4 - kResponseHeaderSize) / kPairSize) {
+        return -1;
+    }
+    status = get_u32(p);
+    request_id = get_u64(p + 4);
+    p += kResponseHeaderSize;
+    results.clear();
+    results.reserve(result_count);
+    for (uint32_t i = 0; i < result_count; i++, p += kPairSize) {
+        results.push_back(Wand::DocIdScore(get_u64(p), (ScoreType)get_u64(p + 8)));
+    }
+    return frame_size;
+}
+
+const char * get_status_name(uint32_t status) {
+    switch (status) {
+    case RESPONSE_OK:
+        return "ok";
+    case RESPONSE_APPROXIMATE:
+        return "approximate";
+    case RESPONSE_DEADLINE_EXCEEDED:
+        return "deadline_exceeded";
+    case RESPONSE_OVERLOADED:
+        return "overloaded";
+    case RESPONSE_BAD_REQUEST:
+        return "bad_request";
+    default:
+        return "unknown";
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef WAND_ENGINE_PROTOCOL_H
+#define WAND_ENGINE_PROTOCOL_H
+
+#include "wand.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Binary protocol of wand-server over a stream socket.
+//
+// Both sides send frames, every integer is little endian:
+//   request   uint32 size         bytes of the frame after 'size'
+//             uint32 magic        kRequestMagic
+//             uint64 request_id   returned in the response
+//             uint32 timeout_us   from the time the server reads the request, 0 means none
+//             uint32 k            results wanted, 0 means the k of the server
+//             uint32 term_count
+//             term_count x { uint64 term_id, uint64 weight }
+//   response  uint32 size
+//             uint32 status       ResponseStatus
+//             uint64 request_id
+//             uint32 result_count
+//             result_count x { uint64 doc_id, uint64 score }
+// A client may send many requests without waiting, responses may come in any order.
+// Term ids are hash_string of features, like the index loader.
+struct SearchRequest {
+    static const uint32_t kRequestMagic = 0x444e4157;// "WAND"
+    // larger frames are malformed
+    static const size_t kMaxFrameSize = 1 << 20;
+
+    uint64_t request_id;
+    uint32_t timeout_us;
+    uint32_t k;
+    TermVector terms;
+
+    SearchRequest() : request_id(0), timeout_us(0), k(0), terms() {}
+
+    // Append the frame of this to 'out'.
+    void encode(std::vector<char> * out) const;
+    // Decode the frame at the start of 'data', return its bytes,
+    // 0 if it's not complete yet, or -1 if it's malformed.
+    long decode(const char * data, size_t size);
+};
+
+enum ResponseStatus {
+    RESPONSE_OK,
+    // ran out of time, the results are the best found so far
+    RESPONSE_APPROXIMATE,
+    // expired before it was searched, no results
+    RESPONSE_DEADLINE_EXCEEDED,
+    // too many requests waiting, no results
+    RESPONSE_OVERLOADED,
+    // malformed request, the server closes the connection
+    RESPONSE_BAD_REQUEST
+};
+
+struct SearchResponse {
+    uint64_t request_id;
+    uint32_t status;
+    std::vector<Wand::DocIdScore> results;
+
+    SearchResponse() : request_id(0), status(RESPONSE_OK), results() {}
+
+    // The frame of this with the first 'count' of 'results' of a search.
+    static void encode(uint64_t request_id, ResponseStatus status,
+            const Wand::DocIdScore * results, size_t count, std::vector<char> * out);
+    void encode(std::vector<char> * out) const;
+    // like SearchRequest::decode
+    long decode(const char * data, size_t size);
+};
+
+const char * get_status_name(uint32_t status);
+
+#endif// WAND_ENGINE_PROTOCOL_H
@@ -0,0 +1,201 @@
+#include "query_executor.h"
+#include "atomic.h"
+#include "numa.h"
+
+#if defined _WIN32
+# define WIN32_LEAN_AND_MEAN
+# include <Windows.h>
+#else
+# include <unistd.h>
+#endif
+
+template <typename Traits>
+size_t BasicQueryExecutor<Traits>::get_cpu_count() {
+#if defined _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (size_t)info.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (size_t)n : 1;
+#endif
+}
+
+template <typename Traits>
+BasicQueryExecutor<Traits>::BasicQueryExecutor(const Wand& wand, size_t thread_count,
+        const std::vector<int> * cpus)
+    : wand_(&wand), cpus_(cpus ? *cpus : std::vector<int>()), workers_(),
+    generation_(0), running_(0), stopping_(false),
+    queries_(0), results_(0), options_(0), options_step_(0), complete_(0), next_query_(0) {
+    pthread_mutex_init(&mutex_, 0);
+    pthread_cond_init(&start_cond_, 0);
+    pthread_cond_init(&done_cond_, 0);
+
+    if (thread_count == 0) {
+        thread_count = cpus_.empty() ? get_cpu_count() : cpus_.size();
+    }
+    for (size_t i = 0; i < thread_count; i++) {
+        Worker * worker = new Worker();
+        worker->executor = this;
+        worker->generation = 0;
+        if (pthread_create(&worker->thread, 0, thread_main, worker) != 0) {
+            delete worker;
+            break;
+        }
+        workers_.push_back(worker);
+    }
+}
+
+template <typename Traits>
+BasicQueryExecutor<Traits>::~BasicQueryExecutor() {
+    pthread_mutex_lock(&mutex_);
+    stopping_ = true;
+    pthread_cond_broadcast(&start_cond_);
+    pthread_mutex_unlock(&mutex_);
+
+    for (size_t i = 0, s = workers_.size(); i < s; i++) {
+        pthread_join(workers_[i]->thread, 0);
+        delete workers_[i];
+    }
+
+    pthread_cond_destroy(&done_cond_);
+    pthread_cond_destroy(&start_cond_);
+    pthread_mutex_destroy(&mutex_);
+}
+
+template <typename Traits>
+void * BasicQueryExecutor<Traits>::thread_main(void * arg) {
+    Worker * worker = (Worker *)arg;
+    worker->executor->run(worker);
+    return 0;
+}
+
+template <typename Traits>
+void BasicQueryExecutor<Traits>::run(Worker * worker) {
+    // before the context allocates anything, so it is on the node of 'cpus_'
+    if (!cpus_.empty()) {
+        Numa::pin_current_thread(cpus_);
+    }
+
+    pthread_mutex_lock(&mutex_);
+    for (;;) {
+        while (!stopping_ && worker->generation == generation_) {
+            pthread_cond_wait(&start_cond_, &mutex_);
+        }
+        if (stopping_) {
+            break;
+        }
+        worker->generation = generation_;
+        const std::vector<TermVector>& queries = *queries_;
+        std::vector<std::vector<typename Wand::DocIdScore> >& results = *results_;
+        pthread_mutex_unlock(&mutex_);
+
+        for (;;) {
+            size_t i = atomic_fetch_add(&next_query_, (size_t)1);
+            if (i >= queries.size()) {
+                break;
+            }
+            // Wand::search sorts the query, work on a copy.
+            worker->query.assign(queries[i].begin(), queries[i].end());
+            bool complete = wand_->search(&worker->context, worker->query, &results[i],
+                options_ ? options_ + i * options_step_ : 0);
+            if (complete_) {
+                (*complete_)[i] = complete;
+            }
+        }
+
+        pthread_mutex_lock(&mutex_);
+        if (--running_ == 0) {
+            pthread_cond_signal(&done_cond_);
+        }
+    }
+    pthread_mutex_unlock(&mutex_);
+}
+
+template <typename Traits>
+void BasicQueryExecutor<Traits>::search(const std::vector<TermVector>& queries,
+        std::vector<std::vector<typename Wand::DocIdScore> > * results,
+        const typename Wand::SearchOptions * options) {
+    start(queries, results, options);
+    wait();
+}
+
+template <typename Traits>
+void BasicQueryExecutor<Traits>::start(const std::vector<TermVector>& queries,
+        std::vector<std::vector<typename Wand::DocIdScore> > * results,
+        const typename Wand::SearchOptions * options) {
+    start(queries, results, options, 0, 0);
+}
+
+template <typename Traits>
+void BasicQueryExecutor<Traits>::search(const std::vector<TermVector>& queries,
+        std::vector<std::vector<typename Wand::DocIdScore> > * results,
+        const std::vector<typename Wand::SearchOptions>& options,
+        std::vector<char> * complete) {
+    start(queries, results, options, complete);
+    wait();
+}
+
+template <typename Traits>
+void BasicQueryExecutor<Traits>::start(const std::vector<TermVector>& queries,
+        std::vector<std::vector<typename Wand::DocIdScore> > * results,
+        const std::vector<typename Wand::SearchOptions>& options,
+        std::vector<char> * complete) {
+    start(queries, results, options.empty() ? 0 : &options[0], 1, complete);
+}
+
+template <typename Traits>
+void BasicQueryExecutor<Traits>::start(const std::vector<TermVector>& queries,
+        std::vector<std::vector<typename Wand::DocIdScore> > * results,
+        const typename Wand::SearchOptions * options, size_t options_step,
+        std::vector<char> * complete) {
+    results->resize(queries.size());
+    if (complete) {
+        complete->assign(queries.size(), 1);
+    }
+    if (queries.empty()) {
+        return;
+    }
+
+    if (workers_.empty()) {
+        // no thread could be created, search in the calling thread
+        typename Wand::QueryContext context;
+        TermVector query;
+        for (size_t i = 0, s = queries.size(); i < s; i++) {
+            query.assign(queries[i].begin(), queries[i].end());
+            bool done = wand_->search(&context, query, &(*results)[i],
+                options ? options + i * options_step : 0);
+            if (complete) {
+                (*complete)[i] = done;
+            }
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&mutex_);
+    queries_ = &queries;
+    results_ = results;
+    options_ = options;
+    options_step_ = options_step;
+    complete_ = complete;
+    next_query_ = 0;
+    running_ = workers_.size();
+    generation_++;
+    pthread_cond_broadcast(&start_cond_);
+    pthread_mutex_unlock(&mutex_);
+}
+
+template <typename Traits>
+void BasicQueryExecutor<Traits>::wait() {
+    pthread_mutex_lock(&mutex_);
+    while (running_ > 0) {
+        pthread_cond_wait(&done_cond_, &mutex_);
+    }
+    queries_ = 0;
+    results_ = 0;
+    options_ = 0;
+    complete_ = 0;
+    pthread_mutex_unlock(&mutex_);
+}
+
+WAND_ENGINE_INSTANTIATE(class BasicQueryExecutor)
@@ -0,0 +1,107 @@
+#ifndef WAND_ENGINE_QUERY_EXECUTOR_H
+#define WAND_ENGINE_QUERY_EXECUTOR_H
+
+#include "wand.h"
+#include <pthread.h>
+#include <vector>
+
+// A fixed pool of threads searching one Wand concurrently.
+// Every thread owns a Wand::QueryContext reused for all its queries,
+// and threads claim queries one by one from a shared atomic counter.
+// Threads may be pinned to a set of CPUs, e.g. the CPUs of the NUMA node
+// holding the index.
+template <typename Traits>
+class BasicQueryExecutor {
+public:
+    typedef BasicWand<Traits> Wand;
+    typedef typename BasicDocument<Traits>::TermVector TermVector;
+
+private:
+    struct Worker {
+        BasicQueryExecutor * executor;
+        pthread_t thread;
+        uint64_t generation;
+        typename Wand::QueryContext context;
+        TermVector query;
+    };
+
+    const Wand * wand_;
+    const std::vector<int> cpus_;
+    std::vector<Worker *> workers_;
+    pthread_mutex_t mutex_;
+    pthread_cond_t start_cond_;
+    pthread_cond_t done_cond_;
+    uint64_t generation_;// one for every batch
+    size_t running_;// workers not done with the current batch
+    bool stopping_;
+    const std::vector<TermVector> * queries_;
+    std::vector<std::vector<typename Wand::DocIdScore> > * results_;
+    // options_[i * options_step_] is for queries[i], 0 if none
+    const typename Wand::SearchOptions * options_;
+    size_t options_step_;
+    std::vector<char> * complete_;
+    volatile size_t next_query_;
+
+    static void * thread_main(void * arg);
+    void run(Worker * worker);
+    void start(const std::vector<TermVector>& queries,
+            std::vector<std::vector<typename Wand::DocIdScore> > * results,
+            const typename Wand::SearchOptions * options, size_t options_step,
+            std::vector<char> * complete);
+
+public:
+    // 'thread_count' 0 means one thread per online CPU, or per CPU of 'cpus' if given.
+    // With 'cpus', every thread is pinned to them(see Numa::pin_current_thread).
+    explicit BasicQueryExecutor(const Wand& wand, size_t thread_count = 0,
+            const std::vector<int> * cpus = 0);
+    ~BasicQueryExecutor();
+
+    // Search all 'queries' in the pool, (*results)[i] is the result of queries[i].
+    // Block until all of them are done.
+    // A stream of queries is searched by calling it once for every batch of the stream.
+    // 'options' applies to each query.
+    // Only one thread may call it at a time.
+    void search(const std::vector<TermVector>& queries,
+            std::vector<std::vector<typename Wand::DocIdScore> > * results,
+            const typename Wand::SearchOptions * options = 0);
+
+    // search split in two, so the calling thread can start several executors
+    // and wait for all of them. Arguments must live until wait returns,
+    // every start must be followed by one wait.
+    void start(const std::vector<TermVector>& queries,
+            std::vector<std::vector<typename Wand::DocIdScore> > * results,
+            const typename Wand::SearchOptions * options = 0);
+    void wait();
+
+    // Like search and start, with options[i] for queries[i], e.g. a deadline per query.
+    // If 'complete' is not 0, (*complete)[i] is what Wand::search returned for queries[i],
+    // 0 if it ran out of budget.
+    void search(const std::vector<TermVector>& queries,
+            std::vector<std::vector<typename Wand::DocIdScore> > * results,
+            const std::vector<typename Wand::SearchOptions>& options,
+            std::vector<char> * complete = 0);
+    void start(const std::vector<TermVector>& queries,
+            std::vector<std::vector<typename Wand::DocIdScore> > * results,
+            const std::vector<typename Wand::SearchOptions>& options,
+            std::vector<char> * complete = 0);
+
+    // Search 'wand' from the next search or start on, e.g. a new version
+    // of an IndexHandle. Not while a search is running.
+    void rebind(const Wand& wand) {
+        wand_ = &wand;
+    }
+
+    size_t thread_count() const {
+        return workers_.size();
+    }
+
+    static size_t get_cpu_count();
+
+private:
+    BasicQueryExecutor(BasicQueryExecutor& other);
+    BasicQueryExecutor& operator=(BasicQueryExecutor& other);
+};
+
+typedef BasicQueryExecutor<DefaultScoreTraits> QueryExecutor;
+
+#endif// WAND_ENGINE_QUERY_EXECUTOR_H
@@ -0,0 +1,361 @@
+// Replay a query log against a cap features index and report latency percentiles.
+//
+// Every line of the query file is one query of whitespace separated "feature:weight"
+// terms("feature" alone means weight 1), features are hashed like the index loader.
+// Queries run in 'concurrency' threads, either back to back(closed loop),
+// or at a target 'qps'(open loop) where latency is measured from the time a query
+// is scheduled, so a stalled server is not hidden by fewer queries being sent.
+//
+// usage: wand-replay --index=FILE --queries=FILE [--name=value ...],
+// run "wand-replay --help" for options.
+#include "wand.h"
+#include "atomic.h"
+#include "cap_features.h"
+#include "histogram.h"
+#include "timer.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#if defined _WIN32
+# define WIN32_LEAN_AND_MEAN
+# include <Windows.h>
+#else
+# include <time.h>
+#endif
+
+namespace {
+
+struct ReplayOptions {
+    std::string index;
+    std::string queries;
+    size_t concurrency;
+    double qps;// 0 means closed loop
+    size_t repeat;// times to replay the query file
+    size_t k;
+    uint64_t threshold;
+    bool seal;
+    std::string engines;
+    std::string json;// file name, "-" for stdout
+
+    ReplayOptions()
+        : index(), queries(), concurrency(1), qps(0), repeat(1),
+        k(100), threshold(0), seal(true), engines("wand,taat"), json() {
+    }
+};
+
+typedef void (*EngineType)(const Wand& wand, Wand::QueryContext * ctx,
+        TermVector& query, std::vector<Wand::DocIdScore> * result);
+
+void search_wand(const Wand& wand, Wand::QueryContext * ctx,
+        TermVector& query, std::vector<Wand::DocIdScore> * result) {
+    wand.search(ctx, query, result);
+}
+
+void search_taat(const Wand& wand, Wand::QueryContext * ctx,
+        TermVector& query, std::vector<Wand::DocIdScore> * result) {
+    wand.search_taat(ctx, query, result);
+}
+
+void search_taat_v1(const Wand& wand, Wand::QueryContext *,
+        TermVector& query, std::vector<Wand::DocIdScore> * result) {
+    wand.search_taat_v1(query, result);
+}
+
+void search_taat_v2(const Wand& wand, Wand::QueryContext *,
+        TermVector& query, std::vector<Wand::DocIdScore> * result) {
+    wand.search_taat_v2(query, result);
+}
+
+struct Engine {
+    const char * name;
+    EngineType search;
+};
+
+const Engine kEngines[] = {
+    {"wand", search_wand},
+    {"taat", search_taat},
+    {"taat_v1", search_taat_v1},
+    {"taat_v2", search_taat_v2},
+};
+const size_t kEngineCount = sizeof(kEngines) / sizeof(kEngines[0]);
+
+bool has_engine(const ReplayOptions& options, const char * name) {
+    std::string list = "," + options.engines + ",";
+    return list.find("," + std::string(name) + ",") != std::string::npos;
+}
+
+void sleep_until_ns(uint64_t time) {
+    uint64_t now = now_ns();
+    if (now >= time) {
+        return;
+    }
+#if defined _WIN32
+    Sleep((DWORD)((time - now) / 1000000));
+#else
+    struct timespec ts;
+    ts.tv_sec = (time_t)((time - now) / 1000000000);
+    ts.tv_nsec = (long)((time - now) % 1000000000);
+    nanosleep(&ts, 0);
+#endif
+}
+
+// One replay of all queries with one engine.
+class Replay {
+private:
+    struct Worker {
+        Replay * replay;
+        pthread_t thread;
+        Wand::QueryContext context;
+        Histogram histogram;
+    };
+
+    const Wand& wand_;
+    const Engine& engine_;
+    const std::vector<TermVector>& queries_;
+    const size_t total_;
+    const uint64_t interval_ns_;// between scheduled queries, 0 for closed loop
+    uint64_t start_ns_;
+    volatile size_t next_query_;
+
+    static void * thread_main(void * arg) {
+        Worker * worker = (Worker *)arg;
+        worker->replay->run(worker);
+        return 0;
+    }
+
+    void run(Worker * worker) {
+        TermVector query;
+        std::vector<Wand::DocIdScore> result;
+        for (;;) {
+            size_t i = atomic_fetch_add(&next_query_, (size_t)1);
+            if (i >= total_) {
+                break;
+            }
+            query = queries_[i % queries_.size()];
+            uint64_t begin;
+            if (interval_ns_) {
+                begin = start_ns_ + i * interval_ns_;
+                sleep_until_ns(begin);
+            } else {
+                begin = now_ns();
+            }
+            engine_.search(wand_, &worker->context, query, &result);
+            worker->histogram.record(now_ns() - begin);
+        }
+    }
+
+public:
+    Replay(const Wand& wand, const Engine& engine,
+            const std::vector<TermVector>& queries, size_t repeat, double qps)
+        : wand_(wand), engine_(engine), queries_(queries),
+        total_(queries.size() * repeat),
+        interval_ns_(qps > 0 ? (uint64_t)(1e9 / qps) : 0),
+        start_ns_(0), next_query_(0) {
+    }
+
+    // Return the wall time in nanoseconds.
+    uint64_t run(size_t concurrency, Histogram * histogram) {
+        std::vector<Worker *> workers;
+        start_ns_ = now_ns();
+        for (size_t i = 0; i < concurrency; i++) {
+            Worker * worker = new Worker();
+            worker->replay = this;
+            if (pthread_create(&worker->thread, 0, thread_main, worker) != 0) {
+                delete worker;
+                break;
+            }
+            workers.push_back(worker);
+        }
+        if (workers.empty()) {
+            // no thread could be created, replay in the calling thread
+            Worker worker;
+            worker.replay = this;
+            run(&worker);
+            histogram->merge(worker.histogram);
+        }
+        for (size_t i = 0; i < workers.size(); i++) {
+            pthread_join(workers[i]->thread, 0);
+            histogram->merge(workers[i]->histogram);
+            delete workers[i];
+        }
+        return now_ns() - start_ns_;
+    }
+
+private:
+    Replay(Replay& other);
+    Replay& operator=(Replay& other);
+};
+
+struct EngineReport {
+    const char * name;
+    Histogram histogram;
+    uint64_t wall_ns;
+};
+
+void print_human(FILE * fp, const std::vector<EngineReport *>& reports) {
+    fprintf(fp, "%-10s %10s %10s %10s %10s %10s %10s %10s %10s\n",
+        "engine", "queries", "qps", "mean(us)", "p50", "p95", "p99", "p99.9", "max");
+    for (size_t i = 0; i < reports.size(); i++) {
+        const EngineReport& report = *reports[i];
+        const Histogram& h = report.histogram;
+        fprintf(fp, "%-10s %10lu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+            report.name, (unsigned long)h.count(),
+            h.count() / (report.wall_ns / 1e9),
+            h.mean() / 1e3,
+            h.percentile(50) / 1e3,
+            h.percentile(95) / 1e3,
+            h.percentile(99) / 1e3,
+            h.percentile(99.9) / 1e3,
+            h.max() / 1e3);
+    }
+}
+
+void print_json(FILE * fp, const ReplayOptions& options,
+        const std::vector<EngineReport *>& reports) {
+    fprintf(fp, "{\"concurrency\": %lu, \"target_qps\": %.1f, \"k\": %lu, \"sealed\": %s, "
+        "\"engines\": [", (unsigned long)options.concurrency, options.qps,
+        (unsigned long)options.k, options.seal ? "true" : "false");
+    for (size_t i = 0; i < reports.size(); i++) {
+        const EngineReport& report = *reports[i];
+        const Histogram& h = report.histogram;
+        fprintf(fp, "%s\n  {\"engine\": \"%s\", \"queries\": %lu, \"qps\": %.3f, "
+            "\"latency_us\": {\"mean\": %.3f, \"min\": %.3f, \"p50\": %.3f, \"p90\": %.3f, "
+            "\"p95\": %.3f, \"p99\": %.3f, \"p99.9\": %.3f, \"max\": %.3f}}",
+            i ? "," : "", report.name, (unsigned long)h.count(),
+            h.count() / (report.wall_ns / 1e9),
+            h.mean() / 1e3, h.min() / 1e3,
+            h.percentile(50) / 1e3, h.percentile(90) / 1e3,
+            h.percentile(95) / 1e3, h.percentile(99) / 1e3,
+            h.percentile(99.9) / 1e3, h.max() / 1e3);
+    }
+    fprintf(fp, "\n]}\n");
+}
+
+void usage(const ReplayOptions& defaults) {
+    std::cout << "usage: wand-replay --index=FILE --queries=FILE [--name=value ...]\n"
+        << "  --index=FILE          cap features file\n"
+        << "  --queries=FILE        one query per line, \"feature:weight ...\"\n"
+        << "  --concurrency=" << defaults.concurrency << "\n"
+        << "  --qps=" << defaults.qps << "               target rate, 0 replays back to back\n"
+        << "  --repeat=" << defaults.repeat << "\n"
+        << "  --k=" << defaults.k << "\n"
+        << "  --threshold=" << defaults.threshold << "\n"
+        << "  --seal=" << defaults.seal << "\n"
+        << "  --engines=" << defaults.engines << "   of wand,taat,taat_v1,taat_v2\n"
+        << "  --json=FILE           also write the report in JSON, \"-\" for stdout\n";
+}
+
+bool parse_options(int argc, char ** argv, ReplayOptions * options) {
+    for (int i = 1; i < argc; i++) {
+        const char * arg = argv[i];
+        const char * eq = strchr(arg, '=');
+        if (strncmp(arg, "--", 2) != 0 || !eq) {
+            return false;
+        }
+        std::string name(arg + 2, eq);
+        const char * value = eq + 1;
+        if (name == "index") {
+            options->index = value;
+        } else if (name == "queries") {
+            options->queries = value;
+        } else if (name == "concurrency") {
+            options->concurrency = (size_t)strtoul(value, 0, 10);
+        } else if (name == "qps") {
+            options->qps = atof(value);
+        } else if (name == "repeat") {
+            options->repeat = (size_t)strtoul(value, 0, 10);
+        } else if (name == "k") {
+            options->k = (size_t)strtoul(value, 0, 10);
+        } else if (name == "threshold") {
+            options->threshold = (uint64_t)strtoull(value, 0, 10);
+        } else if (name == "seal") {
+            options->seal = atoi(value) != 0;
+        } else if (name == "engines") {
+            options->engines = value;
+        } else if (name == "json") {
+            options->json = value;
+        } else {
+            return false;
+        }
+    }
+    return !options->index.empty() && !options->queries.empty()
+        && options->concurrency > 0;
+}
+
+}
+
+int main(int argc, char ** argv) {
+    ReplayOptions options;
+    if (!parse_options(argc, argv, &options)) {
+        usage(ReplayOptions());
+        return 1;
+    }
+
+    InvertedIndex ii;
+    uint64_t begin = now_us();
+    int loaded = load_cap_features(&ii, options.index.c_str());
+    if (loaded == -1) {
+        std::cerr << "can't open " << options.index << "\n";
+        return 1;
+    } else if (loaded == -2) {
+        std::cerr << "bad lines in " << options.index << "\n";
+        return 1;
+    }
+    if (options.seal) {
+        ii.seal();
+    }
+    std::vector<TermVector> queries;
+    if (load_queries(options.queries.c_str(), &queries) == -1) {
+        std::cerr << "can't open " << options.queries << "\n";
+        return 1;
+    }
+    if (queries.empty()) {
+        std::cerr << "no query in " << options.queries << "\n";
+        return 1;
+    }
+    // human readable report goes to stderr if JSON goes to stdout
+    FILE * human = options.json == "-" ? stderr : stdout;
+    fprintf(human, "loaded %lu docs and %lu queries in %.3f seconds\n",
+        (unsigned long)ii.doc_count(), (unsigned long)queries.size(),
+        (now_us() - begin) / 1e6);
+    fprintf(human, "concurrency: %lu, target qps: %.1f, repeat: %lu, k: %lu, sealed: %d\n\n",
+        (unsigned long)options.concurrency, options.qps, (unsigned long)options.repeat,
+        (unsigned long)options.k, (int)options.seal);
+
+    Wand wand(ii, options.k, (ScoreType)options.threshold);
+    std::vector<EngineReport *> reports;
+    for (size_t i = 0; i < kEngineCount; i++) {
+        if (!has_engine(options, kEngines[i].name)) {
+            continue;
+        }
+        EngineReport * report = new EngineReport();
+        report->name = kEngines[i].name;
+        Replay replay(wand, kEngines[i], queries, options.repeat, options.qps);
+        report->wall_ns = replay.run(options.concurrency, &report->histogram);
+        reports.push_back(report);
+    }
+
+    print_human(human, reports);
+    if (options.json == "-") {
+        print_json(stdout, options, reports);
+    }
+    if (!options.json.empty() && options.json != "-") {
+        FILE * fp = fopen(options.json.c_str(), "w");
+        if (fp == NULL) {
+            std::cerr << "can't open " << options.json << "\n";
+        } else {
+            print_json(fp, options, reports);
+            fclose(fp);
+        }
+    }
+
+    for (size_t i = 0; i < reports.size(); i++) {
+        delete reports[i];
+    }
+    return 0;
+}
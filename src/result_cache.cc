@@ -0,0 +1,225 @@
+#include "result_cache.h"
+#include "city.h"
+#include "hash_map.h"
+#include <pthread.h>
+#include <list>
+
+struct ResultCacheKeyHash {
+    template <typename Key>
+    size_t operator()(const Key& key) const {
+        return (size_t)key.low;
+    }
+};
+
+template <typename Traits>
+class BasicResultCache<Traits>::Shard {
+private:
+    struct Entry {
+        Key key;
+        uint64_t version;
+        std::vector<DocIdScore> result;
+        size_t bytes;
+    };
+
+    typedef std::list<Entry> EntryListType;
+    typedef typename EntryListType::iterator EntryIterator;
+    typedef HASH_MAP<Key, EntryIterator, ResultCacheKeyHash> HashTableType;
+
+    mutable pthread_mutex_t mutex_;
+    const size_t capacity_;
+    EntryListType lru_;// most recently used at front
+    HashTableType ht_;
+    Stats stats_;
+
+    static size_t entry_bytes(size_t result_size) {
+        // list node + hash node + results
+        return sizeof(Entry) + 2 * sizeof(void *)
+            + sizeof(typename HashTableType::value_type) + 2 * sizeof(void *)
+            + result_size * sizeof(DocIdScore);
+    }
+
+    void erase(EntryIterator it) {
+        stats_.bytes -= (*it).bytes;
+        stats_.entries--;
+        ht_.erase((*it).key);
+        lru_.erase(it);
+    }
+
+public:
+    explicit Shard(size_t capacity) : capacity_(capacity), lru_(), ht_(), stats_() {
+        pthread_mutex_init(&mutex_, 0);
+    }
+
+    ~Shard() {
+        pthread_mutex_destroy(&mutex_);
+    }
+
+    bool find(const Key& key, uint64_t version, std::vector<DocIdScore> * result);
+    void insert(const Key& key, uint64_t version, const std::vector<DocIdScore>& result);
+    void clear();
+    void add_stats(Stats * stats) const;
+};
+
+template <typename Traits>
+bool BasicResultCache<Traits>::Shard::find(const Key& key, uint64_t version,
+        std::vector<DocIdScore> * result) {
+    pthread_mutex_lock(&mutex_);
+    typename HashTableType::iterator it = ht_.find(key);
+    if (it == ht_.end()) {
+        stats_.misses++;
+        pthread_mutex_unlock(&mutex_);
+        return false;
+    }
+
+    EntryIterator entry = (*it).second;
+    if ((*entry).version != version) {
+        // computed on an index that has changed since
+        erase(entry);
+        stats_.invalidations++;
+        stats_.misses++;
+        pthread_mutex_unlock(&mutex_);
+        return false;
+    }
+
+    lru_.splice(lru_.begin(), lru_, entry);
+    result->assign((*entry).result.begin(), (*entry).result.end());
+    stats_.hits++;
+    pthread_mutex_unlock(&mutex_);
+    return true;
+}
+
+template <typename Traits>
+void BasicResultCache<Traits>::Shard::insert(const Key& key, uint64_t version,
+        const std::vector<DocIdScore>& result) {
+    size_t bytes = entry_bytes(result.size());
+    if (bytes > capacity_) {
+        return;
+    }
+
+    pthread_mutex_lock(&mutex_);
+    typename HashTableType::iterator it = ht_.find(key);
+    if (it != ht_.end()) {
+        erase((*it).second);
+    }
+
+    lru_.push_front(Entry());
+    Entry& entry = lru_.front();
+    entry.key = key;
+    entry.version = version;
+    entry.result.assign(result.begin(), result.end());
+    entry.bytes = bytes;
+    ht_[key] = lru_.begin();
+    stats_.insertions++;
+    stats_.entries++;
+    stats_.bytes += bytes;
+
+    while (stats_.bytes > capacity_) {
+        EntryIterator last = lru_.end();
+        --last;
+        erase(last);
+        stats_.evictions++;
+    }
+    pthread_mutex_unlock(&mutex_);
+}
+
+template <typename Traits>
+void BasicResultCache<Traits>::Shard::clear() {
+    pthread_mutex_lock(&mutex_);
+    ht_.clear();
+    lru_.clear();
+    stats_.entries = 0;
+    stats_.bytes = 0;
+    pthread_mutex_unlock(&mutex_);
+}
+
+template <typename Traits>
+void BasicResultCache<Traits>::Shard::add_stats(Stats * stats) const {
+    pthread_mutex_lock(&mutex_);
+    stats->hits += stats_.hits;
+    stats->misses += stats_.misses;
+    stats->insertions += stats_.insertions;
+    stats->evictions += stats_.evictions;
+    stats->invalidations += stats_.invalidations;
+    stats->entries += stats_.entries;
+    stats->bytes += stats_.bytes;
+    pthread_mutex_unlock(&mutex_);
+}
+
+template <typename Traits>
+BasicResultCache<Traits>::BasicResultCache(size_t capacity, size_t shard_count) {
+    if (shard_count == 0) {
+        shard_count = 1;
+    }
+    shard_count_ = shard_count;
+    shards_ = new Shard *[shard_count_];
+    for (size_t i = 0; i < shard_count_; i++) {
+        shards_[i] = new Shard(capacity / shard_count_);
+    }
+}
+
+template <typename Traits>
+BasicResultCache<Traits>::~BasicResultCache() {
+    for (size_t i = 0; i < shard_count_; i++) {
+        delete shards_[i];
+    }
+    delete [] shards_;
+}
+
+template <typename Traits>
+typename BasicResultCache<Traits>::Key BasicResultCache<Traits>::make_key(const TermVector& query, size_t k, ScoreType threshold) {
+    // Canonicalize: 'query' is sorted, drop duplicated term ids(keep the first one),
+    // the same as what DocumentBuilder::build does.
+    std::vector<uint64_t> buf;
+    buf.reserve(query.size() * 2);
+    for (size_t i = 0, s = query.size(); i < s; i++) {
+        if (i > 0 && query[i].id == query[i - 1].id) {
+            continue;
+        }
+        buf.push_back((uint64_t)query[i].id);
+        buf.push_back(weight_bits(query[i].weight));
+    }
+
+    uint128 seed((uint64)k, (uint64)weight_bits(threshold));
+    uint128 hash = CityHash128WithSeed(
+        buf.empty() ? "" : (const char *)&buf[0], buf.size() * sizeof(uint64_t), seed);
+    return Key(Uint128Low64(hash), Uint128High64(hash));
+}
+
+template <typename Traits>
+bool BasicResultCache<Traits>::find(const Key& key, uint64_t version,
+        std::vector<DocIdScore> * result) {
+    return get_shard(key)->find(key, version, result);
+}
+
+template <typename Traits>
+void BasicResultCache<Traits>::insert(const Key& key, uint64_t version,
+        const std::vector<DocIdScore>& result) {
+    get_shard(key)->insert(key, version, result);
+}
+
+template <typename Traits>
+void BasicResultCache<Traits>::clear() {
+    for (size_t i = 0; i < shard_count_; i++) {
+        shards_[i]->clear();
+    }
+}
+
+template <typename Traits>
+typename BasicResultCache<Traits>::Stats BasicResultCache<Traits>::get_stats() const {
+    Stats stats;
+    for (size_t i = 0; i < shard_count_; i++) {
+        shards_[i]->add_stats(&stats);
+    }
+    return stats;
+}
+
+template <typename Traits>
+std::ostream& BasicResultCache<Traits>::Stats::dump(std::ostream& os) const {
+    os << "result cache hits: " << hits << ", misses: " << misses
+        << ", insertions: " << insertions << ", evictions: " << evictions
+        << ", invalidations: " << invalidations << "\n";
+    os << "result cache entries: " << entries << ", bytes: " << bytes << "\n";
+    return os;
+}
+
+WAND_ENGINE_INSTANTIATE(class BasicResultCache)
@@ -0,0 +1,84 @@
+#ifndef WAND_ENGINE_RESULT_CACHE_H
+#define WAND_ENGINE_RESULT_CACHE_H
+
+#include "wand.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// A bounded, lock-sharded LRU cache of Wand::search results.
+//
+// Entries are keyed by a 128-bit hash of the canonicalized query
+// (sorted by term id, duplicated term ids removed), k and threshold,
+// and are tagged with the InvertedIndex::version() they were computed on.
+// An entry whose version differs from the current index version is
+// dropped on lookup.
+template <typename Traits>
+class BasicResultCache {
+public:
+    typedef typename Traits::ScoreType ScoreType;
+    typedef typename BasicDocument<Traits>::TermVector TermVector;
+    typedef typename BasicWand<Traits>::DocIdScore DocIdScore;
+
+    struct Key {
+        uint64_t low;
+        uint64_t high;
+
+        Key() : low(0), high(0) {}
+        Key(uint64_t _low, uint64_t _high) : low(_low), high(_high) {}
+
+        bool operator==(const Key& other) const {
+            return low == other.low && high == other.high;
+        }
+    };
+
+    struct Stats {
+        size_t hits;
+        size_t misses;
+        size_t insertions;
+        size_t evictions;
+        size_t invalidations;// entries dropped because of index version change
+        size_t entries;
+        size_t bytes;
+
+        Stats() : hits(0), misses(0), insertions(0),
+            evictions(0), invalidations(0), entries(0), bytes(0) {}
+
+        std::ostream& dump(std::ostream& os) const;
+
+        friend std::ostream& operator << (std::ostream& os, const Stats& stats) {
+            stats.dump(os);
+            return os;
+        }
+    };
+
+private:
+    class Shard;
+    Shard ** shards_;
+    size_t shard_count_;
+
+    Shard * get_shard(const Key& key) const {
+        return shards_[key.high % shard_count_];
+    }
+
+public:
+    // 'capacity' is the memory budget in bytes, split evenly among shards.
+    explicit BasicResultCache(size_t capacity, size_t shard_count = 16);
+    ~BasicResultCache();
+
+    // 'query' must be sorted by term id in advance.
+    static Key make_key(const TermVector& query, size_t k, ScoreType threshold);
+
+    bool find(const Key& key, uint64_t version, std::vector<DocIdScore> * result);
+    void insert(const Key& key, uint64_t version, const std::vector<DocIdScore>& result);
+    void clear();
+    Stats get_stats() const;
+
+private:
+    BasicResultCache(BasicResultCache& other);
+    BasicResultCache& operator=(BasicResultCache& other);
+};
+
+typedef BasicResultCache<DefaultScoreTraits> ResultCache;
+
+#endif// WAND_ENGINE_RESULT_CACHE_H
@@ -0,0 +1,790 @@
+// Serve searches of a cap features index over a Unix domain socket or local TCP.
+//
+// Clients send SearchRequest frames of protocol.h and get SearchResponse frames back.
+// One thread runs an epoll loop doing all socket I/O: it reads and decodes requests
+// and queues them, or answers OVERLOADED if 'max_queue' requests are waiting already.
+// A dispatcher thread takes up to 'batch_size' queued requests at a time, waiting at
+// most 'batch_wait_us' after the oldest one for a batch to fill, and searches
+// the batch in a QueryExecutor. A request's deadline starts when it is read:
+// requests expired in the queue are answered DEADLINE_EXCEEDED without searching,
+// the others search with the deadline as budget and are answered APPROXIMATE
+// if they run out of it. Responses go back to the I/O thread through an eventfd.
+//
+// The index is held by an IndexHandle: SIGHUP loads the index file again
+// in the background and switches to it between two batches.
+//
+// usage: wand-server --index=FILE (--socket=PATH | --port=N) [--name=value ...],
+// run "wand-server --help" for options. SIGINT or SIGTERM stops it and prints statistics.
+#include "wand.h"
+#include "cap_features.h"
+#include "histogram.h"
+#include "index_handle.h"
+#include "protocol.h"
+#include "query_executor.h"
+#include "timer.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct ServerOptions {
+    std::string index;
+    std::string socket;// Unix domain socket path
+    int port;// TCP port on 127.0.0.1, 0 means none
+    size_t threads;// 0 means one per CPU
+    size_t k;
+    uint64_t threshold;
+    std::string warm_queries;// query log searched on a new index before serving it
+    size_t batch_size;
+    uint64_t batch_wait_us;
+    size_t max_queue;
+    uint64_t timeout_us;// of requests without one, 0 means none
+
+    ServerOptions()
+        : index(), socket(), port(0), threads(0), k(100), threshold(0), warm_queries(),
+        batch_size(32), batch_wait_us(100), max_queue(4096), timeout_us(0) {
+    }
+};
+
+volatile sig_atomic_t g_stop = 0;
+volatile sig_atomic_t g_reload = 0;
+
+void on_signal(int) {
+    g_stop = 1;
+}
+
+void on_reload(int) {
+    g_reload = 1;
+}
+
+bool load_index(InvertedIndex * ii, void * arg) {
+    const ServerOptions * options = (const ServerOptions *)arg;
+    return load_cap_features(ii, options->index.c_str()) == 0;
+}
+
+bool set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags != -1 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1;
+}
+
+int bind_unix(const std::string& path) {
+    struct sockaddr_un addr;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path.c_str());
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    unlink(addr.sun_path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int bind_tcp(int port) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    int on = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == -1
+            || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Return the listening socket, -1 on failure.
+int listen_on(const ServerOptions& options) {
+    int fd = options.socket.empty() ? bind_tcp(options.port) : bind_unix(options.socket);
+    if (fd == -1) {
+        return -1;
+    }
+    if (listen(fd, 128) == -1 || !set_nonblocking(fd)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Server side statistics, all times in nanoseconds.
+struct ServerStats {
+    size_t requests;
+    size_t batches;
+    size_t statuses[RESPONSE_BAD_REQUEST + 1];
+    Histogram queue_time;// read to searched
+    Histogram latency;// read to answered
+
+    ServerStats() : requests(0), batches(0), queue_time(), latency() {
+        memset(statuses, 0, sizeof(statuses));
+    }
+};
+
+class Server {
+private:
+    // epoll data of the listening socket and the eventfd, connections count from kFirstConnection
+    static const uint64_t kListenId = 0;
+    static const uint64_t kWakeId = 1;
+    static const uint64_t kFirstConnection = 2;
+    static const size_t kReadSize = 64 * 1024;
+
+    struct Connection {
+        int fd;
+        uint64_t id;
+        std::vector<char> in;
+        std::vector<char> out;
+        size_t out_sent;
+        size_t in_flight;// requests queued or being searched
+        uint32_t events;// of epoll
+        bool closing;// no more requests, close when all are answered
+    };
+
+    struct Pending {
+        uint64_t connection_id;
+        uint64_t received_us;
+        SearchRequest request;
+    };
+
+    struct Completion {
+        uint64_t connection_id;
+        ResponseStatus status;
+        std::vector<char> frame;
+    };
+
+    const ServerOptions& options_;
+    IndexHandle& handle_;
+    // bound to the current version for every batch
+    QueryExecutor executor_;
+    int listen_fd_;
+    int epoll_fd_;
+    int wake_fd_;
+    uint64_t next_connection_;
+    std::map<uint64_t, Connection *> connections_;
+    bool reloading_;
+
+    // guarded by mutex_
+    pthread_mutex_t mutex_;
+    pthread_cond_t queue_cond_;
+    std::deque<Pending *> queue_;
+    std::vector<Completion *> completions_;
+    bool stopping_;
+    ServerStats stats_;
+
+    pthread_t dispatcher_;
+
+    // Only to construct 'executor_', which is rebound before it searches.
+    static const Wand& current_wand(IndexHandle * handle) {
+        const IndexHandle::Version * version = handle->acquire();
+        const Wand& wand = version->wand();
+        handle->release(version);
+        return wand;
+    }
+
+    static void * dispatcher_main(void * arg) {
+        ((Server *)arg)->dispatch();
+        return 0;
+    }
+
+    void wake_io() {
+        uint64_t one = 1;
+        while (write(wake_fd_, &one, sizeof(one)) == -1 && errno == EINTR) {
+        }
+    }
+
+    void add_completion(uint64_t connection_id, uint64_t request_id, ResponseStatus status,
+            const Wand::DocIdScore * results, size_t count, std::vector<Completion *> * out) {
+        Completion * completion = new Completion();
+        completion->connection_id = connection_id;
+        completion->status = status;
+        SearchResponse::encode(request_id, status, results, count, &completion->frame);
+        out->push_back(completion);
+    }
+
+    // Take the next batch off the queue, false when stopping.
+    bool take_batch(std::vector<Pending *> * batch) {
+        batch->clear();
+        pthread_mutex_lock(&mutex_);
+        while (queue_.empty() && !stopping_) {
+            pthread_cond_wait(&queue_cond_, &mutex_);
+        }
+        if (!stopping_ && queue_.size() < options_.batch_size && options_.batch_wait_us) {
+            uint64_t until = queue_.front()->received_us + options_.batch_wait_us;
+            struct timespec ts;
+            ts.tv_sec = (time_t)(until / 1000000);
+            ts.tv_nsec = (long)(until % 1000000) * 1000;
+            while (!stopping_ && queue_.size() < options_.batch_size && now_us() < until) {
+                pthread_cond_timedwait(&queue_cond_, &mutex_, &ts);
+            }
+        }
+        while (!stopping_ && !queue_.empty() && batch->size() < options_.batch_size) {
+            batch->push_back(queue_.front());
+            queue_.pop_front();
+        }
+        bool running = !stopping_;
+        pthread_mutex_unlock(&mutex_);
+        return running;
+    }
+
+    void dispatch() {
+        std::vector<Pending *> batch;
+        std::vector<Pending *> searched;
+        std::vector<TermVector> queries;
+        std::vector<Wand::SearchOptions> search_options;
+        std::vector<std::vector<Wand::DocIdScore> > results;
+        std::vector<char> complete;
+        std::vector<Completion *> completions;
+        Histogram queue_time;
+
+        while (take_batch(&batch)) {
+            uint64_t now = now_us();
+            searched.clear();
+            queries.clear();
+            search_options.clear();
+            for (size_t i = 0; i < batch.size(); i++) {
+                Pending * pending = batch[i];
+                uint64_t timeout = pending->request.timeout_us
+                    ? pending->request.timeout_us : options_.timeout_us;
+                uint64_t deadline = timeout ? pending->received_us + timeout : 0;
+                if (deadline && now >= deadline) {
+                    add_completion(pending->connection_id, pending->request.request_id,
+                        RESPONSE_DEADLINE_EXCEEDED, 0, 0, &completions);
+                    continue;
+                }
+                queue_time.record((now - pending->received_us) * 1000);
+                searched.push_back(pending);
+                queries.push_back(TermVector());
+                queries.back().swap(pending->request.terms);
+                search_options.push_back(Wand::SearchOptions());
+                search_options.back().deadline_us = deadline;
+            }
+
+            // one version for the whole batch, a swap applies from the next one
+            const IndexHandle::Version * version = handle_.acquire();
+            executor_.rebind(version->wand());
+            executor_.search(queries, &results, search_options, &complete);
+            handle_.release(version);
+
+            for (size_t i = 0; i < searched.size(); i++) {
+                const SearchRequest& request = searched[i]->request;
+                size_t count = results[i].size();
+                if (request.k && request.k < count) {
+                    count = request.k;
+                }
+                add_completion(searched[i]->connection_id, request.request_id,
+                    complete[i] ? RESPONSE_OK : RESPONSE_APPROXIMATE,
+                    count ? &results[i][0] : 0, count, &completions);
+            }
+            now = now_us();
+
+            pthread_mutex_lock(&mutex_);
+            stats_.batches++;
+            stats_.queue_time.merge(queue_time);
+            for (size_t i = 0; i < batch.size(); i++) {
+                stats_.latency.record((now - batch[i]->received_us) * 1000);
+                delete batch[i];
+            }
+            bool wake = completions_.empty();
+            completions_.insert(completions_.end(), completions.begin(), completions.end());
+            pthread_mutex_unlock(&mutex_);
+            completions.clear();
+            queue_time.clear();
+            if (wake) {
+                wake_io();
+            }
+        }
+    }
+
+    // Read until closing, write while there is something to send.
+    void update_events(Connection * connection) {
+        uint32_t events = (connection->closing ? 0 : (uint32_t)EPOLLIN)
+            | (connection->out.empty() ? 0 : (uint32_t)EPOLLOUT);
+        if (connection->events == events) {
+            return;
+        }
+        struct epoll_event event;
+        event.events = events;
+        event.data.u64 = connection->id;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, connection->fd, &event);
+        connection->events = events;
+    }
+
+    void close_connection(Connection * connection) {
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, connection->fd, 0);
+        close(connection->fd);
+        connections_.erase(connection->id);
+        delete connection;
+    }
+
+    // Send what is pending, false if the connection is closed.
+    bool flush(Connection * connection) {
+        std::vector<char>& out = connection->out;
+        while (connection->out_sent < out.size()) {
+            ssize_t n = send(connection->fd, &out[connection->out_sent],
+                out.size() - connection->out_sent, MSG_NOSIGNAL);
+            if (n > 0) {
+                connection->out_sent += n;
+            } else if (n == -1 && errno == EINTR) {
+                continue;
+            } else if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            } else {
+                close_connection(connection);
+                return false;
+            }
+        }
+        if (connection->out_sent == out.size()) {
+            out.clear();
+            connection->out_sent = 0;
+            if (connection->closing && connection->in_flight == 0) {
+                close_connection(connection);
+                return false;
+            }
+        }
+        update_events(connection);
+        return true;
+    }
+
+    void respond(Connection * connection, const SearchRequest& request, ResponseStatus status) {
+        SearchResponse::encode(request.request_id, status, 0, 0, &connection->out);
+        pthread_mutex_lock(&mutex_);
+        stats_.statuses[status]++;
+        pthread_mutex_unlock(&mutex_);
+    }
+
+    // Queue the requests of 'connection->in', or answer them if they can't be.
+    void admit(Connection * connection) {
+        std::vector<char>& in = connection->in;
+        size_t offset = 0;
+        uint64_t now = now_us();
+        while (!connection->closing && offset < in.size()) {
+            Pending * pending = new Pending();
+            long bytes = pending->request.decode(&in[offset], in.size() - offset);
+            if (bytes == 0) {
+                delete pending;
+                break;
+            }
+            if (bytes < 0) {
+                respond(connection, pending->request, RESPONSE_BAD_REQUEST);
+                delete pending;
+                connection->closing = true;
+                break;
+            }
+            offset += bytes;
+            pending->connection_id = connection->id;
+            pending->received_us = now;
+
+            pthread_mutex_lock(&mutex_);
+            stats_.requests++;
+            bool admitted = queue_.size() < options_.max_queue;
+            if (admitted) {
+                queue_.push_back(pending);
+                pthread_cond_signal(&queue_cond_);
+            }
+            pthread_mutex_unlock(&mutex_);
+            if (admitted) {
+                connection->in_flight++;
+            } else {
+                respond(connection, pending->request, RESPONSE_OVERLOADED);
+                delete pending;
+            }
+        }
+        in.erase(in.begin(), in.begin() + offset);
+    }
+
+    // Read all there is, false if the connection is closed.
+    bool receive(Connection * connection) {
+        char buffer[kReadSize];
+        for (;;) {
+            ssize_t n = recv(connection->fd, buffer, sizeof(buffer), 0);
+            if (n > 0) {
+                if (!connection->closing) {
+                    connection->in.insert(connection->in.end(), buffer, buffer + n);
+                }
+                continue;
+            }
+            if (n == -1 && errno == EINTR) {
+                continue;
+            }
+            if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            }
+            if (n == -1) {
+                close_connection(connection);
+                return false;
+            }
+            // end of stream, requests read so far are still answered
+            admit(connection);
+            connection->closing = true;
+            return flush(connection);
+        }
+        admit(connection);
+        return flush(connection);
+    }
+
+    void accept_all() {
+        for (;;) {
+            int fd = accept(listen_fd_, 0, 0);
+            if (fd == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                break;
+            }
+            int on = 1;
+            // fails on Unix domain sockets, which don't need it
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            Connection * connection = new Connection();
+            connection->fd = fd;
+            connection->id = next_connection_++;
+            connection->out_sent = 0;
+            connection->in_flight = 0;
+            connection->events = EPOLLIN;
+            connection->closing = false;
+            struct epoll_event event;
+            event.events = EPOLLIN;
+            event.data.u64 = connection->id;
+            if (!set_nonblocking(fd) || epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) == -1) {
+                close(fd);
+                delete connection;
+                continue;
+            }
+            connections_[connection->id] = connection;
+        }
+    }
+
+    void deliver_completions() {
+        uint64_t count;
+        while (read(wake_fd_, &count, sizeof(count)) == -1 && errno == EINTR) {
+        }
+        std::vector<Completion *> completions;
+        pthread_mutex_lock(&mutex_);
+        completions.swap(completions_);
+        for (size_t i = 0; i < completions.size(); i++) {
+            stats_.statuses[completions[i]->status]++;
+        }
+        pthread_mutex_unlock(&mutex_);
+
+        std::vector<Connection *> touched;
+        for (size_t i = 0; i < completions.size(); i++) {
+            Completion * completion = completions[i];
+            std::map<uint64_t, Connection *>::iterator it =
+                connections_.find(completion->connection_id);
+            // dropped if the connection is gone
+            if (it != connections_.end()) {
+                Connection * connection = it->second;
+                connection->out.insert(connection->out.end(),
+                    completion->frame.begin(), completion->frame.end());
+                connection->in_flight--;
+                touched.push_back(connection);
+            }
+            delete completion;
+        }
+        std::sort(touched.begin(), touched.end());
+        touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+        for (size_t i = 0; i < touched.size(); i++) {
+            flush(touched[i]);
+        }
+    }
+
+    void reload() {
+        if (handle_.load_async(load_index, (void *)&options_)) {
+            printf("reloading %s\n", options_.index.c_str());
+            reloading_ = true;
+        } else {
+            printf("a reload is running already\n");
+        }
+        fflush(stdout);
+    }
+
+    void finish_reload() {
+        reloading_ = false;
+        if (!handle_.wait_load()) {
+            printf("can't load %s, the index is unchanged\n", options_.index.c_str());
+        } else {
+            const IndexHandle::Version * version = handle_.acquire();
+            printf("serving version %lu, %lu docs\n", (unsigned long)version->number(),
+                (unsigned long)version->index().doc_count());
+            handle_.release(version);
+        }
+        fflush(stdout);
+    }
+
+public:
+    // 'handle' must have a version.
+    Server(const ServerOptions& options, IndexHandle * handle)
+        : options_(options), handle_(*handle),
+        executor_(current_wand(handle), options.threads),
+        listen_fd_(-1), epoll_fd_(-1), wake_fd_(-1),
+        next_connection_(kFirstConnection), connections_(), reloading_(false),
+        queue_(), completions_(), stopping_(false), stats_() {
+        pthread_mutex_init(&mutex_, 0);
+        // deadlines of pthread_cond_timedwait are in the clock of now_us
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&queue_cond_, &attr);
+        pthread_condattr_destroy(&attr);
+    }
+
+    ~Server() {
+        for (std::map<uint64_t, Connection *>::iterator it = connections_.begin();
+                it != connections_.end(); ++it) {
+            close(it->second->fd);
+            delete it->second;
+        }
+        for (size_t i = 0; i < queue_.size(); i++) {
+            delete queue_[i];
+        }
+        for (size_t i = 0; i < completions_.size(); i++) {
+            delete completions_[i];
+        }
+        if (listen_fd_ != -1) {
+            close(listen_fd_);
+        }
+        if (epoll_fd_ != -1) {
+            close(epoll_fd_);
+        }
+        if (wake_fd_ != -1) {
+            close(wake_fd_);
+        }
+        pthread_cond_destroy(&queue_cond_);
+        pthread_mutex_destroy(&mutex_);
+    }
+
+    // Return -1 if it can't listen.
+    int run() {
+        listen_fd_ = listen_on(options_);
+        epoll_fd_ = epoll_create(64);
+        wake_fd_ = eventfd(0, EFD_NONBLOCK);
+        if (listen_fd_ == -1 || epoll_fd_ == -1 || wake_fd_ == -1) {
+            return -1;
+        }
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.u64 = kListenId;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &event);
+        event.data.u64 = kWakeId;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &event);
+        if (pthread_create(&dispatcher_, 0, dispatcher_main, this) != 0) {
+            return -1;
+        }
+
+        struct epoll_event events[64];
+        while (!g_stop) {
+            // the timeout notices a signal delivered to another thread
+            int n = epoll_wait(epoll_fd_, events, 64, 100);
+            for (int i = 0; i < n; i++) {
+                uint64_t id = events[i].data.u64;
+                if (id == kListenId) {
+                    accept_all();
+                } else if (id == kWakeId) {
+                    deliver_completions();
+                } else {
+                    std::map<uint64_t, Connection *>::iterator it = connections_.find(id);
+                    if (it == connections_.end()) {
+                        continue;
+                    }
+                    Connection * connection = it->second;
+                    if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+                        // nothing can be sent anymore
+                        close_connection(connection);
+                    } else if ((events[i].events & EPOLLIN) && !receive(connection)) {
+                        continue;
+                    } else if (events[i].events & EPOLLOUT) {
+                        flush(connection);
+                    }
+                }
+            }
+            if (g_reload) {
+                g_reload = 0;
+                reload();
+            }
+            if (reloading_ && !handle_.loading()) {
+                finish_reload();
+            }
+        }
+
+        pthread_mutex_lock(&mutex_);
+        stopping_ = true;
+        pthread_cond_broadcast(&queue_cond_);
+        pthread_mutex_unlock(&mutex_);
+        pthread_join(dispatcher_, 0);
+        if (!options_.socket.empty()) {
+            unlink(options_.socket.c_str());
+        }
+        return 0;
+    }
+
+    size_t thread_count() const {
+        return executor_.thread_count();
+    }
+
+    const ServerStats& stats() const {
+        return stats_;
+    }
+
+private:
+    Server(Server& other);
+    Server& operator=(Server& other);
+};
+
+void print_stats(const ServerStats& stats) {
+    printf("requests: %lu, batches: %lu, mean batch size: %.2f\n",
+        (unsigned long)stats.requests, (unsigned long)stats.batches,
+        stats.batches ? (double)stats.latency.count() / stats.batches : 0.0);
+    for (int i = 0; i <= RESPONSE_BAD_REQUEST; i++) {
+        printf("%s%s: %lu", i ? ", " : "", get_status_name(i), (unsigned long)stats.statuses[i]);
+    }
+    printf("\n%-10s %10s %10s %10s %10s %10s %10s\n",
+        "us", "mean", "p50", "p95", "p99", "p99.9", "max");
+    const Histogram * histograms[] = {&stats.queue_time, &stats.latency};
+    const char * names[] = {"queued", "answered"};
+    for (size_t i = 0; i < 2; i++) {
+        const Histogram& h = *histograms[i];
+        printf("%-10s %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n", names[i],
+            h.mean() / 1e3, h.percentile(50) / 1e3, h.percentile(95) / 1e3,
+            h.percentile(99) / 1e3, h.percentile(99.9) / 1e3, h.max() / 1e3);
+    }
+}
+
+void usage(const ServerOptions& defaults) {
+    std::cout << "usage: wand-server --index=FILE (--socket=PATH | --port=N) [--name=value ...]\n"
+        << "  --index=FILE          cap features file\n"
+        << "  --socket=PATH         listen on a Unix domain socket\n"
+        << "  --port=N              listen on 127.0.0.1:N\n"
+        << "  --threads=" << defaults.threads << "           search threads, 0 for one per CPU\n"
+        << "  --k=" << defaults.k << "               most results of a request\n"
+        << "  --threshold=" << defaults.threshold << "\n"
+        << "  --warm-queries=FILE   query log searched on a new index before serving it\n"
+        << "  --batch-size=" << defaults.batch_size << "       requests searched together\n"
+        << "  --batch-wait-us=" << defaults.batch_wait_us
+        << "   longest wait for a batch to fill\n"
+        << "  --max-queue=" << defaults.max_queue << "      more waiting requests are rejected\n"
+        << "  --timeout-us=" << defaults.timeout_us
+        << "        of requests without one, 0 means none\n";
+}
+
+bool parse_options(int argc, char ** argv, ServerOptions * options) {
+    for (int i = 1; i < argc; i++) {
+        const char * arg = argv[i];
+        const char * eq = strchr(arg, '=');
+        if (strncmp(arg, "--", 2) != 0 || !eq) {
+            return false;
+        }
+        std::string name(arg + 2, eq);
+        const char * value = eq + 1;
+        if (name == "index") {
+            options->index = value;
+        } else if (name == "socket") {
+            options->socket = value;
+        } else if (name == "port") {
+            options->port = atoi(value);
+        } else if (name == "threads") {
+            options->threads = (size_t)strtoul(value, 0, 10);
+        } else if (name == "k") {
+            options->k = (size_t)strtoul(value, 0, 10);
+        } else if (name == "threshold") {
+            options->threshold = (uint64_t)strtoull(value, 0, 10);
+        } else if (name == "warm-queries") {
+            options->warm_queries = value;
+        } else if (name == "batch-size") {
+            options->batch_size = (size_t)strtoul(value, 0, 10);
+        } else if (name == "batch-wait-us") {
+            options->batch_wait_us = (uint64_t)strtoull(value, 0, 10);
+        } else if (name == "max-queue") {
+            options->max_queue = (size_t)strtoul(value, 0, 10);
+        } else if (name == "timeout-us") {
+            options->timeout_us = (uint64_t)strtoull(value, 0, 10);
+        } else {
+            return false;
+        }
+    }
+    return !options->index.empty() && (!options->socket.empty() != (options->port > 0))
+        && options->batch_size > 0;
+}
+
+}
+
+int main(int argc, char ** argv) {
+    ServerOptions options;
+    if (!parse_options(argc, argv, &options)) {
+        usage(ServerOptions());
+        return 1;
+    }
+
+    IndexHandle handle(options.k, (ScoreType)options.threshold);
+    if (!options.warm_queries.empty()) {
+        std::vector<TermVector> queries;
+        if (load_queries(options.warm_queries.c_str(), &queries) == -1) {
+            std::cerr << "can't open " << options.warm_queries << "\n";
+            return 1;
+        }
+        handle.set_warm_queries(queries);
+    }
+    uint64_t begin = now_us();
+    if (!handle.load(load_index, &options)) {
+        std::cerr << "can't load " << options.index << "\n";
+        return 1;
+    }
+    const IndexHandle::Version * version = handle.acquire();
+    printf("loaded %lu docs in %.3f seconds\n", (unsigned long)version->index().doc_count(),
+        (now_us() - begin) / 1e6);
+    handle.release(version);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_signal;
+    sigaction(SIGINT, &action, 0);
+    sigaction(SIGTERM, &action, 0);
+    action.sa_handler = on_reload;
+    sigaction(SIGHUP, &action, 0);
+    signal(SIGPIPE, SIG_IGN);
+
+    Server server(options, &handle);
+    if (options.socket.empty()) {
+        printf("serving on 127.0.0.1:%d", options.port);
+    } else {
+        printf("serving on %s", options.socket.c_str());
+    }
+    printf(", %lu threads, batch size: %lu, batch wait: %luus\n",
+        (unsigned long)server.thread_count(),
+        (unsigned long)options.batch_size, (unsigned long)options.batch_wait_us);
+    fflush(stdout);
+    if (server.run() == -1) {
+        std::cerr << "can't listen: " << strerror(errno) << "\n";
+        return 1;
+    }
+    print_stats(server.stats());
+    return 0;
+}
@@ -0,0 +1,165 @@
+#include "sharded_index.h"
+#include "numa.h"
+#include <pthread.h>
+#include <algorithm>
+
+namespace {
+
+size_t shard_of(IdType doc_id, size_t shard_count) {
+    // Fibonacci hashing, so consecutive ids spread over shards
+    return (size_t)((doc_id * 0x9e3779b97f4a7c15ULL) >> 32) % shard_count;
+}
+
+}
+
+template <typename Traits>
+BasicShardedIndex<Traits>::BasicShardedIndex(size_t shard_count, Placement placement)
+    : shards_(), placement_(placement) {
+    std::vector<int> nodes;
+    Numa::get_nodes(&nodes);
+    if (shard_count == 0) {
+        shard_count = nodes.size();
+    }
+    for (size_t i = 0; i < shard_count; i++) {
+        Shard * shard = new Shard();
+        shard->node = nodes[i % nodes.size()];
+        Numa::get_node_cpus(shard->node, &shard->cpus);
+        shards_.push_back(shard);
+    }
+}
+
+template <typename Traits>
+BasicShardedIndex<Traits>::~BasicShardedIndex() {
+    for (size_t i = 0; i < shards_.size(); i++) {
+        delete shards_[i];
+    }
+}
+
+template <typename Traits>
+void BasicShardedIndex<Traits>::insert(Document * doc) {
+    shards_[shard_of(doc->id, shards_.size())]->index.insert(doc);
+}
+
+template <typename Traits>
+void BasicShardedIndex<Traits>::clear() {
+    for (size_t i = 0; i < shards_.size(); i++) {
+        shards_[i]->index.clear();
+    }
+}
+
+template <typename Traits>
+size_t BasicShardedIndex<Traits>::doc_count() const {
+    size_t count = 0;
+    for (size_t i = 0; i < shards_.size(); i++) {
+        count += shards_[i]->index.doc_count();
+    }
+    return count;
+}
+
+template <typename Traits>
+void * BasicShardedIndex<Traits>::seal_main(void * arg) {
+    SealTask * task = (SealTask *)arg;
+    Numa::pin_current_thread(task->shard->cpus);
+    task->shard->index.seal(task->huge_pages, task->numa_node);
+    return 0;
+}
+
+template <typename Traits>
+void BasicShardedIndex<Traits>::seal(bool huge_pages) {
+    std::vector<SealTask> tasks(shards_.size());
+    std::vector<pthread_t> threads(shards_.size());
+    std::vector<bool> started(shards_.size(), false);
+    for (size_t i = 0; i < shards_.size(); i++) {
+        tasks[i].shard = shards_[i];
+        tasks[i].huge_pages = huge_pages;
+        tasks[i].numa_node = placement_ == PLACE_LOCAL ? shards_[i]->node : Numa::kInterleave;
+        started[i] = pthread_create(&threads[i], 0, seal_main, &tasks[i]) == 0;
+    }
+    for (size_t i = 0; i < shards_.size(); i++) {
+        if (started[i]) {
+            pthread_join(threads[i], 0);
+        } else {
+            // no thread, seal unpinned in the calling thread, mbind still places it
+            shards_[i]->index.seal(huge_pages, tasks[i].numa_node);
+        }
+    }
+}
+
+template <typename Traits>
+bool BasicShardedIndex<Traits>::sealed() const {
+    for (size_t i = 0; i < shards_.size(); i++) {
+        if (!shards_[i]->index.sealed()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <typename Traits>
+void BasicShardedIndex<Traits>::memory_usage(IndexMemoryUsage * usage) const {
+    usage->clear();
+    for (size_t i = 0; i < shards_.size(); i++) {
+        IndexMemoryUsage shard;
+        shards_[i]->index.memory_usage(&shard);
+        usage->dictionary += shard.dictionary;
+        usage->posting_nodes += shard.posting_nodes;
+        usage->posting_arrays += shard.posting_arrays;
+        usage->skip_data += shard.skip_data;
+        usage->documents += shard.documents;
+        usage->term_vectors += shard.term_vectors;
+        usage->attributes += shard.attributes;
+        usage->slack += shard.slack;
+        usage->huge_pages += shard.huge_pages;
+        usage->numa_bound += shard.numa_bound;
+    }
+}
+
+template <typename Traits>
+BasicShardedSearcher<Traits>::BasicShardedSearcher(const ShardedIndex& index,
+        size_t heap_size, ScoreType threshold, size_t threads_per_shard)
+    : shards_(), heap_size_(heap_size) {
+    for (size_t i = 0; i < index.shard_count(); i++) {
+        Shard * shard = new Shard();
+        shard->wand = new Wand(index.shard(i), heap_size, threshold);
+        shard->executor = new QueryExecutor(*shard->wand, threads_per_shard, &index.cpus(i));
+        shards_.push_back(shard);
+    }
+}
+
+template <typename Traits>
+BasicShardedSearcher<Traits>::~BasicShardedSearcher() {
+    for (size_t i = 0; i < shards_.size(); i++) {
+        delete shards_[i]->executor;
+        delete shards_[i]->wand;
+        delete shards_[i];
+    }
+}
+
+template <typename Traits>
+void BasicShardedSearcher<Traits>::search(const std::vector<TermVector>& queries,
+        std::vector<std::vector<DocIdScore> > * results,
+        const SearchOptions * options) {
+    for (size_t i = 0; i < shards_.size(); i++) {
+        shards_[i]->executor->start(queries, &shards_[i]->results, options);
+    }
+    for (size_t i = 0; i < shards_.size(); i++) {
+        shards_[i]->executor->wait();
+    }
+
+    results->resize(queries.size());
+    for (size_t q = 0; q < queries.size(); q++) {
+        std::vector<DocIdScore>& result = (*results)[q];
+        result.clear();
+        for (size_t i = 0; i < shards_.size(); i++) {
+            const std::vector<DocIdScore>& shard_result = shards_[i]->results[q];
+            result.insert(result.end(), shard_result.begin(), shard_result.end());
+        }
+        std::sort(result.begin(), result.end(), typename Wand::DocIdScore_ScoreGreat());
+        if (result.size() > heap_size_) {
+            result.resize(heap_size_);
+        }
+    }
+}
+
+WAND_ENGINE_INSTANTIATE(class BasicShardedIndex)
+WAND_ENGINE_INSTANTIATE(class BasicShardedSearcher)
@@ -0,0 +1,143 @@
+#ifndef WAND_ENGINE_SHARDED_INDEX_H
+#define WAND_ENGINE_SHARDED_INDEX_H
+
+#include "index.h"
+#include "query_executor.h"
+#include "wand.h"
+#include <vector>
+
+// An InvertedIndex split by doc id into shards, each one assigned to a NUMA node.
+//
+// seal builds the posting arrays and dictionary of a shard from a thread pinned
+// to its node into an arena bound to the node(PLACE_LOCAL), or interleaved over
+// all nodes(PLACE_INTERLEAVE) as a baseline. Documents and linked lists stay
+// where insert allocated them. On a single node machine it works as usual,
+// with every shard on node 0.
+template <typename Traits>
+class BasicShardedIndex {
+public:
+    typedef BasicDocument<Traits> Document;
+    typedef BasicInvertedIndex<Traits> InvertedIndex;
+
+    enum Placement {
+        PLACE_LOCAL,
+        PLACE_INTERLEAVE
+    };
+
+private:
+    struct Shard {
+        InvertedIndex index;
+        int node;
+        std::vector<int> cpus;// of 'node'
+    };
+
+    struct SealTask {
+        Shard * shard;
+        bool huge_pages;
+        int numa_node;
+    };
+
+    std::vector<Shard *> shards_;
+    const Placement placement_;
+
+    static void * seal_main(void * arg);
+
+public:
+    // 'shard_count' 0 means one shard per NUMA node,
+    // otherwise shards are assigned to nodes round robin.
+    explicit BasicShardedIndex(size_t shard_count = 0, Placement placement = PLACE_LOCAL);
+    ~BasicShardedIndex();
+
+    // callers can't use "doc" any more, it goes to the shard of "doc->id".
+    void insert(Document * doc);
+    void clear();
+    size_t doc_count() const;
+    // Seal all shards concurrently, see the class comment.
+    void seal(bool huge_pages = true);
+    bool sealed() const;
+
+    size_t shard_count() const {
+        return shards_.size();
+    }
+
+    const InvertedIndex& shard(size_t i) const {
+        return shards_[i]->index;
+    }
+
+    int node(size_t i) const {
+        return shards_[i]->node;
+    }
+
+    const std::vector<int>& cpus(size_t i) const {
+        return shards_[i]->cpus;
+    }
+
+    Placement placement() const {
+        return placement_;
+    }
+
+    void memory_usage(IndexMemoryUsage * usage) const;
+
+private:
+    BasicShardedIndex(BasicShardedIndex& other);
+    BasicShardedIndex& operator=(BasicShardedIndex& other);
+};
+
+// Search a ShardedIndex with one Wand and one QueryExecutor per shard.
+//
+// A query is sent to every shard and searched there by threads pinned to the
+// node of the shard, so the traversal only reads memory of its own node.
+// The top k of all shards are merged into the top k of the index.
+// A threshold or budget in SearchOptions applies to each shard on its own.
+template <typename Traits>
+class BasicShardedSearcher {
+public:
+    typedef BasicShardedIndex<Traits> ShardedIndex;
+    typedef BasicWand<Traits> Wand;
+    typedef BasicQueryExecutor<Traits> QueryExecutor;
+    typedef typename Traits::ScoreType ScoreType;
+    typedef typename BasicDocument<Traits>::TermVector TermVector;
+    typedef typename Wand::DocIdScore DocIdScore;
+    typedef typename Wand::SearchOptions SearchOptions;
+
+private:
+    struct Shard {
+        Wand * wand;
+        QueryExecutor * executor;
+        std::vector<std::vector<DocIdScore> > results;
+    };
+
+    std::vector<Shard *> shards_;
+    const size_t heap_size_;
+
+public:
+    // The index must be sealed and outlive this.
+    // 'threads_per_shard' 0 means one thread per CPU of the node of the shard.
+    BasicShardedSearcher(const ShardedIndex& index, size_t heap_size = 1000,
+            ScoreType threshold = 0, size_t threads_per_shard = 0);
+    ~BasicShardedSearcher();
+
+    // Like QueryExecutor::search, (*results)[i] is the result of queries[i].
+    // Only one thread may call it at a time.
+    void search(const std::vector<TermVector>& queries,
+            std::vector<std::vector<DocIdScore> > * results,
+            const SearchOptions * options = 0);
+
+    // to tune each shard, e.g. set_prefetch_distance
+    Wand& wand(size_t i) {
+        return *shards_[i]->wand;
+    }
+
+    size_t shard_count() const {
+        return shards_.size();
+    }
+
+private:
+    BasicShardedSearcher(BasicShardedSearcher& other);
+    BasicShardedSearcher& operator=(BasicShardedSearcher& other);
+};
+
+typedef BasicShardedIndex<DefaultScoreTraits> ShardedIndex;
+typedef BasicShardedSearcher<DefaultScoreTraits> ShardedSearcher;
+
+#endif// WAND_ENGINE_SHARDED_INDEX_H
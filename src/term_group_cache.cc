@@ -0,0 +1,342 @@
+#include "term_group_cache.h"
+#include "city.h"
+#include "hash_map.h"
+#include <algorithm>
+#include <limits>
+#include <utility>
+
+namespace {
+
+const size_t kMaxGroupSize = 16;
+
+// two terms with co-occurrence signatures differing in at most this many bits
+// (of the last 64 observed queries) can be put in one group
+const int kMaxSignatureDistance = 4;
+
+struct TermKeyHash {
+    template <typename TermKey>
+    size_t operator()(const TermKey& key) const {
+        return (size_t)(key.first ^ (weight_bits(key.second) * 0x9ddfea08eb382d69ULL));
+    }
+};
+
+template <typename WeightType>
+struct Candidate {
+    IdType id;
+    WeightType weight;
+    size_t count;
+    uint64_t signature;
+};
+
+struct Candidate_CountGreat {
+    template <typename CandidateType>
+    bool operator()(const CandidateType& a, const CandidateType& b) const {
+        if (a.count != b.count) {
+            return a.count > b.count;
+        }
+        return a.id < b.id;
+    }
+};
+
+}
+
+template <typename Traits>
+class BasicTermGroupCache<Traits>::Observer {
+private:
+    typedef typename Traits::WeightType WeightType;
+    typedef std::pair<IdType, WeightType> TermKey;
+
+    struct TermStat {
+        size_t count;
+        uint64_t signature;// bit i: seen in the i-th latest query
+        uint64_t last_seen;
+    };
+
+    typedef HASH_MAP<TermKey, TermStat, TermKeyHash> HashTableType;
+    HashTableType ht_;
+    uint64_t queries_;
+    TermVector sorted_;
+
+    uint64_t get_signature(const TermStat& stat) const {
+        uint64_t shift = queries_ - stat.last_seen;
+        return shift >= 64 ? 0 : stat.signature << shift;
+    }
+
+public:
+    Observer() : ht_(), queries_(0), sorted_() {}
+
+    void observe(const TermVector& query);
+    void get_candidates(size_t min_count,
+            std::vector<Candidate<WeightType> > * candidates) const;
+
+    uint64_t queries() const {
+        return queries_;
+    }
+
+    void clear() {
+        ht_.clear();
+        queries_ = 0;
+    }
+};
+
+template <typename Traits>
+void BasicTermGroupCache<Traits>::Observer::observe(const TermVector& query) {
+    queries_++;
+    sorted_.assign(query.begin(), query.end());
+    std::sort(sorted_.begin(), sorted_.end(), TermLess());
+    for (size_t i = 0, s = sorted_.size(); i < s; i++) {
+        if (i > 0 && sorted_[i].id == sorted_[i - 1].id) {
+            continue;
+        }
+        TermKey key(sorted_[i].id, sorted_[i].weight);
+        typename HashTableType::iterator it = ht_.find(key);
+        if (it == ht_.end()) {
+            TermStat stat;
+            stat.count = 1;
+            stat.signature = 1;
+            stat.last_seen = queries_;
+            ht_.insert(std::make_pair(key, stat));
+        } else {
+            TermStat& stat = (*it).second;
+            stat.count++;
+            stat.signature = get_signature(stat) | 1;
+            stat.last_seen = queries_;
+        }
+    }
+}
+
+template <typename Traits>
+void BasicTermGroupCache<Traits>::Observer::get_candidates(size_t min_count,
+        std::vector<Candidate<WeightType> > * candidates) const {
+    typename HashTableType::const_iterator it = ht_.begin();
+    typename HashTableType::const_iterator last = ht_.end();
+    for (; it != last; ++it) {
+        const TermStat& stat = (*it).second;
+        if (stat.count < min_count) {
+            continue;
+        }
+        Candidate<WeightType> candidate;
+        candidate.id = (*it).first.first;
+        candidate.weight = (*it).first.second;
+        candidate.count = stat.count;
+        candidate.signature = get_signature(stat);
+        candidates->push_back(candidate);
+    }
+    std::sort(candidates->begin(), candidates->end(), Candidate_CountGreat());
+}
+
+// Return 0 if a bound overflows WeightType.
+template <typename Traits>
+static BasicPostingList<Traits> * merge_posting_lists(const BasicInvertedIndex<Traits>& ii,
+        const typename BasicDocument<Traits>::TermVector& terms) {
+    typedef typename Traits::WeightType WeightType;
+    typedef typename Traits::ScoreType ScoreType;
+    typedef BasicDocument<Traits> Document;
+    typedef BasicPostingListNode<Traits> PostingListNode;
+    typedef BasicPostingList<Traits> PostingList;
+
+    std::vector<PostingListNode *> current;
+    for (size_t i = 0, s = terms.size(); i < s; i++) {
+        current.push_back(ii.find(terms[i].id)->front());
+    }
+
+    PostingList * merged = new PostingList();
+    for (;;) {
+        IdType doc_id = (IdType)-1;
+        Document * doc = 0;
+        for (size_t i = 0, s = current.size(); i < s; i++) {
+            if (current[i]->doc->id < doc_id) {
+                doc_id = current[i]->doc->id;
+                doc = current[i]->doc;
+            }
+        }
+        if (Document::is_sentinel(doc_id)) {
+            break;
+        }
+
+        ScoreType bound = 0;
+        for (size_t i = 0, s = current.size(); i < s; i++) {
+            if (current[i]->doc->id == doc_id) {
+                bound += (ScoreType)terms[i].weight * current[i]->bound;
+                current[i] = current[i]->next;
+            }
+        }
+        if (bound > (ScoreType)std::numeric_limits<WeightType>::max()) {
+            delete merged;
+            return 0;
+        }
+
+        PostingListNode * node = PostingListNode::get_node();
+        node->doc = doc;
+        doc->add_ref();
+        node->bound = (WeightType)bound;
+        // doc ids are increasing, so it is always put at the back
+        merged->insert(node);
+    }
+    return merged;
+}
+
+template <typename Traits>
+BasicTermGroupCache<Traits>::BasicTermGroupCache(size_t max_group_size, size_t max_postings, double min_frequency)
+    : observer_(new Observer()), groups_(),
+    max_group_size_(std::min(max_group_size, kMaxGroupSize)), max_postings_(max_postings),
+    min_frequency_(min_frequency), index_version_(0), postings_(0) {
+}
+
+template <typename Traits>
+BasicTermGroupCache<Traits>::~BasicTermGroupCache() {
+    clear();
+    delete observer_;
+}
+
+template <typename Traits>
+void BasicTermGroupCache<Traits>::observe(const TermVector& query) {
+    observer_->observe(query);
+}
+
+template <typename Traits>
+void BasicTermGroupCache<Traits>::clear_groups() {
+    for (size_t i = 0, s = groups_.size(); i < s; i++) {
+        delete groups_[i]->posting_list;
+        delete groups_[i];
+    }
+    groups_.clear();
+    postings_ = 0;
+    index_version_ = 0;
+}
+
+template <typename Traits>
+void BasicTermGroupCache<Traits>::rebuild(const InvertedIndex& ii) {
+    clear_groups();
+    index_version_ = ii.version();
+
+    size_t min_count = (size_t)(min_frequency_ * observer_->queries());
+    if (min_count < 2) {
+        min_count = 2;
+    }
+    std::vector<Candidate<typename Traits::WeightType> > candidates;
+    observer_->get_candidates(min_count, &candidates);
+
+    // Greedily group the most frequent terms with those that
+    // appeared in (almost) the same recent queries.
+    std::vector<char> assigned(candidates.size(), 0);
+    for (size_t i = 0, s = candidates.size(); i < s; i++) {
+        if (assigned[i] || !ii.find(candidates[i].id)) {
+            continue;
+        }
+
+        std::vector<size_t> members(1, i);
+        size_t max_size = ii.find(candidates[i].id)->size();
+        for (size_t j = i + 1; j < s && members.size() < max_group_size_; j++) {
+            if (assigned[j] || !ii.find(candidates[j].id)) {
+                continue;
+            }
+            if (popcount64(candidates[i].signature ^ candidates[j].signature)
+                    > kMaxSignatureDistance) {
+                continue;
+            }
+            bool duplicated = false;
+            for (size_t m = 0; m < members.size(); m++) {
+                if (candidates[members[m]].id == candidates[j].id) {
+                    duplicated = true;
+                    break;
+                }
+            }
+            if (!duplicated) {
+                members.push_back(j);
+                max_size += ii.find(candidates[j].id)->size();
+            }
+        }
+
+        if (members.size() < 2 || postings_ + max_size > max_postings_) {
+            continue;
+        }
+
+        Group * group = new Group();
+        for (size_t m = 0; m < members.size(); m++) {
+            const Candidate<typename Traits::WeightType>& candidate = candidates[members[m]];
+            group->terms.push_back(Term(candidate.id, candidate.weight));
+        }
+        std::sort(group->terms.begin(), group->terms.end(), TermLess());
+        group->posting_list = merge_posting_lists(ii, group->terms);
+        if (!group->posting_list) {
+            delete group;
+            continue;
+        }
+        // usable whether or not the index is sealed
+        group->posting_list->seal();
+        for (size_t m = 0; m < members.size(); m++) {
+            assigned[members[m]] = 1;
+        }
+
+        // hash ids and weights only, terms may have padding
+        std::vector<uint64_t> buf;
+        for (size_t m = 0; m < group->terms.size(); m++) {
+            buf.push_back((uint64_t)group->terms[m].id);
+            buf.push_back(weight_bits(group->terms[m].weight));
+        }
+        group->group_id = (IdType)CityHash64(
+            (const char *)&buf[0], buf.size() * sizeof(uint64_t));
+        postings_ += group->posting_list->size();
+        groups_.push_back(group);
+    }
+}
+
+template <typename Traits>
+void BasicTermGroupCache<Traits>::clear() {
+    clear_groups();
+    observer_->clear();
+}
+
+template <typename Traits>
+size_t BasicTermGroupCache<Traits>::match(const TermVector& query,
+        std::vector<const Group *> * groups, std::vector<char> * covered) const {
+    size_t matched = 0;
+    size_t member_index[kMaxGroupSize];
+    for (size_t g = 0, gs = groups_.size(); g < gs; g++) {
+        const Group * group = groups_[g];
+        size_t m = 0, ms = group->terms.size();
+        for (; m < ms; m++) {
+            const Term& term = group->terms[m];
+            typename TermVector::const_iterator it =
+                std::lower_bound(query.begin(), query.end(), term.id, TermLess());
+            if (it == query.end() || (*it).id != term.id || (*it).weight != term.weight) {
+                break;
+            }
+            member_index[m] = it - query.begin();
+        }
+        if (m != ms) {
+            continue;
+        }
+
+        for (m = 0; m < ms; m++) {
+            (*covered)[member_index[m]] = 1;
+        }
+        groups->push_back(group);
+        matched++;
+    }
+    return matched;
+}
+
+template <typename Traits>
+std::ostream& BasicTermGroupCache<Traits>::Group::dump(std::ostream& os) const {
+    os << "  group id: " << group_id << "\n";
+    for (size_t i = 0, s = terms.size(); i < s; i++) {
+        os << "    term id: " << terms[i].id << ", weight in query: " << terms[i].weight << "\n";
+    }
+    os << "    posting list size: " << posting_list->size()
+        << ", upper bound: " << posting_list->get_upper_bound() << "\n";
+    return os;
+}
+
+template <typename Traits>
+std::ostream& BasicTermGroupCache<Traits>::dump(std::ostream& os) const {
+    os << "term groups: " << groups_.size() << ", postings: " << postings_
+        << ", observed queries: " << observer_->queries() << "\n";
+    for (size_t i = 0, s = groups_.size(); i < s; i++) {
+        os << *groups_[i];
+    }
+    return os;
+}
+
+WAND_ENGINE_INSTANTIATE(class BasicTermGroupCache)
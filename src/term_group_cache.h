@@ -0,0 +1,102 @@
+#ifndef WAND_ENGINE_TERM_GROUP_CACHE_H
+#define WAND_ENGINE_TERM_GROUP_CACHE_H
+
+#include "index.h"
+#include <ostream>
+#include <vector>
+
+// Materialized posting lists for groups of terms that frequently occur together in queries.
+//
+// A group is a set of (term id, weight in query) pairs. Its posting list is the union of
+// the members' posting lists, each node's bound being the partial dot product
+// sum(weight in query * bound) of the members that doc contains.
+// So Wand can replace all members found in a query by one virtual term with weight 1,
+// whose upper bound is the exact maximum of that partial dot product.
+//
+// Groups are admitted from the query log:
+// 'observe' every query, then 'rebuild' against the index.
+// 'observe', 'rebuild' and 'clear' must not run concurrently with 'match'.
+// A group is dropped if any of its bounds doesn't fit in WeightType.
+template <typename Traits>
+class BasicTermGroupCache {
+public:
+    typedef BasicTerm<Traits> Term;
+    typedef typename BasicDocument<Traits>::TermVector TermVector;
+    typedef BasicPostingList<Traits> PostingList;
+    typedef BasicInvertedIndex<Traits> InvertedIndex;
+
+    struct Group {
+        IdType group_id;// virtual term id
+        TermVector terms;// members sorted by term id, weight is the weight in query
+        PostingList * posting_list;
+
+        std::ostream& dump(std::ostream& os) const;
+
+        friend std::ostream& operator << (std::ostream& os, const Group& group) {
+            group.dump(os);
+            return os;
+        }
+    };
+
+private:
+    class Observer;
+    Observer * observer_;
+    std::vector<Group *> groups_;
+    const size_t max_group_size_;
+    const size_t max_postings_;
+    const double min_frequency_;
+    uint64_t index_version_;
+    size_t postings_;
+
+    void clear_groups();
+
+public:
+    // 'min_frequency': a term is a candidate if it appears in at least this fraction of
+    // observed queries.
+    // 'max_postings': memory budget in materialized posting list nodes.
+    explicit BasicTermGroupCache(
+        size_t max_group_size = 4,
+        size_t max_postings = 16 * 1024 * 1024,
+        double min_frequency = 0.1);
+    ~BasicTermGroupCache();
+
+    void observe(const TermVector& query);
+    void rebuild(const InvertedIndex& ii);
+    void clear();
+
+    // Append groups all of whose members are in 'query' to 'groups',
+    // and set (*covered)[i] to 1 if query[i] is a member of one of them.
+    // 'query' must be sorted by term id in advance.
+    // Return the number of groups matched.
+    size_t match(const TermVector& query,
+            std::vector<const Group *> * groups, std::vector<char> * covered) const;
+
+    // the InvertedIndex::version() groups were built on
+    uint64_t version() const {
+        return index_version_;
+    }
+
+    size_t size() const {
+        return groups_.size();
+    }
+
+    size_t postings() const {
+        return postings_;
+    }
+
+    std::ostream& dump(std::ostream& os) const;
+
+private:
+    BasicTermGroupCache(BasicTermGroupCache& other);
+    BasicTermGroupCache& operator=(BasicTermGroupCache& other);
+};
+
+template <typename Traits>
+inline std::ostream& operator << (std::ostream& os, const BasicTermGroupCache<Traits>& cache) {
+    cache.dump(os);
+    return os;
+}
+
+typedef BasicTermGroupCache<DefaultScoreTraits> TermGroupCache;
+
+#endif// WAND_ENGINE_TERM_GROUP_CACHE_H
@@ -0,0 +1,41 @@
+#ifndef WAND_ENGINE_TIMER_H
+#define WAND_ENGINE_TIMER_H
+
+#include <stdint.h>
+
+#if defined _WIN32
+# define WIN32_LEAN_AND_MEAN
+# include <Windows.h>
+#else
+# include <time.h>
+#endif
+
+// monotonic time in microseconds, only differences between two calls make sense
+inline uint64_t now_us() {
+#if defined _WIN32
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (uint64_t)(counter.QuadPart / (frequency.QuadPart / 1000000.0));
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+#endif
+}
+
+// monotonic time in nanoseconds
+inline uint64_t now_ns() {
+#if defined _WIN32
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (uint64_t)(counter.QuadPart / (frequency.QuadPart / 1000000000.0));
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+#endif// WAND_ENGINE_TIMER_H
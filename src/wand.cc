@@ -1,202 +1,916 @@
 #include "wand.h"
+#include "dot_product.h"
+#include "hash_map.h"
+#include "result_cache.h"
+#include "timer.h"
 #include <assert.h>
 #include <algorithm>
-#include <iostream>
 #include <map>
 
-ScoreType Wand::dot_product(const TermVector& query, const TermVector& doc) {
-    // 'query' and 'doc' must be sorted by term id in advance.
-    ScoreType dp = 0;
-    size_t i = 0, j = 0, imax = query.size(), jmax = doc.size();
-    for (; i < imax && j < jmax; ) {
-        if (query[i].id < doc[j].id) {
-            i++;
-        } else if (query[i].id > doc[j].id) {
-            j++;
-        } else {
-            dp += (query[i].weight * doc[j].weight);
-            i++;
-            j++;
+namespace {
+
+// check the deadline once every this many iterations of Wand::next
+const size_t kDeadlineCheckInterval = 64;
+// docs search_taat passes to AttributeMatcher::select at once
+const size_t kFilterBatchSize = 256;
+
+}
+
+template <typename Traits>
+void BasicWand<Traits>::QueryStats::clear() {
+    cache_hit = false;
+    terms_matched = 0;
+    groups_matched = 0;
+    postings_advanced = 0;
+    postings_skipped = 0;
+    pivots = 0;
+    block_skips = 0;
+    filtered = 0;
+    evaluations = 0;
+    heap_insertions = 0;
+    threshold_trajectory.clear();
+    match_ns = 0;
+    traverse_ns = 0;
+    collect_ns = 0;
+}
+
+template <typename Traits>
+void BasicWand<Traits>::QueryContext::clean(ScoreType threshold, const SearchOptions * options,
+        QueryStats * stats) {
+    skipped_doc_ = 0;
+    current_doc_id_ = 0;
+    linked_term_posting_lists_.clear();
+    array_term_posting_lists_.clear();
+    doc_heap_.clear();
+    matched_groups_.clear();
+
+    pivots_ = 0;
+    block_skips_ = 0;
+    filtered_ = 0;
+    heap_insertions_ = 0;
+    stats_ = stats;
+    if (stats) {
+        stats->clear();
+        lap_begin_ns_ = now_ns();
+    }
+
+    postings_advanced_ = 0;
+    max_postings_ = (size_t)-1;
+    evaluations_ = 0;
+    max_evaluations_ = (size_t)-1;
+    deadline_us_ = 0;
+    deadline_countdown_ = kDeadlineCheckInterval;
+    approximate_ = false;
+    if (options) {
+        if (options->max_postings) {
+            max_postings_ = options->max_postings;
+        }
+        if (options->max_evaluations) {
+            max_evaluations_ = options->max_evaluations;
         }
+        deadline_us_ = options->deadline_us;
     }
-    return dp;
+    threshold_factor_ = options ? options->threshold_factor : 1.0;
+    set_threshold(threshold);
 }
 
-ScoreType Wand::full_evaluate(const TermVector& query, const Document * doc) {
+template <typename Traits>
+void BasicWand<Traits>::QueryContext::fill_stats() const {
+    stats_->postings_advanced = postings_advanced_;
+    stats_->postings_skipped = skipped_doc_;
+    stats_->pivots = pivots_;
+    stats_->block_skips = block_skips_;
+    stats_->filtered = filtered_;
+    stats_->evaluations = evaluations_;
+    stats_->heap_insertions = heap_insertions_;
+}
+
+template <typename Traits>
+uint64_t BasicWand<Traits>::QueryContext::lap_ns() {
+    uint64_t now = now_ns();
+    uint64_t elapsed = now - lap_begin_ns_;
+    lap_begin_ns_ = now;
+    return elapsed;
+}
+
+template <typename Traits>
+typename BasicWand<Traits>::ScoreType
+BasicWand<Traits>::dot_product(const TermVector& query, const TermVector& doc) {
+    // 'query' and 'doc' must be sorted by term id in advance.
+    return sparse_dot_product(query, doc);
+}
+
+template <typename Traits>
+typename BasicWand<Traits>::ScoreType
+BasicWand<Traits>::full_evaluate(const TermVector& query, const Document * doc) {
     return dot_product(query, doc->terms);
 }
 
-void Wand::match_terms(const TermVector& query) {
+template <typename Traits>
+template <typename Cursor>
+typename BasicWand<Traits>::ScoreType
+BasicWand<Traits>::evaluate_postings(const std::vector<TermPostingList<Cursor> >& tpls,
+        IdType doc_id) {
+    // Cursors are sorted by doc id and the first one is on 'doc_id'(see 'next'),
+    // so all cursors of terms in 'doc_id' are at the front, none lags behind.
+    ScoreType score = 0;
+    for (size_t i = 0, s = tpls.size(); i < s; i++) {
+        const TermPostingList<Cursor>& tpl = tpls[i];
+        if (tpl.cursor.docid() != doc_id) {
+            break;
+        }
+        score += tpl.weight_in_query * tpl.cursor.weight();
+    }
+    return score;
+}
+
+template <typename Traits>
+template <typename Cursor>
+void BasicWand<Traits>::add_term_posting_list(std::vector<TermPostingList<Cursor> > * tpls,
+        IdType term_id, const PostingList * posting_list, ScoreType weight_in_query) {
+    TermPostingList<Cursor> tpl;
+    tpl.term_id = term_id;
+    tpl.cursor = Cursor(posting_list);
+    tpl.weight_in_query = weight_in_query;
+    tpls->push_back(tpl);
+}
+
+template <typename Traits>
+template <typename Cursor>
+void BasicWand<Traits>::match_terms(QueryContext * ctx,
+        std::vector<TermPostingList<Cursor> > * tpls, const TermVector& query) const {
+    ctx->covered_terms_.assign(query.size(), 0);
+    if (term_group_cache_ && term_group_cache_->version() == ii_.version()) {
+        // Each matched group is one virtual term, whose bound is
+        // the partial dot product of its members already.
+        term_group_cache_->match(query, &ctx->matched_groups_, &ctx->covered_terms_);
+        for (size_t i = 0, s = ctx->matched_groups_.size(); i < s; i++) {
+            const typename TermGroupCache::Group * group = ctx->matched_groups_[i];
+            add_term_posting_list(tpls, group->group_id, group->posting_list, 1);
+        }
+    }
+
     for (size_t i = 0, s = query.size(); i < s; i++) {
+        if (ctx->covered_terms_[i]) {
+            continue;
+        }
+        if (i > 0 && query[i].id == query[i - 1].id) {
+            // duplicated term, only the first one counts like dot_product
+            continue;
+        }
         const Term& term = query[i];
-        IdType term_id = term.id;
-        ScoreType term_weight = term.weight;
-        const PostingList * posting_list = ii_.find(term_id);
+        const PostingList * posting_list = ii_.find(term.id);
         if (posting_list) {
-            PostingListNode * first = posting_list->front();
-            if (first) {
-                TermPostingList tpl;
-                tpl.term_id = term_id;
-                tpl.posting_list = posting_list;
-                tpl.current = first;
-                tpl.remains = posting_list->size();
-                tpl.weight_in_query = term_weight;
-                term_posting_list_set_.insert(tpl);
-            }
+            add_term_posting_list(tpls, term.id, posting_list, term.weight);
         }
     }
+
+    std::sort(tpls->begin(), tpls->end(), TermPostingList_DocIdLess());
 }
 
-void Wand::advance_term_posting_list(const TermPostingListSetType::const_iterator& to_advance,
-        IdType doc_id) {
-    TermPostingList tpl = (*to_advance);// TODO copy
-    term_posting_list_set_.erase(to_advance);
+template <typename Traits>
+template <typename Cursor>
+bool BasicWand<Traits>::open_constraints(const SearchOptions * options,
+        Constraints<Cursor> * constraints) const {
+    constraints->required.clear();
+    constraints->excluded.clear();
+    if (!options) {
+        return true;
+    }
+    for (size_t i = 0, s = options->required_terms.size(); i < s; i++) {
+        const PostingList * posting_list = ii_.find(options->required_terms[i]);
+        if (!posting_list || posting_list->empty()) {
+            return false;
+        }
+        constraints->required.push_back(Cursor(posting_list));
+    }
+    for (size_t i = 0, s = options->excluded_terms.size(); i < s; i++) {
+        const PostingList * posting_list = ii_.find(options->excluded_terms[i]);
+        if (posting_list && !posting_list->empty()) {
+            constraints->excluded.push_back(Cursor(posting_list));
+        }
+    }
+    return true;
+}
 
-    // Find a doc after 'tpl.current', whose id >= 'doc_id',
-    // and set tpl.current to this doc.
-    PostingListNode *& current = tpl.current;
+template <typename Traits>
+template <typename Cursor>
+IdType BasicWand<Traits>::align_required(QueryContext * ctx, Constraints<Cursor> * constraints,
+        IdType doc_id) {
+    // Leapfrog: move each cursor to the largest doc id seen,
+    // until all of them agree on one.
+    std::vector<Cursor>& required = constraints->required;
+    size_t s = required.size();
+    IdType target = doc_id;
+    for (size_t i = 0, aligned = 0; aligned < s; i = i + 1 < s ? i + 1 : 0) {
+        size_t advanced = required[i].skip_to(target);
+        ctx->skipped_doc_ += advanced;
+        ctx->postings_advanced_ += advanced;
+        IdType current = required[i].docid();
+        if (current == target) {
+            aligned++;
+        } else {
+            target = current;
+            aligned = 1;
+        }
+        if (Document::is_sentinel(target)) {
+            break;
+        }
+    }
+    return target;
+}
 
-    while (current->doc->id < doc_id) {
-        current = current->next;
-        skipped_doc_++;
-        tpl.remains--;
+template <typename Traits>
+template <typename Cursor>
+bool BasicWand<Traits>::is_excluded(QueryContext * ctx, Constraints<Cursor> * constraints,
+        IdType doc_id) {
+    std::vector<Cursor>& excluded = constraints->excluded;
+    for (size_t i = 0, s = excluded.size(); i < s; i++) {
+        size_t advanced = excluded[i].skip_to(doc_id);
+        ctx->skipped_doc_ += advanced;
+        ctx->postings_advanced_ += advanced;
+        if (excluded[i].docid() == doc_id) {
+            return true;
+        }
     }
-    assert(current->doc->id >= doc_id);
+    return false;
+}
 
-    term_posting_list_set_.insert(tpl);
+template <typename Traits>
+template <typename Cursor>
+void BasicWand<Traits>::advance_term_posting_list(QueryContext * ctx,
+        std::vector<TermPostingList<Cursor> > * tpls, size_t to_advance, IdType doc_id) {
+    TermPostingList<Cursor> tpl = (*tpls)[to_advance];
+
+    // Find a doc after the current one, whose id >= 'doc_id',
+    // and move the cursor to this doc.
+    size_t advanced = tpl.cursor.skip_to(doc_id);
+    assert(tpl.cursor.docid() >= doc_id);
+    ctx->skipped_doc_ += advanced;
+    ctx->postings_advanced_ += advanced;
+
+    // Its doc id only grows, move it backward to keep 'tpls' sorted.
+    IdType current_doc_id = tpl.cursor.docid();
+    size_t i = to_advance + 1, s = tpls->size();
+    for (; i < s && (*tpls)[i].cursor.docid() < current_doc_id; i++) {
+        (*tpls)[i - 1] = (*tpls)[i];
+    }
+    (*tpls)[i - 1] = tpl;
 }
 
-bool Wand::find_pivot(TermPostingListSetType::const_iterator * pivot) const {
+template <typename Traits>
+template <typename Cursor>
+bool BasicWand<Traits>::find_pivot(const QueryContext * ctx,
+        const std::vector<TermPostingList<Cursor> >& tpls, size_t * pivot) {
     ScoreType acc_score = 0;
-    TermPostingListSetType::const_iterator first = term_posting_list_set_.begin();
-    TermPostingListSetType::const_iterator last = term_posting_list_set_.end();
-    for (; first != last; ++first) {
-        const TermPostingList& tpl = (*first);
-        acc_score += tpl.posting_list->get_upper_bound() * tpl.weight_in_query;
+    for (size_t i = 0, s = tpls.size(); i < s; i++) {
+        const TermPostingList<Cursor>& tpl = tpls[i];
+        acc_score += tpl.cursor.max_score() * tpl.weight_in_query;
         // Another policy is to disregard term weight in query:
-        // acc_score += tpl.posting_list->get_upper_bound();
+        // acc_score += tpl.cursor.max_score();
         // This policy is not as accurate.
-        if (acc_score >= current_threshold_) {
-            *pivot = first;
+        if (acc_score >= ctx->pivot_threshold_) {
+            *pivot = i;
             return true;
         }
     }
     return false;
 }
 
-Wand::TermPostingListSetType::const_iterator
-Wand::pick_term(const TermPostingListSetType::const_iterator& pivot) const {
+template <typename Traits>
+template <typename Cursor>
+size_t BasicWand<Traits>::pick_term(const std::vector<TermPostingList<Cursor> >&, size_t) {
     // The simplest way: always return the first one(current term).
-    return term_posting_list_set_.begin();
+    return 0;
 
     // We can have many strategies to pick a term.
     // One principle is: picked term will skip more doc.
     // That is the TermPostingList with the largest 'remains':
 }
 
-bool Wand::next(TermPostingListSetType::const_iterator * next_term) {
+template <typename Traits>
+bool BasicWand<Traits>::out_of_budget(QueryContext * ctx) {
+    if (ctx->postings_advanced_ >= ctx->max_postings_) {
+        return true;
+    }
+    if (ctx->deadline_us_ && --ctx->deadline_countdown_ == 0) {
+        ctx->deadline_countdown_ = kDeadlineCheckInterval;
+        if (now_us() >= ctx->deadline_us_) {
+            return true;
+        }
+    }
+    return false;
+}
+
+template <typename Traits>
+template <typename Cursor>
+bool BasicWand<Traits>::next(QueryContext * ctx, std::vector<TermPostingList<Cursor> > * tpls,
+        Constraints<Cursor> * constraints, size_t * next_term) {
     for (;;) {
-        TermPostingListSetType::const_iterator pivot;
-        if (!find_pivot(&pivot)) {
+        if (out_of_budget(ctx)) {
+            ctx->approximate_ = true;
+            return false;
+        }
+
+        size_t pivot;
+        if (!find_pivot(ctx, *tpls, &pivot)) {
             // no more doc
             return false;
         }
 
-        IdType pivot_doc_id = (*pivot).current->doc->id;
+        IdType pivot_doc_id = (*tpls)[pivot].cursor.docid();
         if (Document::is_sentinel(pivot_doc_id)) {
             // no more doc
             return false;
         }
+        ctx->pivots_++;
+        if (ctx->prefetch_distance_) {
+            // the cursors up to the pivot are the ones advanced next
+            for (size_t i = 0; i <= pivot; i++) {
+                (*tpls)[i].cursor.prefetch_postings(ctx->prefetch_distance_);
+            }
+            if (ctx->prefetch_docs_) {
+                prefetch((*tpls)[pivot].cursor.doc());
+            }
+        }
 
-        if (pivot_doc_id <= current_doc_id_) {
+        if (pivot_doc_id <= ctx->current_doc_id_) {
             // pivot has already been considered, advance one of the preceding terms.
             // this kind of advance is not considered as a skip,
             // because at least one advance shall come.
-            skipped_doc_--;
-            TermPostingListSetType::const_iterator picked = pick_term(pivot);
-            assert((*picked).current->doc->id < current_doc_id_ + 1);
-            advance_term_posting_list(picked, current_doc_id_ + 1);
+            ctx->skipped_doc_--;
+            size_t picked = pick_term(*tpls, pivot);
+            assert((*tpls)[picked].cursor.docid() < ctx->current_doc_id_ + 1);
+            advance_term_posting_list(ctx, tpls, picked, ctx->current_doc_id_ + 1);
         } else {
-            if (pivot_doc_id == term_posting_list_set_.begin()->current->doc->id) {
+            if (!constraints->required.empty()) {
+                // Align required terms before anything is scored on the pivot.
+                IdType target = align_required(ctx, constraints, pivot_doc_id);
+                if (Document::is_sentinel(target)) {
+                    return false;
+                }
+                if (target > pivot_doc_id) {
+                    // no doc before 'target' has all required terms,
+                    // the preceding terms are advanced to it next
+                    ctx->filtered_++;
+                    ctx->current_doc_id_ = target - 1;
+                    continue;
+                }
+            }
+            if (pivot_doc_id == (*tpls)[0].cursor.docid()) {
+                if (Cursor::has_blocks) {
+                    // Block maxes of the postings on the pivot doc bound its score
+                    // tighter than max scores, skip it if that can't reach the threshold.
+                    ScoreType block_score = 0;
+                    for (size_t i = 0, s = tpls->size();
+                            i < s && (*tpls)[i].cursor.docid() == pivot_doc_id; i++) {
+                        block_score += (*tpls)[i].cursor.block_max() * (*tpls)[i].weight_in_query;
+                    }
+                    if (block_score < ctx->pivot_threshold_) {
+                        ctx->block_skips_++;
+                        ctx->current_doc_id_ = pivot_doc_id;
+                        continue;
+                    }
+                }
+                if (is_excluded(ctx, constraints, pivot_doc_id)
+                        || (ctx->attribute_matcher_.active()
+                        && !ctx->attribute_matcher_.match((*tpls)[pivot].cursor.doc()->ordinal))) {
+                    ctx->filtered_++;
+                    ctx->current_doc_id_ = pivot_doc_id;
+                    continue;
+                }
+
                 // two valid outputs of this function
-                current_doc_id_ = pivot_doc_id;
+                ctx->current_doc_id_ = pivot_doc_id;
                 *next_term = pivot;
                 return true;
             } else {
                 //// not enough mass yet on pivot, advance all of the preceding terms
-                // for (;;)
-                // {
-                //     TermPostingListSetType::const_iterator first = term_posting_list_set_.begin();
-                //     if (first == pivot)
-                //         break;
-                //     advance_term_posting_list(first, pivot_doc_id);
-                // }
+                // while ((*tpls)[0].cursor.docid() < pivot_doc_id)
+                //     advance_term_posting_list(ctx, tpls, 0, pivot_doc_id);
 
                 // In the original paper, author only advances one term posting list like this:
                 // not enough mass yet on pivot, advance one of the preceding terms
-                TermPostingListSetType::const_iterator picked = pick_term(pivot);
-                advance_term_posting_list(picked, pivot_doc_id);
+                size_t picked = pick_term(*tpls, pivot);
+                advance_term_posting_list(ctx, tpls, picked, pivot_doc_id);
             }
         }
     }
 }
 
-void Wand::search(TermVector& query, std::vector<DocIdScore> * result) {
-    std::sort(query.begin(), query.end(), TermLess());
-    match_terms(query);
-    if (term_posting_list_set_.empty()) {
-        // no doc matched
-        return;
+template <typename Traits>
+template <typename Cursor>
+typename BasicWand<Traits>::ScoreType
+BasicWand<Traits>::evaluate(const std::vector<TermPostingList<Cursor> >& tpls, size_t pivot,
+        const TermVector& query) const {
+    if (evaluate_mode_ == EVALUATE_BY_POSTINGS) {
+        return evaluate_postings(tpls, tpls[pivot].cursor.docid());
     }
+    return full_evaluate(query, tpls[pivot].cursor.doc());
+}
 
-    bool found;
-
-    if (verbose_) {
-        std::cout << *this << "\n";
+template <typename Traits>
+template <typename Cursor>
+void BasicWand<Traits>::search_cursors(QueryContext * ctx,
+        std::vector<TermPostingList<Cursor> > * tpls, Constraints<Cursor> * constraints,
+        const TermVector& query) const {
+    typename QueryContext::DocHeapType& doc_heap = ctx->doc_heap_;
+    QueryStats * stats = ctx->stats_;
+    if (stats) {
+        stats->terms_matched = tpls->size();
+        stats->groups_matched = ctx->matched_groups_.size();
+        stats->match_ns = ctx->lap_ns();
     }
 
     for (;;) {
-        TermPostingListSetType::const_iterator pivot;
-        found = next(&pivot);
-        if (!found) {
+        size_t pivot;
+        if (!next(ctx, tpls, constraints, &pivot)) {
             break;
         }
-
-        const TermPostingList& tpl = (*pivot);
-        const Document * doc = tpl.current->doc;
+        if (ctx->evaluations_ >= ctx->max_evaluations_) {
+            ctx->approximate_ = true;
+            break;
+        }
+        ctx->evaluations_++;
 
         DocIdScore ds;
-        ds.doc_id = doc->id;
-        ds.score = full_evaluate(query, doc);
+        ds.doc_id = (*tpls)[pivot].cursor.docid();
+        ds.score = evaluate(*tpls, pivot, query);
 
-        if (doc_heap_.size() < heap_size_) {
-            if (ds.score > current_threshold_) {
-                doc_heap_.insert(ds);
+        if (doc_heap.size() < heap_size_) {
+            if (ds.score > ctx->current_threshold_) {
+                doc_heap.push_back(ds);
+                std::push_heap(doc_heap.begin(), doc_heap.end(), DocIdScore_ScoreGreat());
+                ctx->heap_insertions_++;
             }
         } else {
             // Heap is full,
-            // update 'doc_heap_' and 'current_threshold_' if its score > min score in heap.
-            DocHeapType::iterator it = doc_heap_.begin();
-            if (ds.score > (*it).score) {
-                doc_heap_.erase(it);
-                doc_heap_.insert(ds);
-                current_threshold_ = (*doc_heap_.begin()).score;
+            // update 'doc_heap' and 'current_threshold_' if its score > min score in heap.
+            if (ds.score > doc_heap.front().score) {
+                std::pop_heap(doc_heap.begin(), doc_heap.end(), DocIdScore_ScoreGreat());
+                doc_heap.back() = ds;
+                std::push_heap(doc_heap.begin(), doc_heap.end(), DocIdScore_ScoreGreat());
+                ctx->heap_insertions_++;
+                ctx->set_threshold(doc_heap.front().score);
+            }
+        }
+    }
+
+    if (stats) {
+        stats->traverse_ns = ctx->lap_ns();
+    }
+}
+
+template <typename Traits>
+template <typename Cursor>
+bool BasicWand<Traits>::stream_cursors(QueryContext * ctx,
+        std::vector<TermPostingList<Cursor> > * tpls, Constraints<Cursor> * constraints,
+        const TermVector& query, ResultCallback callback, void * arg) const {
+    QueryStats * stats = ctx->stats_;
+    if (stats) {
+        stats->terms_matched = tpls->size();
+        stats->groups_matched = ctx->matched_groups_.size();
+        stats->match_ns = ctx->lap_ns();
+    }
+
+    // The threshold never changes, every doc above it is passed on at once.
+    bool stopped = false;
+    for (;;) {
+        size_t pivot;
+        if (!next(ctx, tpls, constraints, &pivot)) {
+            break;
+        }
+        if (ctx->evaluations_ >= ctx->max_evaluations_) {
+            ctx->approximate_ = true;
+            break;
+        }
+        ctx->evaluations_++;
+
+        DocIdScore ds;
+        ds.doc_id = (*tpls)[pivot].cursor.docid();
+        ds.score = evaluate(*tpls, pivot, query);
+        if (ds.score > ctx->current_threshold_) {
+            ctx->heap_insertions_++;
+            if (!callback(ds, arg)) {
+                stopped = true;
+                break;
+            }
+        }
+    }
+
+    if (stats) {
+        stats->traverse_ns = ctx->lap_ns();
+    }
+    return !stopped;
+}
+
+template <typename Traits>
+bool BasicWand<Traits>::compile_filter(QueryContext * ctx, const SearchOptions * options) const {
+    if (!options || !options->filter || options->filter->empty()) {
+        ctx->attribute_matcher_.clear();
+        return true;
+    }
+    return ctx->attribute_matcher_.compile(*options->filter, ii_.attributes());
+}
+
+template <typename Traits>
+bool BasicWand<Traits>::begin_query(QueryContext * ctx, TermVector& query,
+        const SearchOptions * options, QueryStats * stats) const {
+    ctx->clean(threshold_, options, stats);
+    bool filter_matchable = compile_filter(ctx, options);
+    ctx->prefetch_distance_ = prefetch_distance_;
+    // the filter reads the ordinal of the pivot doc
+    ctx->prefetch_docs_ = evaluate_mode_ == EVALUATE_BY_DOCUMENT
+        || ctx->attribute_matcher_.active();
+    std::sort(query.begin(), query.end(), TermLess());
+    return filter_matchable;
+}
+
+template <typename Traits>
+template <typename Cursor>
+void BasicWand<Traits>::match_query(QueryContext * ctx,
+        std::vector<TermPostingList<Cursor> > * tpls, Constraints<Cursor> * constraints,
+        const TermVector& query, const SearchOptions * options, bool matchable) const {
+    match_terms(ctx, tpls, query);
+    if (!open_constraints(options, constraints) || !matchable) {
+        tpls->clear();
+    }
+}
+
+template <typename Traits>
+bool BasicWand<Traits>::search(QueryContext * ctx, TermVector& query,
+        std::vector<DocIdScore> * result, const SearchOptions * options,
+        QueryStats * stats) const {
+    bool matchable = begin_query(ctx, query, options, stats);
+
+    // The cache key has no constraints, filter or threshold factor,
+    // constrained and approximate searches skip the cache.
+    bool use_cache = result_cache_
+        && (!options || (options->required_terms.empty() && options->excluded_terms.empty()
+        && !options->filter && options->threshold_factor == 1.0));
+    typename ResultCache::Key cache_key;
+    uint64_t index_version = 0;
+    if (use_cache) {
+        cache_key = ResultCache::make_key(query, heap_size_, threshold_);
+        index_version = ii_.version();
+        if (result_cache_->find(cache_key, index_version, result)) {
+            if (stats) {
+                stats->cache_hit = true;
+                stats->match_ns = ctx->lap_ns();
+            }
+            return true;
+        }
+    }
+
+    // Dispatch once per query, each posting layout has its own inlined loop.
+    // search_cursors returns at once if no term is matched.
+    if (ii_.sealed()) {
+        match_query(ctx, &ctx->array_term_posting_lists_, &ctx->array_constraints_,
+            query, options, matchable);
+        search_cursors(ctx, &ctx->array_term_posting_lists_, &ctx->array_constraints_, query);
+    } else {
+        match_query(ctx, &ctx->linked_term_posting_lists_, &ctx->linked_constraints_,
+            query, options, matchable);
+        search_cursors(ctx, &ctx->linked_term_posting_lists_, &ctx->linked_constraints_, query);
+    }
+
+    const typename QueryContext::DocHeapType& doc_heap = ctx->doc_heap_;
+    result->assign(doc_heap.begin(), doc_heap.end());
+    std::sort(result->begin(), result->end(), DocIdScore_ScoreGreat());
+
+    bool complete = !ctx->approximate_;
+    if (complete && use_cache) {
+        result_cache_->insert(cache_key, index_version, *result);
+    }
+    if (stats) {
+        ctx->fill_stats();
+        stats->collect_ns = ctx->lap_ns();
+    }
+    return complete;
+}
+
+template <typename Traits>
+bool BasicWand<Traits>::search(TermVector& query, std::vector<DocIdScore> * result,
+        const SearchOptions * options, QueryStats * stats) {
+    return search(&context_, query, result, options, stats);
+}
+
+template <typename Traits>
+bool BasicWand<Traits>::search_stream(QueryContext * ctx, TermVector& query,
+        ResultCallback callback, void * arg, const SearchOptions * options,
+        QueryStats * stats) const {
+    bool matchable = begin_query(ctx, query, options, stats);
+    bool complete;
+    if (ii_.sealed()) {
+        match_query(ctx, &ctx->array_term_posting_lists_, &ctx->array_constraints_,
+            query, options, matchable);
+        complete = stream_cursors(ctx, &ctx->array_term_posting_lists_,
+            &ctx->array_constraints_, query, callback, arg);
+    } else {
+        match_query(ctx, &ctx->linked_term_posting_lists_, &ctx->linked_constraints_,
+            query, options, matchable);
+        complete = stream_cursors(ctx, &ctx->linked_term_posting_lists_,
+            &ctx->linked_constraints_, query, callback, arg);
+    }
+    if (stats) {
+        ctx->fill_stats();
+        stats->collect_ns = ctx->lap_ns();
+    }
+    return complete && !ctx->approximate_;
+}
+
+template <typename Traits>
+bool BasicWand<Traits>::search_stream(TermVector& query, ResultCallback callback, void * arg,
+        const SearchOptions * options, QueryStats * stats) {
+    return search_stream(&context_, query, callback, arg, options, stats);
+}
+
+namespace {
+
+template <typename ScoreType>
+struct BatchTerm {
+    IdType term_id;
+    size_t query_index;
+    ScoreType weight_in_query;
+};
+
+struct BatchTerm_TermIdLess {
+    template <typename BatchTermType>
+    bool operator()(const BatchTermType& a, const BatchTermType& b) const {
+        if (a.term_id != b.term_id) {
+            return a.term_id < b.term_id;
+        }
+        return a.query_index < b.query_index;
+    }
+};
+
+// Add every posting from 'cursor' on to the docs of the queries of ['first', 'last'),
+// which share its term.
+template <typename Cursor, typename ScoreType, typename DocIdScoreMapType>
+void accumulate_batch(Cursor cursor, const BatchTerm<ScoreType> * first,
+        const BatchTerm<ScoreType> * last, std::vector<DocIdScoreMapType> * doc_maps) {
+    for (; !Cursor::Document::is_sentinel(cursor.docid()); cursor.next()) {
+        IdType doc_id = cursor.docid();
+        ScoreType weight = (ScoreType)cursor.weight();
+        for (const BatchTerm<ScoreType> * bt = first; bt != last; bt++) {
+            if (bt != first && bt->query_index == (bt - 1)->query_index) {
+                // duplicated term in one query, only one of them counts like 'search'
+                continue;
             }
+            (*doc_maps)[bt->query_index][doc_id] += bt->weight_in_query * weight;
         }
+    }
+}
+
+}
+
+template <typename Traits>
+void BasicWand<Traits>::search_batch(const std::vector<TermVector>& queries,
+        std::vector<std::vector<DocIdScore> > * results) const {
+    typedef HASH_MAP<IdType, ScoreType> DocIdScoreMapType;
 
-        if (verbose_) {
-            std::cout << *this << "\n";
-            std::cout << "matched term id(pivot): " << tpl.term_id
-                << ", doc id: " << current_doc_id_ << "\n";
-            std::cout << "\n";
+    // Group queries by term.
+    std::vector<BatchTerm<ScoreType> > batch_terms;
+    for (size_t i = 0, s = queries.size(); i < s; i++) {
+        const TermVector& query = queries[i];
+        for (size_t j = 0, js = query.size(); j < js; j++) {
+            BatchTerm<ScoreType> bt;
+            bt.term_id = query[j].id;
+            bt.query_index = i;
+            bt.weight_in_query = query[j].weight;
+            batch_terms.push_back(bt);
         }
     }
+    std::stable_sort(batch_terms.begin(), batch_terms.end(), BatchTerm_TermIdLess());
 
-    result->assign(doc_heap_.rbegin(), doc_heap_.rend());
-    clean();
+    // Walk each posting list once, accumulating into every query containing the term.
+    std::vector<DocIdScoreMapType> doc_maps(queries.size());
+    size_t first = 0, last = batch_terms.size();
+    while (first < last) {
+        IdType term_id = batch_terms[first].term_id;
+        size_t end = first + 1;
+        while (end < last && batch_terms[end].term_id == term_id) {
+            end++;
+        }
+
+        const PostingList * posting_list = ii_.find(term_id);
+        if (posting_list && !posting_list->empty()) {
+            if (ii_.sealed()) {
+                accumulate_batch(ArrayCursor(posting_list),
+                    &batch_terms[first], &batch_terms[0] + end, &doc_maps);
+            } else {
+                accumulate_batch(LinkedCursor(posting_list),
+                    &batch_terms[first], &batch_terms[0] + end, &doc_maps);
+            }
+        }
+        first = end;
+    }
+
+    results->resize(queries.size());
+    for (size_t i = 0, s = queries.size(); i < s; i++) {
+        std::vector<DocIdScore>& result = (*results)[i];
+        result.clear();
+
+        DocIdScoreMapType& doc_map = doc_maps[i];
+        typename DocIdScoreMapType::const_iterator it = doc_map.begin();
+        typename DocIdScoreMapType::const_iterator it_last = doc_map.end();
+        for (; it != it_last; ++it) {
+            if ((*it).second > threshold_) {
+                result.push_back(DocIdScore((*it).first, (*it).second));
+            }
+        }
+        DocIdScoreMapType().swap(doc_map);
+
+        if (result.size() > heap_size_) {
+            std::partial_sort(result.begin(), result.begin() + heap_size_, result.end(),
+                DocIdScore_ScoreGreat());
+            result.resize(heap_size_);
+        } else {
+            std::sort(result.begin(), result.end(), DocIdScore_ScoreGreat());
+        }
+    }
 }
 
-void Wand::search_taat_v1(TermVector& query, std::vector<DocIdScore> * result) const {
+template <typename Traits>
+template <typename Cursor>
+void BasicWand<Traits>::accumulate(QueryContext * ctx, Cursor cursor, ScoreType weight_in_query) {
+    ScoreType * accumulators = &ctx->accumulators_[0];
+    uint64_t * touched_bits = &ctx->touched_bits_[0];
+    std::vector<const Document *>& touched_docs = ctx->touched_docs_;
+    size_t prefetch_distance = ctx->prefetch_distance_;
+    for (; !Document::is_sentinel(cursor.docid()); cursor.next()) {
+        if (prefetch_distance) {
+            cursor.prefetch_doc(prefetch_distance);
+        }
+        const Document * doc = cursor.doc();
+        OrdinalType ordinal = doc->ordinal;
+        uint64_t& bits = touched_bits[ordinal >> 6];
+        uint64_t mask = (uint64_t)1 << (ordinal & 63);
+        if (!(bits & mask)) {
+            bits |= mask;
+            touched_docs.push_back(doc);
+        }
+        accumulators[ordinal] += weight_in_query * cursor.weight();
+    }
+}
+
+template <typename Traits>
+void BasicWand<Traits>::accumulate(QueryContext * ctx, const PostingArray& array,
+        ScoreType weight_in_query) {
+    ScoreType * accumulators = &ctx->accumulators_[0];
+    uint64_t * touched_bits = &ctx->touched_bits_[0];
+    std::vector<const Document *>& touched_docs = ctx->touched_docs_;
+    size_t prefetch_distance = ctx->prefetch_distance_;
+    const typename PostingArray::WeightType * weights = array.weights;
+    Document * const * docs = array.docs;
+    for (size_t i = 0, s = array.size(); i < s; i++) {
+        if (prefetch_distance) {
+            // the sentinel ends the docs
+            prefetch(docs[std::min(i + prefetch_distance, s)]);
+        }
+        const Document * doc = docs[i];
+        OrdinalType ordinal = doc->ordinal;
+        uint64_t& bits = touched_bits[ordinal >> 6];
+        uint64_t mask = (uint64_t)1 << (ordinal & 63);
+        if (!(bits & mask)) {
+            bits |= mask;
+            touched_docs.push_back(doc);
+        }
+        accumulators[ordinal] += weight_in_query * weights[i];
+    }
+}
+
+template <typename Traits>
+size_t BasicWand<Traits>::collect_filtered(const QueryContext * ctx,
+        const IdType * doc_ids, const OrdinalType * ordinals, const ScoreType * scores,
+        size_t count, std::vector<DocIdScore> * result) {
+    uint32_t selection[kFilterBatchSize];
+    size_t selected = ctx->attribute_matcher_.select(ordinals, count, selection);
+    for (size_t i = 0; i < selected; i++) {
+        result->push_back(DocIdScore(doc_ids[selection[i]], scores[selection[i]]));
+    }
+    return count - selected;
+}
+
+template <typename Traits>
+void BasicWand<Traits>::search_taat(QueryContext * ctx, TermVector& query,
+        std::vector<DocIdScore> * result, const SearchOptions * options,
+        QueryStats * stats) const {
+    uint64_t begin_ns = 0;
+    if (stats) {
+        stats->clear();
+        begin_ns = now_ns();
+    }
+    std::sort(query.begin(), query.end(), TermLess());
+    // nothing is matched if no doc can pass the filter
+    bool filter_matchable = compile_filter(ctx, options);
+
+    size_t doc_count = ii_.doc_count();
+    if (ctx->accumulators_.size() < doc_count) {
+        ctx->accumulators_.resize(doc_count, 0);
+        ctx->touched_bits_.resize((doc_count + 63) / 64, 0);
+    }
+    std::vector<const Document *>& touched_docs = ctx->touched_docs_;
+    touched_docs.clear();
+    ctx->prefetch_distance_ = prefetch_distance_;
+
+    if (stats) {
+        uint64_t now = now_ns();
+        stats->match_ns = now - begin_ns;
+        begin_ns = now;
+    }
+    for (size_t i = 0, s = filter_matchable ? query.size() : 0; i < s; i++) {
+        if (i > 0 && query[i].id == query[i - 1].id) {
+            // duplicated term, only the first one counts like dot_product
+            continue;
+        }
+        const PostingList * posting_list = ii_.find(query[i].id);
+        if (!posting_list) {
+            continue;
+        }
+        if (stats) {
+            stats->terms_matched++;
+            stats->postings_advanced += posting_list->size();
+        }
+
+        if (posting_list->array()) {
+            accumulate(ctx, *posting_list->array(), (ScoreType)query[i].weight);
+        } else {
+            accumulate(ctx, LinkedCursor(posting_list), (ScoreType)query[i].weight);
+        }
+    }
+
+    if (stats) {
+        uint64_t now = now_ns();
+        stats->traverse_ns = now - begin_ns;
+        begin_ns = now;
+        stats->evaluations = touched_docs.size();
+    }
+
+    // Collect and reset touched accumulators.
+    ScoreType * accumulators = &ctx->accumulators_[0];
+    uint64_t * touched_bits = &ctx->touched_bits_[0];
+    result->clear();
+    if (!ctx->attribute_matcher_.active()) {
+        for (size_t i = 0, s = touched_docs.size(); i < s; i++) {
+            const Document * doc = touched_docs[i];
+            OrdinalType ordinal = doc->ordinal;
+            if (accumulators[ordinal] > threshold_) {
+                result->push_back(DocIdScore(doc->id, accumulators[ordinal]));
+            }
+            accumulators[ordinal] = 0;
+            touched_bits[ordinal >> 6] = 0;
+        }
+    } else {
+        // Docs above the threshold are filtered in batches.
+        IdType doc_ids[kFilterBatchSize];
+        OrdinalType ordinals[kFilterBatchSize];
+        ScoreType scores[kFilterBatchSize];
+        size_t count = 0;
+        size_t filtered = 0;
+        for (size_t i = 0, s = touched_docs.size(); i < s; i++) {
+            const Document * doc = touched_docs[i];
+            OrdinalType ordinal = doc->ordinal;
+            if (accumulators[ordinal] > threshold_) {
+                doc_ids[count] = doc->id;
+                ordinals[count] = ordinal;
+                scores[count] = accumulators[ordinal];
+                if (++count == kFilterBatchSize) {
+                    filtered += collect_filtered(ctx, doc_ids, ordinals, scores, count, result);
+                    count = 0;
+                }
+            }
+            accumulators[ordinal] = 0;
+            touched_bits[ordinal >> 6] = 0;
+        }
+        filtered += collect_filtered(ctx, doc_ids, ordinals, scores, count, result);
+        if (stats) {
+            stats->filtered = filtered;
+        }
+    }
+
+    if (stats) {
+        stats->heap_insertions = result->size();
+    }
+    if (result->size() > heap_size_) {
+        std::nth_element(result->begin(), result->begin() + heap_size_, result->end(),
+            DocIdScore_ScoreGreat());
+        result->resize(heap_size_);
+    }
+    std::sort(result->begin(), result->end(), DocIdScore_ScoreGreat());
+    if (stats) {
+        stats->collect_ns = now_ns() - begin_ns;
+    }
+}
+
+template <typename Traits>
+void BasicWand<Traits>::search_taat(TermVector& query, std::vector<DocIdScore> * result,
+        const SearchOptions * options, QueryStats * stats) {
+    search_taat(&context_, query, result, options, stats);
+}
+
+template <typename Traits>
+void BasicWand<Traits>::search_taat_v1(TermVector& query, std::vector<DocIdScore> * result) const {
     typedef std::map<IdType, ScoreType> DocIdScoreMapType;
     DocIdScoreMapType doc_map;
 
@@ -215,7 +929,7 @@ void Wand::search_taat_v1(TermVector& query, std::vector<DocIdScore> * result) c
                 }
                 IdType doc_id = doc->id;
 
-                DocIdScoreMapType::iterator it = doc_map.find(doc_id);
+                typename DocIdScoreMapType::iterator it = doc_map.find(doc_id);
                 if (it == doc_map.end()) {
                     ScoreType score = doc->get_weight(term_id) * term_weight;
                     doc_map.insert(std::make_pair(doc_id, score));
@@ -231,14 +945,15 @@ void Wand::search_taat_v1(TermVector& query, std::vector<DocIdScore> * result) c
 
     result->clear();
     result->reserve(doc_map.size());
-    DocIdScoreMapType::const_iterator first = doc_map.begin();
-    DocIdScoreMapType::const_iterator last = doc_map.end();
+    typename DocIdScoreMapType::const_iterator first = doc_map.begin();
+    typename DocIdScoreMapType::const_iterator last = doc_map.end();
     for (; first != last; ++first)
         result->push_back(DocIdScore((*first).first, (*first).second));
     std::sort(result->begin(), result->end(), DocIdScore_ScoreGreat());
 }
 
-void Wand::search_taat_v2(TermVector& query, std::vector<DocIdScore> * result) const {
+template <typename Traits>
+void BasicWand<Traits>::search_taat_v2(TermVector& query, std::vector<DocIdScore> * result) const {
     typedef std::map<IdType, ScoreType> DocIdScoreMapType;
     DocIdScoreMapType doc_map;
 
@@ -256,7 +971,7 @@ void Wand::search_taat_v2(TermVector& query, std::vector<DocIdScore> * result) c
                 }
                 IdType doc_id = doc->id;
 
-                DocIdScoreMapType::iterator it = doc_map.find(doc_id);
+                typename DocIdScoreMapType::iterator it = doc_map.find(doc_id);
                 if (it == doc_map.end()) {
                     ScoreType score = full_evaluate(query, doc);
                     doc_map.insert(std::make_pair(doc_id, score));
@@ -269,69 +984,90 @@ void Wand::search_taat_v2(TermVector& query, std::vector<DocIdScore> * result) c
 
     result->clear();
     result->reserve(doc_map.size());
-    DocIdScoreMapType::const_iterator first = doc_map.begin();
-    DocIdScoreMapType::const_iterator last = doc_map.end();
+    typename DocIdScoreMapType::const_iterator first = doc_map.begin();
+    typename DocIdScoreMapType::const_iterator last = doc_map.end();
     for (; first != last; ++first)
         result->push_back(DocIdScore((*first).first, (*first).second));
     std::sort(result->begin(), result->end(), DocIdScore_ScoreGreat());
 }
 
-std::ostream& Wand::DocIdScore::dump(std::ostream& os) const {
+template <typename Traits>
+std::ostream& BasicWand<Traits>::DocIdScore::dump(std::ostream& os) const {
     os << "  doc id: " << doc_id << ", score: " << score << "\n";
     return os;
 }
 
-std::ostream& Wand::TermPostingList::dump(std::ostream& os) const {
+template <typename Traits>
+template <typename Cursor>
+std::ostream& BasicWand<Traits>::TermPostingList<Cursor>::dump(std::ostream& os) const {
     os << "  term_id: " << term_id << "\n";
-    if (current->doc->is_sentinel()) {
+    if (Document::is_sentinel(cursor.docid())) {
         os << "    all docs processed" << "\n";
     } else {
-        os << "    current doc id: " << current->doc->id << "\n";
-        os << "    remains: " << remains << "\n";
+        os << "    current doc id: " << cursor.docid() << "\n";
+        os << "    remains: " << cursor.remains() << "\n";
     }
     os << "    weight in query: " << weight_in_query << "\n";
     return os;
 }
 
-std::ostream& Wand::dump(std::ostream& os) const {
-    os << "heap size: " << heap_size_ << "\n";
-    os << "threshold: " << threshold_ << "\n";
+template <typename Traits>
+std::ostream& BasicWand<Traits>::QueryStats::dump(std::ostream& os) const {
+    os << "cache hit: " << cache_hit << "\n";
+    os << "terms matched: " << terms_matched << "\n";
+    os << "groups matched: " << groups_matched << "\n";
+    os << "postings advanced: " << postings_advanced << "\n";
+    os << "postings skipped: " << postings_skipped << "\n";
+    os << "pivots: " << pivots << "\n";
+    os << "block skips: " << block_skips << "\n";
+    os << "filtered: " << filtered << "\n";
+    os << "evaluations: " << evaluations << "\n";
+    os << "heap insertions: " << heap_insertions << "\n";
+    os << "threshold trajectory:" << "\n";
+    for (size_t i = 0, s = threshold_trajectory.size(); i < s; i++) {
+        os << "  after " << threshold_trajectory[i].evaluations << " evaluations: "
+            << threshold_trajectory[i].threshold << "\n";
+    }
+    os << "match: " << match_ns / 1000 << " us" << "\n";
+    os << "traverse: " << traverse_ns / 1000 << " us" << "\n";
+    os << "collect: " << collect_ns / 1000 << " us" << "\n";
+    return os;
+}
+
+template <typename Traits>
+std::ostream& BasicWand<Traits>::QueryContext::dump(std::ostream& os) const {
     os << "skipped doc: " << skipped_doc_ << "\n";
     os << "current doc id: " << current_doc_id_ << "\n";
     os << "current threshold: " << current_threshold_ << "\n";
+    os << "pivot threshold: " << pivot_threshold_ << "\n";
+    os << "postings advanced: " << postings_advanced_ << "\n";
+    os << "evaluations: " << evaluations_ << "\n";
+    os << "pivots: " << pivots_ << "\n";
+    os << "block skips: " << block_skips_ << "\n";
+    os << "filtered: " << filtered_ << "\n";
+    os << "heap insertions: " << heap_insertions_ << "\n";
 
     os << "posting list:" << "\n";
-    {
-        TermPostingListSetType::const_iterator first = term_posting_list_set_.begin();
-        TermPostingListSetType::const_iterator last = term_posting_list_set_.end();
-        for (; first != last; ++first) {
-            os << (*first);
-        }
+    for (size_t i = 0, s = linked_term_posting_lists_.size(); i < s; i++) {
+        os << linked_term_posting_lists_[i];
+    }
+    for (size_t i = 0, s = array_term_posting_lists_.size(); i < s; i++) {
+        os << array_term_posting_lists_[i];
     }
 
     os << "doc heap:" << "\n";
-    {
-        DocHeapType::const_iterator first = doc_heap_.begin();
-        DocHeapType::const_iterator last = doc_heap_.end();
-        for (; first != last; ++ first) {
-            os << *first;
-        }
+    for (size_t i = 0, s = doc_heap_.size(); i < s; i++) {
+        os << doc_heap_[i];
     }
 
     return os;
 }
 
-std::ostream& operator << (std::ostream& os, const Wand::DocIdScore& doc) {
-    doc.dump(os);
-    return os;
-}
-
-std::ostream& operator << (std::ostream& os, const Wand::TermPostingList& term) {
-    term.dump(os);
+template <typename Traits>
+std::ostream& BasicWand<Traits>::dump(std::ostream& os) const {
+    os << "heap size: " << heap_size_ << "\n";
+    os << "threshold: " << threshold_ << "\n";
     return os;
 }
 
-std::ostream& operator << (std::ostream& os, const Wand& wand) {
-    wand.dump(os);
-    return os;
-}
+WAND_ENGINE_INSTANTIATE(class BasicWand)
@@ -2,12 +2,32 @@
 #define WAND_ENGINE_WAND_H
 
 #include "index.h"
+#include "posting_cursor.h"
+#include "term_group_cache.h"
 #include <ostream>
-#include <set>
 #include <vector>
 
-class Wand {
+template <typename Traits>
+class BasicResultCache;
+
+template <typename Traits>
+class BasicWand {
 public:
+    static const size_t kDefaultPrefetchDistance = 8;
+
+    typedef typename Traits::ScoreType ScoreType;
+    typedef BasicTerm<Traits> Term;
+    typedef typename BasicDocument<Traits>::TermVector TermVector;
+    typedef BasicDocument<Traits> Document;
+    typedef BasicPostingListNode<Traits> PostingListNode;
+    typedef BasicPostingList<Traits> PostingList;
+    typedef BasicPostingArray<Traits> PostingArray;
+    typedef LinkedPostingCursor<Traits> LinkedCursor;
+    typedef ArrayPostingCursor<Traits> ArrayCursor;
+    typedef BasicInvertedIndex<Traits> InvertedIndex;
+    typedef BasicTermGroupCache<Traits> TermGroupCache;
+    typedef BasicResultCache<Traits> ResultCache;
+
     struct DocIdScore {
         IdType doc_id;
         ScoreType score;
@@ -16,6 +36,11 @@ public:
         DocIdScore(IdType _doc_id, ScoreType _score) : doc_id(_doc_id), score(_score) {}
 
         std::ostream& dump(std::ostream& os) const;
+
+        friend std::ostream& operator << (std::ostream& os, const DocIdScore& doc) {
+            doc.dump(os);
+            return os;
+        }
     };
 
     struct DocIdScore_ScoreLess {
@@ -30,83 +55,406 @@ public:
         }
     };
 
+    // 'Cursor' is one of the posting cursors in posting_cursor.h.
+    template <typename Cursor>
     struct TermPostingList {
         IdType term_id;
-        const PostingList * posting_list;
-        PostingListNode * current;
-        size_t remains;
+        Cursor cursor;
         ScoreType weight_in_query;
 
         std::ostream& dump(std::ostream& os) const;
+
+        friend std::ostream& operator << (std::ostream& os, const TermPostingList& term) {
+            term.dump(os);
+            return os;
+        }
+    };
+
+    // Cursors on SearchOptions::required_terms and excluded_terms.
+    template <typename Cursor>
+    struct Constraints {
+        std::vector<Cursor> required;
+        std::vector<Cursor> excluded;
+
+        bool empty() const {
+            return required.empty() && excluded.empty();
+        }
     };
 
     struct TermPostingList_DocIdLess {
-        bool operator()(const TermPostingList& a, const TermPostingList& b) const {
-            return a.current->doc->id < b.current->doc->id;
+        template <typename TermPostingListType>
+        bool operator()(const TermPostingListType& a, const TermPostingListType& b) const {
+            return a.cursor.docid() < b.cursor.docid();
         }
     };
 
+    // Called by search_stream for every doc found, in increasing doc id order,
+    // 'arg' is the one passed to search_stream. Return false to stop the search.
+    typedef bool (*ResultCallback)(const DocIdScore& doc, void * arg);
+
+    // How Wand::search scores a candidate doc.
+    enum EvaluateMode {
+        // sum of weight in query * posting weight of the cursors positioned on the doc
+        EVALUATE_BY_POSTINGS,
+        // dot product of the query and Document::terms
+        EVALUATE_BY_DOCUMENT
+    };
+
+    struct SearchOptions {
+        // Budget of one search, 0 means unlimited.
+        // When any of them runs out, search stops and returns the best docs found so far.
+        size_t max_postings;// posting list nodes advanced
+        size_t max_evaluations;// docs fully evaluated
+        uint64_t deadline_us;// absolute time of now_us()
+
+        // Pivot selection compares upper bounds against threshold * 'threshold_factor'.
+        // Values > 1 prune more aggressively, and a doc can be missed if
+        // its score is less than 'threshold_factor' times the threshold.
+        double threshold_factor;
+
+        // Boolean constraints of search, they don't change scores.
+        // Only docs containing all of 'required_terms' and none of 'excluded_terms'
+        // are returned, other docs are skipped by the traversal and never evaluated.
+        // A required term missing from the query only selects docs.
+        std::vector<IdType> required_terms;
+        std::vector<IdType> excluded_terms;
+
+        // Predicates on InvertedIndex::attributes(), not owned, 0 means none.
+        // Like the constraints, docs failing it are skipped before they are scored,
+        // search_taat applies it to the docs above the threshold.
+        const AttributeFilter * filter;
+
+        SearchOptions() : max_postings(0), max_evaluations(0), deadline_us(0),
+            threshold_factor(1.0), required_terms(), excluded_terms(), filter(0) {}
+    };
+
+    // Execution statistics of one query, filled by search and search_taat if requested.
+    // Counters are kept in QueryContext anyway, the trajectory and the clock
+    // are only touched when statistics are requested.
+    struct QueryStats {
+        struct ThresholdPoint {
+            size_t evaluations;// docs evaluated when the threshold changed
+            ScoreType threshold;
+        };
+
+        bool cache_hit;
+        size_t terms_matched;// posting lists opened, a matched term group counts once
+        size_t groups_matched;
+        size_t postings_advanced;// search_taat: postings accumulated
+        size_t postings_skipped;// advanced by skip_to over docs never considered
+        size_t pivots;// pivots found by find_pivot
+        size_t block_skips;// pivot docs rejected by block max bounds
+        // pivot docs rejected by required or excluded terms or the filter,
+        // search_taat: docs above the threshold rejected by the filter
+        size_t filtered;
+        size_t evaluations;// search_taat: docs touched
+        // search_taat: docs above threshold before top k,
+        // search_stream: docs passed to the callback
+        size_t heap_insertions;
+        std::vector<ThresholdPoint> threshold_trajectory;
+        // time per phase in nanoseconds
+        uint64_t match_ns;// sorting the query, result cache lookup, opening posting lists
+        uint64_t traverse_ns;
+        uint64_t collect_ns;// sorting the result, result cache insertion
+
+        QueryStats() : threshold_trajectory() {
+            clear();
+        }
+
+        void clear();
+
+        std::ostream& dump(std::ostream& os) const;
+
+        friend std::ostream& operator << (std::ostream& os, const QueryStats& stats) {
+            stats.dump(os);
+            return os;
+        }
+    };
+
+    // Per query mutable state of Wand::search.
+    // One context serves one query at a time,
+    // it keeps its buffers between queries, so it can be reused without reallocation.
+    class QueryContext {
+    private:
+        friend class BasicWand;
+        typedef std::vector<DocIdScore> DocHeapType;
+
+        // Sorted by current doc id,
+        // one of them is used depending on whether the index is sealed.
+        std::vector<TermPostingList<LinkedCursor> > linked_term_posting_lists_;
+        std::vector<TermPostingList<ArrayCursor> > array_term_posting_lists_;
+        Constraints<LinkedCursor> linked_constraints_;
+        Constraints<ArrayCursor> array_constraints_;
+        // SearchOptions::filter compiled for the query
+        AttributeMatcher attribute_matcher_;
+        // min heap on score
+        DocHeapType doc_heap_;
+        std::vector<const typename TermGroupCache::Group *> matched_groups_;
+        std::vector<char> covered_terms_;
+        // search_taat: accumulators indexed by doc ordinal,
+        // and the docs touched by the current query to reset them.
+        std::vector<ScoreType> accumulators_;
+        std::vector<uint64_t> touched_bits_;
+        std::vector<const Document *> touched_docs_;
+        size_t skipped_doc_;
+        IdType current_doc_id_;
+        ScoreType current_threshold_;
+        // current_threshold_ * threshold_factor_, used by find_pivot
+        ScoreType pivot_threshold_;
+        double threshold_factor_;
+        // budget
+        size_t postings_advanced_;
+        size_t max_postings_;
+        size_t evaluations_;
+        size_t max_evaluations_;
+        uint64_t deadline_us_;
+        size_t deadline_countdown_;
+        bool approximate_;
+        // statistics, 'stats_' is 0 unless the caller asked for them
+        size_t pivots_;
+        size_t block_skips_;
+        size_t filtered_;
+        size_t heap_insertions_;
+        QueryStats * stats_;
+        uint64_t lap_begin_ns_;
+        // copied from the Wand for the static traversal helpers
+        size_t prefetch_distance_;
+        bool prefetch_docs_;
+
+        void clean(ScoreType threshold, const SearchOptions * options, QueryStats * stats);
+        // copy the counters into 'stats_'
+        void fill_stats() const;
+        // time since the last lap, used for the phases in 'stats_'
+        uint64_t lap_ns();
+
+        void set_threshold(ScoreType threshold) {
+            current_threshold_ = threshold;
+            pivot_threshold_ = threshold_factor_ == 1.0 ?
+                threshold : (ScoreType)(threshold * threshold_factor_);
+            if (stats_) {
+                typename QueryStats::ThresholdPoint point;
+                point.evaluations = evaluations_;
+                point.threshold = threshold;
+                stats_->threshold_trajectory.push_back(point);
+            }
+        }
+
+    public:
+        QueryContext()
+            : linked_term_posting_lists_(), array_term_posting_lists_(),
+            linked_constraints_(), array_constraints_(), attribute_matcher_(), doc_heap_(),
+            matched_groups_(), covered_terms_(),
+            accumulators_(), touched_bits_(), touched_docs_(),
+            skipped_doc_(0), current_doc_id_(0), current_threshold_(0),
+            pivot_threshold_(0), threshold_factor_(1.0),
+            postings_advanced_(0), max_postings_(0),
+            evaluations_(0), max_evaluations_(0),
+            deadline_us_(0), deadline_countdown_(0),
+            approximate_(false), pivots_(0), block_skips_(0), filtered_(0), heap_insertions_(0),
+            stats_(0), lap_begin_ns_(0),
+            prefetch_distance_(0), prefetch_docs_(false) {
+        }
+
+        // whether the last search ran out of its budget
+        bool approximate() const {
+            return approximate_;
+        }
+
+        std::ostream& dump(std::ostream& os) const;
+
+        friend std::ostream& operator << (std::ostream& os, const QueryContext& ctx) {
+            ctx.dump(os);
+            return os;
+        }
+
+    private:
+        QueryContext(QueryContext& other);
+        QueryContext& operator=(QueryContext& other);
+    };
+
 private:
-    typedef std::multiset<TermPostingList, TermPostingList_DocIdLess> TermPostingListSetType;
-    typedef std::multiset<DocIdScore, DocIdScore_ScoreLess> DocHeapType;
     const InvertedIndex& ii_;
     const size_t heap_size_;
     const ScoreType threshold_;
-    size_t skipped_doc_;
-    IdType current_doc_id_;
-    ScoreType current_threshold_;
-    TermPostingListSetType term_posting_list_set_;
-    DocHeapType doc_heap_;
-    int verbose_;
+    ResultCache * result_cache_;
+    const TermGroupCache * term_group_cache_;
+    EvaluateMode evaluate_mode_;
+    size_t prefetch_distance_;
+    // used by the single threaded 'search'
+    QueryContext context_;
 
 private:
     static ScoreType dot_product(const TermVector& query, const TermVector& doc);
     static ScoreType full_evaluate(const TermVector& query, const Document * doc);
-    void match_terms(const TermVector& query);
-    void advance_term_posting_list(const TermPostingListSetType::const_iterator& to_advance,
+    static bool out_of_budget(QueryContext * ctx);
+
+    // Traversal over one type of posting cursor, 'tpls' is one of the vectors in 'ctx'.
+    template <typename Cursor>
+    static ScoreType evaluate_postings(const std::vector<TermPostingList<Cursor> >& tpls,
             IdType doc_id);
-    bool find_pivot(TermPostingListSetType::const_iterator * pivot) const;
-    TermPostingListSetType::const_iterator
-        pick_term(const TermPostingListSetType::const_iterator& pivot) const;
-    bool next(TermPostingListSetType::const_iterator * next_term);
-
-    void clean() {
-        skipped_doc_ = 0;
-        current_doc_id_ = 0;
-        current_threshold_ = threshold_;
-        term_posting_list_set_.clear();
-        doc_heap_.clear();
-    }
+    template <typename Cursor>
+    static void add_term_posting_list(std::vector<TermPostingList<Cursor> > * tpls,
+            IdType term_id, const PostingList * posting_list, ScoreType weight_in_query);
+    template <typename Cursor>
+    void match_terms(QueryContext * ctx, std::vector<TermPostingList<Cursor> > * tpls,
+            const TermVector& query) const;
+    // Reset 'ctx' for 'query' and sort it,
+    // return false if no doc can pass the filter of 'options'.
+    bool begin_query(QueryContext * ctx, TermVector& query,
+            const SearchOptions * options, QueryStats * stats) const;
+    // Open the cursors of 'query' and 'options', none if not 'matchable'.
+    template <typename Cursor>
+    void match_query(QueryContext * ctx, std::vector<TermPostingList<Cursor> > * tpls,
+            Constraints<Cursor> * constraints, const TermVector& query,
+            const SearchOptions * options, bool matchable) const;
+    // Compile SearchOptions::filter into ctx->attribute_matcher_,
+    // return false if no doc can pass it.
+    bool compile_filter(QueryContext * ctx, const SearchOptions * options) const;
+    // Return false if a required term is in no doc, then nothing can match.
+    template <typename Cursor>
+    bool open_constraints(const SearchOptions * options, Constraints<Cursor> * constraints) const;
+    // the first doc id >= 'doc_id' containing all required terms
+    template <typename Cursor>
+    static IdType align_required(QueryContext * ctx, Constraints<Cursor> * constraints,
+            IdType doc_id);
+    template <typename Cursor>
+    static bool is_excluded(QueryContext * ctx, Constraints<Cursor> * constraints,
+            IdType doc_id);
+    template <typename Cursor>
+    static void advance_term_posting_list(QueryContext * ctx,
+            std::vector<TermPostingList<Cursor> > * tpls, size_t to_advance, IdType doc_id);
+    template <typename Cursor>
+    static bool find_pivot(const QueryContext * ctx,
+            const std::vector<TermPostingList<Cursor> >& tpls, size_t * pivot);
+    template <typename Cursor>
+    static size_t pick_term(const std::vector<TermPostingList<Cursor> >& tpls, size_t pivot);
+    template <typename Cursor>
+    static bool next(QueryContext * ctx, std::vector<TermPostingList<Cursor> > * tpls,
+            Constraints<Cursor> * constraints, size_t * next_term);
+    // score of the pivot doc
+    template <typename Cursor>
+    ScoreType evaluate(const std::vector<TermPostingList<Cursor> >& tpls, size_t pivot,
+            const TermVector& query) const;
+    // fill ctx->doc_heap_
+    template <typename Cursor>
+    void search_cursors(QueryContext * ctx, std::vector<TermPostingList<Cursor> > * tpls,
+            Constraints<Cursor> * constraints, const TermVector& query) const;
+    // Return false if 'callback' stopped it.
+    template <typename Cursor>
+    bool stream_cursors(QueryContext * ctx, std::vector<TermPostingList<Cursor> > * tpls,
+            Constraints<Cursor> * constraints, const TermVector& query,
+            ResultCallback callback, void * arg) const;
+    template <typename Cursor>
+    static void accumulate(QueryContext * ctx, Cursor cursor, ScoreType weight_in_query);
+    // Sealed lists are walked by position, without decoding doc ids.
+    static void accumulate(QueryContext * ctx, const PostingArray& array,
+            ScoreType weight_in_query);
+    // Append the docs of a batch of search_taat passing the filter to 'result',
+    // return how many are filtered out.
+    static size_t collect_filtered(const QueryContext * ctx,
+            const IdType * doc_ids, const OrdinalType * ordinals, const ScoreType * scores,
+            size_t count, std::vector<DocIdScore> * result);
 
 public:
-    explicit Wand(
+    explicit BasicWand(
         const InvertedIndex& ii,
         size_t heap_size = 1000,
         ScoreType threshold = 0)
         : ii_(ii), heap_size_(heap_size), threshold_(threshold),
-        skipped_doc_(0), current_doc_id_(0),
-        current_threshold_(threshold),
-        term_posting_list_set_(), doc_heap_(),
-        verbose_(0) {
+        result_cache_(0), term_group_cache_(0),
+        evaluate_mode_(EVALUATE_BY_POSTINGS),
+        prefetch_distance_(kDefaultPrefetchDistance),
+        context_() {
     }
 
-    void search(TermVector& query, std::vector<DocIdScore> * result);
+    // Return false if the search ran out of budget in 'options',
+    // then 'result' is the best docs found so far.
+    // If 'stats' is not 0, it is overwritten with the statistics of this query.
+    // Thread safe as long as every thread uses its own 'ctx'.
+    bool search(QueryContext * ctx, TermVector& query, std::vector<DocIdScore> * result,
+            const SearchOptions * options = 0, QueryStats * stats = 0) const;
+    // Not thread safe, it uses the context owned by this Wand.
+    bool search(TermVector& query, std::vector<DocIdScore> * result,
+            const SearchOptions * options = 0, QueryStats * stats = 0);
+    // Threshold only search, without a top k heap: every doc scoring above the threshold
+    // of this Wand is passed to 'callback' as soon as the traversal finds it,
+    // so the caller can start on results early and stop once it has enough.
+    // Memory use doesn't depend on the number of results, heap_size is ignored,
+    // and the result cache isn't used. 'options' apply like in 'search',
+    // QueryStats::traverse_ns includes the time spent in 'callback'.
+    // Return false if the search ran out of budget or 'callback' stopped it.
+    bool search_stream(QueryContext * ctx, TermVector& query, ResultCallback callback, void * arg,
+            const SearchOptions * options = 0, QueryStats * stats = 0) const;
+    // Not thread safe, it uses the context owned by this Wand.
+    bool search_stream(TermVector& query, ResultCallback callback, void * arg,
+            const SearchOptions * options = 0, QueryStats * stats = 0);
+    // Evaluate many queries in one pass over the posting lists of their terms,
+    // each posting list is walked once for all queries containing that term,
+    // through its arrays once the index is sealed.
+    // (*results)[i] is what 'search' returns for queries[i](except the order of equal scores).
+    // Memory use is proportional to the number of matched docs of the whole batch,
+    // so huge query streams should be split into batches.
+    void search_batch(const std::vector<TermVector>& queries,
+            std::vector<std::vector<DocIdScore> > * results) const;
+    // Term at a time, returns the same docs as 'search'(except the order of equal scores).
+    // Its memory is O(doc count of the index) per 'ctx',
+    // it may beat 'search' for very long queries.
+    // Only SearchOptions::filter of 'options' is used.
+    void search_taat(QueryContext * ctx, TermVector& query, std::vector<DocIdScore> * result,
+            const SearchOptions * options = 0, QueryStats * stats = 0) const;
+    // Not thread safe, it uses the context owned by this Wand.
+    void search_taat(TermVector& query, std::vector<DocIdScore> * result,
+            const SearchOptions * options = 0, QueryStats * stats = 0);
     // only for comparison
     void search_taat_v1(TermVector& query, std::vector<DocIdScore> * result) const;
     void search_taat_v2(TermVector& query, std::vector<DocIdScore> * result) const;
 
-    void set_verbose(int verbose) {
-        verbose_ = verbose;
+    size_t heap_size() const {
+        return heap_size_;
+    }
+
+    ScoreType threshold() const {
+        return threshold_;
+    }
+
+    // Options below must not be changed while searching.
+
+    // Optional, 'cache' is not owned and may be shared by many Wand instances.
+    // Searches with required or excluded terms, a filter or a threshold factor don't use it.
+    void set_result_cache(ResultCache * cache) {
+        result_cache_ = cache;
+    }
+
+    // Optional, 'cache' is not owned.
+    // Its groups are used only if they were built on the current version of the index.
+    void set_term_group_cache(const TermGroupCache * cache) {
+        term_group_cache_ = cache;
+    }
+
+    void set_evaluate_mode(EvaluateMode mode) {
+        evaluate_mode_ = mode;
+    }
+
+    // Postings ahead of the cursors to prefetch, 0 disables prefetching.
+    // search prefetches for the cursors up to the pivot,
+    // and the pivot doc in EVALUATE_BY_DOCUMENT mode,
+    // search_taat prefetches the docs whose accumulators are updated next.
+    void set_prefetch_distance(size_t distance) {
+        prefetch_distance_ = distance;
     }
 
     std::ostream& dump(std::ostream& os) const;
 private:
-    Wand(Wand& other);
-    Wand& operator=(Wand& other);
+    BasicWand(BasicWand& other);
+    BasicWand& operator=(BasicWand& other);
 };
 
-std::ostream& operator << (std::ostream& os, const Wand::DocIdScore& doc);
-std::ostream& operator << (std::ostream& os, const Wand::TermPostingList& term);
-std::ostream& operator << (std::ostream& os, const Wand& wand);
+template <typename Traits>
+inline std::ostream& operator << (std::ostream& os, const BasicWand<Traits>& wand) {
+    wand.dump(os);
+    return os;
+}
+
+typedef BasicWand<DefaultScoreTraits> Wand;
 
 #endif// WAND_ENGINE_WAND_H